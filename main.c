@@ -1,15 +1,66 @@
+/* madvise, pread/pwrite, strnlen e strdup também com -std=c11 */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
 #include <unistd.h>
-
-
-#define MAX_PRODUTOS 200
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIPRI_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__linux__)
+#define SIPRI_EPOLL 1
+#include <sys/epoll.h>
+#endif
+
+/* o cálculo em lote (SIMD) precisa dar exatamente o mesmo resultado do
+   escalar: proíbe o compilador de fundir a*b+c em FMA em um só dos caminhos */
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+/* motor de preço: em double (padrão) ou em centavos inteiros (int64), para
+   auditoria com resultado exato e igual em qualquer máquina. Compile com
+   -DSIPRI_CENTAVOS=1 para o segundo */
+#ifndef SIPRI_CENTAVOS
+#define SIPRI_CENTAVOS 0
+#endif
+
+
+#define CATALOGO_CAP_INICIAL 64
+/* compacta quando as lápides passam deste percentual dos slots */
+#define FRAGMENTACAO_MAX_PERCENT 25
+#define FRAGMENTACAO_MIN_LAPIDES 64
+#define LOTE_REGISTROS 256
 #define MAX_NOME 80
 #define MAX_DESC 512
 #define MAX_INGR 100
 #define BUF_SIZE 512
+#define DINHEIRO_TAM 32     /* buffer de dinheiroTexto */
+/* maior valor (em módulo) aceito num campo numérico: R$ 100 bilhões. Com
+   isso as contas do motor em centavos cabem em int64 com folga */
+#define VALOR_MAX 1e11
 
 /* Códigos de cores ANSI */
 #define RESET   "\033[0m"
@@ -25,9 +76,14 @@
 #define ARQ_PRODUTOS "produtos.dat"
 #define ARQ_PRODUTOS_TMP "produtos.tmp"
 #define ARQ_PRODUTOS_BAK "produtos.bak"
+#define ARQ_PRODUTOS_QUARENTENA "produtos.quarentena"
+#define ARQ_PRODUTOS_WAL "produtos.wal"
 #define ARQ_CONFIG "config.dat"
 #define ARQ_CONFIG_TMP "config.tmp"
 #define ARQ_CONFIG_BAK "config.bak"
+#define ARQ_INGREDIENTES "ingredientes.dat"
+#define ARQ_INGREDIENTES_TMP "ingredientes.tmp"
+#define ARQ_INGREDIENTES_BAK "ingredientes.bak"
 
 /* Configurações globais de despesas fixas (mensais) */
 struct Config {
@@ -37,6 +93,10 @@ struct Config {
     int producao_mensal_unidades;
 } config;
 
+/* incrementado a cada mudança de config: preços calculados com versão
+   anterior estão desatualizados e são refeitos sob demanda */
+unsigned config_versao = 1;
+
 /* Estrutura de produto */
 struct Produto {
     char nome[MAX_NOME];
@@ -54,6 +114,466 @@ struct Produto {
     double preco_produtor;
 };
 
+/* Tabela de ingredientes compartilhada pelas receitas (ingredientes.dat).
+   O id de um ingrediente é a posição dele na tabela e nunca muda. Cada
+   linha de receita liga um produto (pelo nome, que é único e não muda na
+   compactação do catálogo) a um ingrediente e à quantidade usada; as linhas
+   de um mesmo produto ficam contíguas. investimento_total e
+   ingredientes_desc dos produtos em modo receita são derivados dessas
+   linhas e refeitos quando o preço de um ingrediente muda.
+   Um produto usado como insumo de outra receita (sub-receita) entra na
+   tabela como ingrediente INGR_PRODUTO, com o mesmo nome do produto e o
+   custo unitário dele (sem o rateio das despesas fixas, que o produto final
+   já recebe) como preço: ingrediente -> receita -> sub-receita formam um
+   grafo sem ciclos, recalculado em ordem topológica */
+enum { INGR_POR_KG = 1, INGR_POR_UNIDADE = 2, INGR_PRODUTO = 3 };
+
+struct Ingrediente {
+    char nome[MAX_NOME];
+    int tipo;               /* INGR_POR_KG: quantidade em gramas; senão em unidades */
+    double preco;           /* por kg ou por unidade */
+};
+
+struct ItemReceita {
+    char produto[MAX_NOME];
+    int ingrediente;
+    double quantidade;
+};
+
+/* usos[inicio_uso[g] .. inicio_uso[g + 1]) são as linhas que usam o
+   ingrediente g, em ordem crescente (índice reverso, montado sob demanda e
+   descartado quando as linhas mudam) */
+struct TabelaIngredientes {
+    struct Ingrediente *itens;
+    unsigned *hash;         /* nomeHash do nome normalizado de cada item */
+    int qtd;
+    int capacidade;
+    struct ItemReceita *linhas;
+    int qtd_linhas;
+    int capacidade_linhas;
+    int *inicio_uso;
+    int *usos;
+    int usos_validos;
+} ingredientes;
+
+/* Colunas "quentes" do catálogo (struct-of-arrays): só os campos numéricos
+   que o cálculo de preço lê e escreve, cada um contíguo na memória */
+#define COLUNAS_PRECO(X) \
+    X(int, modo) \
+    X(int, rendimento) \
+    X(int, usar_mei_comercio) \
+    X(double, preco_custo) \
+    X(double, investimento_total) \
+    X(double, despesas_variaveis) \
+    X(double, imposto_percent) \
+    X(double, taxa_cartao_percent) \
+    X(double, lucro_produtor_percent) \
+    X(double, custo_unitario) \
+    X(double, preco_produtor)
+
+struct ColunasPreco {
+#define X(tipo, campo) tipo *campo;
+    COLUNAS_PRECO(X)
+#undef X
+};
+
+/* Textos "frios" (nome e ingredientes) ficam numa arena de blocos que não
+   se movem; o catálogo guarda só ponteiros para as strings */
+#define ARENA_BLOCO 65536
+
+struct BlocoTexto {
+    struct BlocoTexto *prox;
+    size_t usado;
+    size_t tamanho;
+    char dados[];
+};
+
+struct ArenaTexto {
+    struct BlocoTexto *blocos;
+    size_t total;       /* bytes ocupados por strings */
+    size_t desperdicio; /* bytes de strings substituídas/excluídas */
+};
+
+/* Índice de nomes: hash com endereçamento aberto (sondagem linear) sobre o
+   nome normalizado. Cada posição guarda o índice do produto (-1 vazia,
+   -2 removida) e o hash completo, para só comparar nomes quando os hashes
+   batem. Fica vazio (capacidade 0) até a primeira busca ou até o fim da
+   carga, e aí é montado de uma vez com o tamanho certo */
+#define INDICE_VAZIO (-1)
+#define INDICE_REMOVIDO (-2)
+
+struct IndiceNome {
+    int *idx;
+    unsigned *hash;
+    size_t capacidade;  /* potência de 2 */
+    size_t usados;      /* posições ocupadas, removidas incluídas */
+};
+
+/* Índice de trigramas para busca por trecho em nome e ingredientes: cada
+   trigrama (3 bytes seguidos do texto normalizado) aponta para a lista, em
+   ordem crescente, dos produtos que o contêm. A busca intersecta as listas
+   dos trigramas da consulta, começando pela menor, e confirma cada
+   candidato no texto. Montado na primeira busca; depois disso, mantido a
+   cada gravação que muda textos e a cada exclusão */
+struct ListaTrigrama {
+    unsigned chave;     /* 3 bytes + 1 (0 = posição vazia) */
+    int qtd;
+    int capacidade;
+    int *idx;
+};
+
+struct IndiceTrigrama {
+    struct ListaTrigrama *listas;
+    size_t capacidade;  /* potência de 2; 0 = não montado */
+    size_t usadas;
+};
+
+/* Índices ordenados por preço final, custo unitário e margem efetiva:
+   entradas (chave, slot) em ordem crescente, guardadas em blocos de até
+   ORDEM_BLOCO entradas (uma B+tree de dois níveis: o vetor de blocos é a
+   raiz, cada bloco uma folha). Faixa e top-K saem com duas buscas binárias
+   e uma caminhada pelos blocos (O(log n + k)); inserir/remover mexe em um
+   bloco só. Como os preços dependem da config, o conjunto vale para uma
+   config_versao: mudou a config, é remontado (ordenação) na próxima
+   consulta. Enquanto vale, cada gravação reprecifica o produto na hora e
+   move só a entrada dele */
+#define ORDEM_BLOCO 256
+
+enum { ORDEM_PRECO, ORDEM_CUSTO, ORDEM_MARGEM, NUM_ORDENS };
+
+struct EntradaOrdem {
+    double chave;
+    int idx;
+};
+
+struct BlocoOrdem {
+    int qtd;
+    struct EntradaOrdem e[ORDEM_BLOCO];
+};
+
+struct IndiceOrdem {
+    struct BlocoOrdem **blocos;
+    int qtd_blocos;
+    int cap_blocos;
+    int qtd;
+};
+
+/* posição de uma entrada num índice: bloco + posição dentro do bloco */
+struct CursorOrdem {
+    const struct IndiceOrdem *o;
+    int bloco;
+    int pos;
+};
+
+struct IndicesOrdenados {
+    struct IndiceOrdem ordem[NUM_ORDENS];
+    unsigned versao;    /* config_versao da montagem; 0 = não montado */
+};
+
+/* slots alterados desde a última vez que alguém (o servidor) olhou; tudo:
+   os slots mudaram de lugar (carga, compactação) ou a lista não coube */
+struct Alteracoes {
+    int *idx;
+    int qtd;
+    int capacidade;
+    int tudo;
+};
+
+/* Catálogo de produtos: motor de armazenamento hot/cold sem limite fixo.
+   versao_preco[i] guarda a config_versao usada no último cálculo do item i
+   (0 = nunca calculado nesta sessão); itens com versão diferente da atual
+   formam o conjunto "sujo", reprecificado na leitura ou ao salvar.
+   Exclusão é O(1): o slot vira lápide (excluido[i] = 1, textos NULL) e vai
+   para a pilha de livres, reaproveitada pelo próximo cadastro. qtd conta os
+   slots, lápides incluídas; a compactação remove as lápides de uma vez */
+struct Catalogo {
+    struct ColunasPreco col;
+    unsigned *versao_preco;
+    unsigned versao_salva;  /* config_versao dos preços gravados em disco */
+    const char **nome;
+    const char **ingredientes_desc;
+    struct ArenaTexto textos;
+    unsigned char *excluido;
+    int *livres;                /* pilha de slots com lápide */
+    int qtd_livres;
+    struct IndiceNome indice_nome;
+    struct IndiceTrigrama indice_texto;
+    struct IndicesOrdenados ordenados;
+    int qtd;
+    int capacidade;
+    int registros_corrompidos;  /* checksum inválido na última carga */
+    /* produtos.dat mapeado (só leitura): textos de produtos não editados
+       apontam direto para cá, sem cópia */
+    const char *mapa;
+    size_t mapa_tamanho;
+    int mapa_no_heap;           /* mmap indisponível: arquivo lido para o heap */
+    struct Alteracoes *alteracoes;  /* NULL: ninguém acompanha */
+};
+
+/* Registro de produtos.dat: o produto seguido de selo e checksum, para
+   reconhecer um registro rasgado por escrita interrompida no meio. Cada
+   registro ocupa um múltiplo de 64 bytes (linha de cache): com o cabeçalho
+   também de 64 em 64, todo registro do arquivo mapeado começa alinhado */
+#define REGISTRO_SELO 0x52504953u /* "SIPR" */
+#define REGISTRO_LAPIDE 0x58504953u /* "SIPX": produto excluído, slot livre */
+#define VERSAO_CORROMPIDA 0xffffffffu
+#define FORMATO_ALINHAMENTO 64
+
+struct RegistroProduto {
+    _Alignas(FORMATO_ALINHAMENTO) struct Produto produto;
+    unsigned selo;
+    unsigned crc;       /* crc32 de produto + selo; o resto é preenchimento zerado */
+};
+
+/* Formato versionado de produtos.dat: cabeçalho com a quantidade de
+   registros, a versão do esquema, um marcador de ordem dos bytes e o
+   deslocamento/tamanho de cada campo do registro. Um arquivo com os mesmos
+   campos em outra disposição (outro compilador/plataforma) é lido campo a
+   campo pelos deslocamentos; layouts sem cabeçalho são convertidos na carga */
+#define FORMATO_MAGIC "SIPRIDAT"
+#define FORMATO_ESQUEMA 1
+#define FORMATO_ORDEM 0x01020304u
+#define FORMATO_MAX_CAMPOS 16
+
+#define CAMPOS_PRODUTO(X) \
+    X(nome) \
+    X(modo) \
+    X(preco_custo) \
+    X(investimento_total) \
+    X(rendimento) \
+    X(ingredientes_desc) \
+    X(despesas_variaveis) \
+    X(usar_mei_comercio) \
+    X(imposto_percent) \
+    X(taxa_cartao_percent) \
+    X(lucro_produtor_percent) \
+    X(custo_unitario) \
+    X(preco_produtor)
+
+enum {
+#define X(campo) CAMPO_##campo,
+    CAMPOS_PRODUTO(X)
+#undef X
+    NUM_CAMPOS
+};
+
+struct CabecalhoProdutos {
+    char magic[8];
+    unsigned ordem;             /* FORMATO_ORDEM na ordem de bytes de quem gravou */
+    unsigned esquema;
+    unsigned tam_cabecalho;     /* os registros começam aqui */
+    unsigned tam_registro;
+    unsigned long long qtd;
+    unsigned num_campos;
+    unsigned short offset_campo[FORMATO_MAX_CAMPOS];
+    unsigned short tamanho_campo[FORMATO_MAX_CAMPOS];
+    unsigned short offset_selo;
+    unsigned short offset_crc;  /* o crc cobre os bytes do registro antes dele */
+    char reservado[20];
+    unsigned crc;               /* crc32 do cabeçalho antes deste campo */
+};
+
+_Static_assert(sizeof(struct CabecalhoProdutos) % FORMATO_ALINHAMENTO == 0, "cabecalho desalinhado");
+_Static_assert(sizeof(struct RegistroProduto) % FORMATO_ALINHAMENTO == 0, "registro desalinhado");
+_Static_assert(NUM_CAMPOS <= FORMATO_MAX_CAMPOS, "campos demais no cabecalho");
+
+/* layouts antigos de produtos.dat (sem cabeçalho) */
+enum {
+    FORMATO_ATUAL,          /* cabeçalho e disposição iguais aos deste binário */
+    FORMATO_CAMPOS,         /* cabeçalho válido, campos em outra disposição */
+    FORMATO_SELADO,         /* registros de 688 bytes com selo/crc, sem cabeçalho */
+    FORMATO_CRU,            /* struct Produto cru (versões até a 0.5) */
+    FORMATO_FLOAT,          /* struct de floats do projetosipri */
+    FORMATO_DESCONHECIDO
+};
+
+#define TAM_SELADO (sizeof(struct Produto) + 2 * sizeof(unsigned))
+
+struct ProdutoFloat {
+    char nome[50];
+    float custo;
+    float despesas;
+    float lucro_desejado;
+    float preco_ideal;
+    float valor_lucro;
+    float imposto;
+};
+
+/* ingredientes.dat: cabeçalho + ingredientes + linhas das receitas */
+#define INGREDIENTES_MAGIC "SIPRIING"
+#define INGREDIENTES_ESQUEMA 2     /* 2: INGR_PRODUTO */
+
+struct CabecalhoIngredientes {
+    char magic[8];
+    unsigned ordem;
+    unsigned esquema;
+    unsigned tamanho_item;      /* sizeof(struct Ingrediente) de quem gravou */
+    unsigned tamanho_linha;     /* sizeof(struct ItemReceita) */
+    unsigned qtd;
+    unsigned qtd_linhas;
+    unsigned crc;               /* crc32 do cabeçalho antes deste campo + dados */
+};
+
+/* config.dat: cabeçalho curto + struct Config */
+#define CONFIG_MAGIC "SIPRICFG"
+#define CONFIG_ESQUEMA 1
+
+struct CabecalhoConfig {
+    char magic[8];
+    unsigned ordem;
+    unsigned esquema;
+    unsigned tamanho;           /* sizeof(struct Config) de quem gravou */
+    unsigned crc;               /* crc32 do cabeçalho antes deste campo + config */
+};
+
+/* Diário (write-ahead log) de alterações em produtos.dat: cada inserção,
+   edição ou exclusão vira uma entrada anexada ao log. O base publicado não é
+   alterado no lugar (ver struct Compartilhamento): as entradas ficam no log
+   até a próxima consolidação, que grava um produtos.dat novo. O cabeçalho
+   amarra o log ao inode do base: depois da consolidação, o log antigo não
+   casa mais e nunca é reaplicado */
+#define DIARIO_MAGIC "SIPRIWAL"
+#define DIARIO_LIMITE_MIN (1 << 20) /* log >= 1 MB (e >= metade do base) é consolidado */
+enum { LOG_INSERIR = 1, LOG_ATUALIZAR = 2, LOG_EXCLUIR = 3 };
+
+struct CabecalhoDiario {
+    char magic[8];
+    unsigned long long base_ino;
+    long long reservado;
+};
+
+struct EntradaDiario {
+    unsigned tipo;
+    int idx;
+    unsigned tamanho;   /* bytes de struct Produto após a entrada (0 na exclusão) */
+    unsigned crc;       /* crc32 de tipo/idx/tamanho + produto */
+};
+
+struct Diario {
+    int fd;             /* -1: sem log, cada alteração regrava o arquivo */
+    char *buf;          /* entradas ainda não confirmadas (group commit) */
+    size_t usado;
+    size_t capacidade;
+    long long tamanho;  /* bytes confirmados no arquivo de log */
+    int base_fd;        /* produtos.dat aberto para anexar (importação) */
+    unsigned long long base_ino;
+    long long base_tamanho;
+    unsigned long long base_qtd;    /* quantidade gravada no cabeçalho do base */
+    int desalinhado;    /* anexar falhou: base só vale após consolidar */
+} diario = { -1, NULL, 0, 0, 0, -1, 0, 0, 0, 1 };
+
+/* Vários processos (caixas, terminais, o modo lote) no mesmo diretório.
+   Cada produtos.dat publicado é um instantâneo imutável: alterações só vão
+   para o fim do log (ou, na importação, para depois do último registro) e a
+   consolidação grava um arquivo novo, com outro inode; quem ainda tem o
+   antigo mapeado continua lendo a versão dele (MVCC). config.dat e
+   ingredientes.dat já são trocados inteiros por rename.
+   produtos.lck é o ponto único de confirmação: quem grava pega a trava
+   exclusiva (fcntl) só para confirmar, alcança ali o estado mais recente
+   (reaplica o que os outros confirmaram), revalida, grava e publica no
+   próprio produtos.lck o estado novo: geração, versão de cada arquivo e o
+   tamanho confirmado do log. Leitores nunca pegam a trava: comparam a
+   geração e, se mudou, aplicam o log só até o tamanho publicado (um
+   confirmar inteiro, nunca metade de um group commit) ou remapeiam o base */
+#define ARQ_PRODUTOS_LCK "produtos.lck"
+#define ARQ_PRODUTOS_WAL_TMP "produtos.wal.tmp"
+#define SINCRONIZAR_TENTATIVAS 50
+enum { ALTEROU_LOG = 1, ALTEROU_BASE = 2, ALTEROU_CONFIG = 4, ALTEROU_INGREDIENTES = 8 };
+
+struct EstadoCompartilhado {
+    unsigned long long geracao;         /* muda a cada confirmação */
+    unsigned long long versao_base;     /* produtos.dat novo, anexado ou log zerado */
+    unsigned long long versao_config;
+    unsigned long long versao_ingredientes;
+    unsigned long long base_ino;
+    long long log_tamanho;              /* bytes confirmados do log desse base */
+    unsigned crc;
+    unsigned reservado;
+};
+
+struct Compartilhamento {
+    int fd;             /* produtos.lck; -1: sem coordenação (só este processo) */
+    int aberto;         /* já tentou abrir produtos.lck */
+    int travado;        /* profundidade da trava de gravação */
+    int alterou;        /* ALTEROU_* gravados desde que travou */
+    int produtos_em_dia;    /* catálogo alcançou o estado mais recente sob a trava */
+    long long limite_log;   /* leitura sem trava aplica o log só até aqui (-1: tudo) */
+    struct EstadoCompartilhado visto;   /* estado que a memória reflete */
+} compartilhado = { -1, 0, 0, 0, 0, -1, { ~0ULL, ~0ULL, ~0ULL, ~0ULL, 0, 0, 0, 0 } };
+
+/* Esteira de lote: importação e regravação completa rodam em três estágios.
+   Um leitor divide a entrada em tarefas numeradas, trabalhadores processam
+   as tarefas em paralelo e o gravador (a thread que chamou) consome os
+   resultados na mesma ordem da entrada. A tarefa seq vai sempre para o
+   trabalhador seq % n e cada par de estágios conversa por anéis sem trava de
+   um produtor e um consumidor: para manter a ordem, o gravador só lê os anéis
+   de saída em rodízio. Os buffers circulam (livres -> entrada -> saída ->
+   livres), então a memória em uso é fixa */
+#define ESTEIRA_MAX_TRABALHADORES 32
+#define ESTEIRA_PROFUNDIDADE 4      /* tarefas em circulação por trabalhador */
+#define ESTEIRA_LOTE 1024           /* registros por tarefa */
+
+struct TarefaLote {
+    long seq;
+    int ultima;                 /* sentinela: a entrada acabou */
+    /* entrada: trecho do arquivo importado ou faixa do catálogo */
+    const char *ini;
+    const char *fim;
+    long linha;
+    int primeiro;
+    /* resultado, um registro selado por linha/produto */
+    int qtd;
+    int ajustes;
+    struct RegistroProduto *reg;    /* ESTEIRA_LOTE registros */
+    unsigned char *estado;
+    long *linha_reg;
+};
+
+struct AnelTarefas {
+    _Alignas(64) atomic_size_t cabeca;  /* só o consumidor escreve */
+    _Alignas(64) atomic_size_t cauda;   /* só o produtor escreve */
+    _Alignas(64) struct TarefaLote *itens[ESTEIRA_PROFUNDIDADE];
+};
+
+struct Esteira {
+    int (*preparar)(struct TarefaLote *t, void *ctx);    /* leitor; 0 = fim */
+    void (*processar)(struct TarefaLote *t, void *ctx);  /* em paralelo */
+    int (*consumir)(struct TarefaLote *t, void *ctx);    /* em ordem; 0 = erro */
+    void *ctx;
+    int n;
+    atomic_int parar;
+    struct AnelTarefas livres[ESTEIRA_MAX_TRABALHADORES];
+    struct AnelTarefas entrada[ESTEIRA_MAX_TRABALHADORES];
+    struct AnelTarefas saida[ESTEIRA_MAX_TRABALHADORES];
+};
+
+/* Executor paralelo das passadas pelo catálogo inteiro (reprecificar,
+   montar índices, exportar): [0, n) é cortado em pedaços de grao itens e
+   cada trabalhador começa com um trecho contíguo de pedaços no seu deque.
+   O dono tira pedaços da frente; quem fica sem nada rouba a metade de trás
+   do deque de outro. Os cortes não dependem de quem executa, então cada
+   pedaço dá o mesmo resultado em qualquer thread, e juntar (a saída do
+   export) roda na thread que chamou, na ordem dos pedaços. A thread que
+   chama é o trabalhador 0; as outras sobem na primeira passada e ficam à
+   espera das seguintes. Uma passada pedida enquanto outra roda (de outra
+   thread ou de dentro de um pedaço) roda inteira em quem pediu */
+#define PARALELO_MAX_TRABALHADORES 64
+
+struct Paralelo {
+    void (*corpo)(int ini, int fim, int w, void *ctx);  /* um pedaço; w: trabalhador */
+    void (*juntar)(int pedaco, void *ctx);              /* opcional: em ordem, em quem chamou */
+    void *ctx;
+    int n;
+    int grao;
+};
+
+/* trabalhadores da esteira e do executor: -1 = um por processador, 0 =
+   tudo na thread que chamou (sem threads) */
+int lote_trabalhadores = -1;
+/* --deterministic: o executor não rouba trabalho, cada trabalhador faz
+   sempre o mesmo trecho */
+int paralelo_deterministico = 0;
+
 /* ----- Prototypes ----- */
 void imprimir_aviso(const char *msg);
 void imprimir_erro(const char *msg);
@@ -63,21 +583,93 @@ void imprimir_secao(const char *titulo);
 void limpar_tela();
 void pausar();
 void lerLinha(char *buf, int n);
-double coletarIngredientesText(char *descricao, int descSize, int *rendimento);
+double coletarIngredientes(struct Catalogo *cat, const char *produto, struct ItemReceita *itens,
+                           int *qtd_itens, char *descricao, int descSize, int *rendimento);
+int ingredienteBuscar(const char *nome);
+int ingredienteAdicionar(const char *nome, int tipo, double preco);
+double ingredienteCusto(const struct Ingrediente *g, double quantidade);
+int ingredientesPropagar(struct Catalogo *cat, const int *alterados, int n);
+int ingredientesAlterarPrecos(struct Catalogo *cat, const int *ids, const double *precos, int n);
+int produtoPropagar(struct Catalogo *cat, int idx);
+double custoBaseProduto(const struct ColunasPreco *c, int i);
+int receitaDefinir(const char *produto, const struct ItemReceita *itens, int n);
+int receitaRemover(const char *produto);
+int receitaRenomear(const char *antigo, const char *novo);
+int salvarIngredientesAtomic();
+int carregarIngredientes();
+void gerenciarIngredientes(struct Catalogo *cat);
 void calcularTudo(struct Produto *p);
+double rateioDespesasFixas();
+int calcularLote(struct ColunasPreco *c, int ini, int fim, double rateio);
+void paraleloExecutar(const struct Paralelo *p);
 int salvarConfigAtomic();
 int carregarConfig();
-int salvarProdutosAtomic(struct Produto produtos[], int qtd);
-int carregarProdutos(struct Produto produtos[], int *qtd);
+void catalogoIniciar(struct Catalogo *cat);
+void catalogoLiberar(struct Catalogo *cat);
+int catalogoReservar(struct Catalogo *cat, int capacidade);
+int catalogoAdicionar(struct Catalogo *cat, const struct Produto *p);
+void catalogoObter(struct Catalogo *cat, int idx, struct Produto *p);
+int catalogoAtualizarPreco(struct Catalogo *cat, int idx);
+int catalogoAtualizarPrecos(struct Catalogo *cat);
+int catalogoGravar(struct Catalogo *cat, int idx, const struct Produto *p);
+void catalogoRemover(struct Catalogo *cat, int idx);
+int catalogoInserirEm(struct Catalogo *cat, int idx, const struct Produto *p);
+void catalogoReconstruirLivres(struct Catalogo *cat);
+void catalogoCompactar(struct Catalogo *cat);
+int catalogoVivos(const struct Catalogo *cat);
+int catalogoValido(const struct Catalogo *cat, int idx);
+void catalogoIndexarNomes(struct Catalogo *cat);
+int catalogoBuscarNome(struct Catalogo *cat, const char *nome);
+int escolherProduto(struct Catalogo *cat, const char *acao);
+void catalogoIndexarTextos(struct Catalogo *cat);
+int catalogoBuscarTexto(struct Catalogo *cat, const char *consulta, int **resultado);
+void buscarProdutos(struct Catalogo *cat);
+double margemEfetiva(const struct ColunasPreco *c, int i);
+const struct IndiceOrdem *catalogoOrdenado(struct Catalogo *cat, int ordem);
+void ordemLimite(const struct IndiceOrdem *o, double chave, int depois, struct CursorOrdem *c);
+void ordemExtremo(const struct IndiceOrdem *o, int ultimo, struct CursorOrdem *c);
+const struct EntradaOrdem *cursorEntrada(const struct CursorOrdem *c);
+void cursorAvancar(struct CursorOrdem *c, int passo);
+void consultarFaixas(struct Catalogo *cat);
+int modoLote(int argc, char **argv);
+int salvarProdutosAtomic(struct Catalogo *cat);
+int esteiraExecutar(struct Esteira *e);
+int carregarProdutos(struct Catalogo *cat);
+unsigned crc32Atualizar(unsigned crc, const void *dados, size_t n);
+int sincronizarDiretorio();
+int diarioAbrir(struct Catalogo *cat, unsigned long long base_ino);
+int baseAbrir();
+int baseAnexavel(const struct Catalogo *cat);
+int baseAnexarRegistros(const struct RegistroProduto *r, int n, int idx);
+int baseAnexarConfirmar(int qtd);
+void cabecalhoPreencher(struct CabecalhoProdutos *cab, unsigned long long qtd);
+int formatoBase(const char *dados, size_t tamanho, struct CabecalhoProdutos *cab);
+void selarRegistro(struct RegistroProduto *r);
+int registroValido(const struct RegistroProduto *r);
+int diarioRegistrar(struct Catalogo *cat, int tipo, int idx);
+int diarioConfirmar(struct Catalogo *cat);
+int catalogoTravar(struct Catalogo *cat);
+void catalogoDestravar(void);
+int catalogoSincronizar(struct Catalogo *cat);
+int ingredienteCadastrar(const char *nome, int tipo, double preco);
 void configurarDespesasFixas();
-void listarProdutos(struct Produto produtos[], int qtd);
-void editarProduto(struct Produto produtos[], int qtd);
-void excluirProduto(struct Produto produtos[], int *qtd);
+void listarProdutos(struct Catalogo *cat);
+void editarProduto(struct Catalogo *cat);
+void excluirProduto(struct Catalogo *cat);
 void calculoRapido();
-void menuPosCadastro(struct Produto produtos[], int *qtd, int idxRecente);
-void cadastrarProduto(struct Produto produtos[], int *qtd);
-void excluirProdutoIndex(struct Produto produtos[], int *qtd, int idx);
+void menuPosCadastro(struct Catalogo *cat, int idxRecente);
+void cadastrarProduto(struct Catalogo *cat);
+void excluirProdutoIndex(struct Catalogo *cat, int idx);
 void validarPercentuaisProduto(struct Produto *p);
+int ajustarPercentuais(double *imposto, double *taxa, double *lucro);
+int numeroLer(const char *s, const char *fim, double *v);
+int dinheiroLer(const char *s, double *v);
+int valorNaFaixa(double v);
+double lerValor(const char *s);
+size_t formatarInteiro(long long v, char *dst);
+size_t dinheiroFormatar(double v, char *dst);
+size_t numeroFormatarCurto(double v, char *dst);
+const char *dinheiroTexto(double v, char *buf);
 double clamp_double(double v, double lo, double hi);
 
 /* ----- Funções de interface ----- */
@@ -112,7 +704,8 @@ void imprimir_secao(const char *titulo) {
 }
 
 void imprimir_valor(const char *label, double valor) {
-    printf("%s%-30s:%s %sR$ %.2f%s\n", CYAN, label, RESET, GREEN, valor, RESET);
+    char v[DINHEIRO_TAM];
+    printf("%s%-30s:%s %sR$ %s%s\n", CYAN, label, RESET, GREEN, dinheiroTexto(valor, v), RESET);
 }
 
 void imprimir_sucesso(const char *msg) {
@@ -134,658 +727,7429 @@ double clamp_double(double v, double lo, double hi) {
     return v;
 }
 
+/* ----- Dinheiro: leitura e formatação ----- */
+/* Todo valor digitado, importado ou exportado passa por aqui, nunca por
+   atof/strtod/printf direto: independe do locale e aceita tanto "12,50"
+   quanto "12.50" */
+
+/* número decimal em [s, fim): sinal, dígitos com '.' ou ',' decimal e
+   expoente opcional, espaços nas pontas. Sem alocar nem copiar: com até 19
+   dígitos significativos e expoente decimal até 22 em módulo, mantissa e
+   potência de 10 são exatas em double e uma única multiplicação (ou
+   divisão) já dá o valor corretamente arredondado (caminho rápido de
+   Clinger). Fora disso, strtod numa cópia local. Retorna 0 se não for
+   um número inteiro do campo */
+int numeroLer(const char *s, const char *fim, double *v) {
+    static const double potencias10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    while (s < fim && (*s == ' ' || *s == '\t')) s++;
+    while (fim > s && (fim[-1] == ' ' || fim[-1] == '\t')) fim--;
+    const char *ini = s;
+    int negativo = 0;
+    if (s < fim && (*s == '-' || *s == '+')) negativo = *s++ == '-';
+
+    /* mais de 19 dígitos estouraria a mantissa: vai para o caminho lento */
+    unsigned long long mantissa = 0;
+    const char *d = s;
+    while (s < fim && (unsigned)(*s - '0') < 10) mantissa = mantissa * 10 + (unsigned)(*s++ - '0');
+    int digitos = (int)(s - d), casas = 0;
+    if (s < fim && (*s == '.' || *s == ',')) {
+        d = ++s;
+        while (s < fim && (unsigned)(*s - '0') < 10) mantissa = mantissa * 10 + (unsigned)(*s++ - '0');
+        casas = (int)(s - d);
+        digitos += casas;
+    }
+    if (digitos == 0) return 0;
+    int expoente = -casas;
+    if (s < fim && (*s == 'e' || *s == 'E')) {
+        s++;
+        int neg_exp = 0, e = 0, tem = 0;
+        if (s < fim && (*s == '-' || *s == '+')) neg_exp = *s++ == '-';
+        for (; s < fim && (unsigned)(*s - '0') < 10; s++) {
+            tem = 1;
+            if (e < 100000) e = e * 10 + (*s - '0');
+        }
+        if (!tem) return 0;
+        expoente += neg_exp ? -e : e;
+    }
+    if (s != fim) return 0;
+
+    if (digitos <= 19 && mantissa <= (1ULL << 53) && expoente >= -22 && expoente <= 22) {
+        double r = (double)mantissa;
+        r = expoente < 0 ? r / potencias10[-expoente] : r * potencias10[expoente];
+        *v = negativo ? -r : r;
+        return 1;
+    }
+    /* caminho lento: strtod só entende '.', e o campo não termina em '\0' */
+    char buf[64];
+    size_t n = (size_t)(fim - ini);
+    if (n >= sizeof(buf)) return 0;
+    for (size_t i = 0; i < n; i++) buf[i] = ini[i] == ',' ? '.' : ini[i];
+    buf[n] = '\0';
+    char *resto;
+    *v = strtod(buf, &resto);
+    return *resto == '\0';
+}
+
+/* inteiro em decimal; retorna quantos bytes escreveu */
+size_t formatarInteiro(long long v, char *dst) {
+    char tmp[24];
+    size_t n = 0, k = 0;
+    unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+    do {
+        tmp[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0) dst[k++] = '-';
+    while (n) dst[k++] = tmp[--n];
+    return k;
+}
+
+/* v com duas casas, igual ao printf("%.2f") do locale "C": o produto v*100
+   é arredondado, mas o erro desse arredondamento sai exato do produto de
+   Dekker (100 tem poucos bits: as metades de v vezes 100 são exatas, sem
+   precisar de fma). Com o erro se decide para que lado vai a terceira casa,
+   empate (valor exato ...5) para o par como a libc. Fora da faixa segura do
+   double, e para nan/inf, usa snprintf */
+size_t dinheiroFormatar(double v, char *dst) {
+    double a = v < 0 ? -v : v;
+    if (!(a < 9.0e13)) return (size_t)snprintf(dst, 32, "%.2f", v);
+    double p = a * 100.0;
+    double t = a * 134217729.0;         /* 2^27 + 1: separa a em 26 + 27 bits */
+    double alto = t - (t - a), baixo = a - alto;
+    double e = (alto * 100.0 - p) + baixo * 100.0;  /* a*100 == p + e, exato */
+    unsigned long long cent = (unsigned long long)p;
+    double d = (p - (double)cent - 0.5) + e;        /* sinal de a*100 - cent - 0.5 */
+    if (d > 0 || (d == 0 && (cent & 1))) cent++;
+    size_t k = 0;
+    if (signbit(v)) dst[k++] = '-';
+    k += formatarInteiro((long long)(cent / 100), dst + k);
+    dst[k++] = '.';
+    dst[k++] = (char)('0' + cent / 10 % 10);
+    dst[k++] = (char)('0' + cent % 10);
+    return k;
+}
+
+/* menor número de casas decimais que, lido de volta, dá exatamente v (em
+   notação fixa). Com k casas, m = v*10^k arredondado volta a ser v se a
+   divisão exata m / 10^k (m < 2^53, 10^k exato) reproduzir v, que é o mesmo
+   teste do caminho rápido da leitura. Fora dessa faixa, %.17g */
+size_t numeroFormatarCurto(double v, char *dst) {
+    static const double potencias10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17
+    };
+    static const unsigned long long inteiros10[] = {
+        1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+        100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+        10000000000000ULL, 100000000000000ULL, 1000000000000000ULL,
+        10000000000000000ULL, 100000000000000000ULL
+    };
+    double a = v < 0 ? -v : v;
+    for (int k = 0; k < 18 && a < 9.0e15; k++) {
+        double p = a * potencias10[k];
+        if (!(p < 9007199254740992.0)) break;
+        unsigned long long m = (unsigned long long)(p + 0.5);
+        if ((double)m / potencias10[k] != a) continue;
+        size_t n = 0;
+        if (signbit(v)) dst[n++] = '-';
+        n += formatarInteiro((long long)(m / inteiros10[k]), dst + n);
+        if (k > 0) {
+            unsigned long long frac = m % inteiros10[k];
+            dst[n++] = '.';
+            for (int j = k - 1; j >= 0; j--) {
+                dst[n + (size_t)j] = (char)('0' + frac % 10);
+                frac /= 10;
+            }
+            n += (size_t)k;
+        }
+        return n;
+    }
+    return (size_t)snprintf(dst, 32, "%.17g", v);
+}
+
+/* valor com duas casas como string terminada (buf com DINHEIRO_TAM bytes),
+   para os printf da interface */
+const char *dinheiroTexto(double v, char *buf) {
+    buf[dinheiroFormatar(v, buf)] = '\0';
+    return buf;
+}
+
+/* valor digitado pelo usuário: "12,50", "12.50", "R$ 12,50" ou com milhar
+   ("1.234,56", "1,234.56", "1.234.567"). Com os dois separadores, o último
+   é o decimal; um separador repetido é só de milhar. Retorna 0 se não for
+   um número */
+int dinheiroLer(const char *s, double *v) {
+    char limpo[64];
+    while (*s == ' ' || *s == '\t') s++;
+    if ((s[0] == 'R' || s[0] == 'r') && s[1] == '$') s += 2;
+    size_t n = strlen(s);
+    if (n >= sizeof(limpo)) return 0;
+    const char *ultimo_ponto = strrchr(s, '.'), *ultima_virgula = strrchr(s, ',');
+    const char *decimal;
+    if (ultimo_ponto && ultima_virgula) {
+        decimal = ultimo_ponto > ultima_virgula ? ultimo_ponto : ultima_virgula;
+    } else {
+        /* um só tipo de separador: é decimal se aparece uma vez */
+        decimal = ultimo_ponto ? ultimo_ponto : ultima_virgula;
+        if (decimal && strchr(s, *decimal) != decimal) decimal = NULL;
+    }
+    size_t k = 0;
+    for (const char *p = s; *p; p++) {
+        if (*p == '.' || *p == ',') {
+            if (p == decimal) limpo[k++] = '.';
+            continue;
+        }
+        limpo[k++] = *p;
+    }
+    return numeroLer(limpo, limpo + k, v);
+}
+
+/* dentro de ±VALOR_MAX (nan fica de fora) */
+int valorNaFaixa(double v) {
+    return v >= -VALOR_MAX && v <= VALOR_MAX;
+}
+
+/* resposta de um prompt numérico: vazio, inválido ou fora da faixa vale 0,
+   como o atof */
+double lerValor(const char *s) {
+    double v;
+    return dinheiroLer(s, &v) && valorNaFaixa(v) ? v : 0.0;
+}
+
 /* ----- Valida percentuais e evita soma >= 100 ----- */
-void validarPercentuaisProduto(struct Produto *p) {
+/* ajusta os percentuais sem imprimir nada (usado também no cálculo em lote);
+   retorna 1 se algum valor foi alterado */
+int ajustarPercentuais(double *imposto, double *taxa, double *lucro) {
     int changed = 0;
     /* imposto e taxa individuais 0..99 */
-    if (p->imposto_percent < 0.0) { p->imposto_percent = 0.0; changed = 1; }
-    if (p->taxa_cartao_percent < 0.0) { p->taxa_cartao_percent = 0.0; changed = 1; }
-    if (p->lucro_produtor_percent < 0.0) { p->lucro_produtor_percent = 0.0; changed = 1; }
-    p->imposto_percent = clamp_double(p->imposto_percent, 0.0, 99.0);
-    p->taxa_cartao_percent = clamp_double(p->taxa_cartao_percent, 0.0, 99.0);
-    p->lucro_produtor_percent = clamp_double(p->lucro_produtor_percent, 0.0, 99.0);
+    if (*imposto < 0.0) { *imposto = 0.0; changed = 1; }
+    if (*taxa < 0.0) { *taxa = 0.0; changed = 1; }
+    if (*lucro < 0.0) { *lucro = 0.0; changed = 1; }
+    *imposto = clamp_double(*imposto, 0.0, 99.0);
+    *taxa = clamp_double(*taxa, 0.0, 99.0);
+    *lucro = clamp_double(*lucro, 0.0, 99.0);
 
     /* garantir que imposto + taxa < 99 (reservamos pelo menos 1% para dividir) */
-    double total = p->imposto_percent + p->taxa_cartao_percent;
+    double total = *imposto + *taxa;
     if (total >= 99.0) {
         /* reduz proporcionalmente as duas para manter proporção */
         if (total > 0.0) {
             double factor = 98.0 / total; /* deixa 98% como soma */
-            p->imposto_percent *= factor;
-            p->taxa_cartao_percent *= factor;
+            *imposto *= factor;
+            *taxa *= factor;
         } else {
-            p->imposto_percent = 0.0;
-            p->taxa_cartao_percent = 0.0;
+            *imposto = 0.0;
+            *taxa = 0.0;
         }
         changed = 1;
     }
+    return changed;
+}
 
-    if (changed) {
+void validarPercentuaisProduto(struct Produto *p) {
+    if (ajustarPercentuais(&p->imposto_percent, &p->taxa_cartao_percent, &p->lucro_produtor_percent)) {
         imprimir_aviso("Alguns percentuais foram ajustados para valores validos (0-99%% e imposto+taxa < 99%%).");
     }
 }
 
-/* ----- Funções de arquivo (atômico com temp + rename + backup) ----- */
-int salvarConfigAtomic() {
-    /* escreve temporário */
-    FILE *f = fopen(ARQ_CONFIG_TMP, "wb");
-    if (!f) return 0;
-    if (fwrite(&config, sizeof(struct Config), 1, f) != 1) {
-        fclose(f);
-        remove(ARQ_CONFIG_TMP);
-        return 0;
+/* ----- Arena de textos ----- */
+static void arenaLiberar(struct ArenaTexto *a) {
+    struct BlocoTexto *b = a->blocos;
+    while (b) {
+        struct BlocoTexto *prox = b->prox;
+        free(b);
+        b = prox;
     }
-    fflush(f);
-    fclose(f);
+    a->blocos = NULL;
+    a->total = 0;
+    a->desperdicio = 0;
+}
 
-    /* move antigo para backup se existir */
-    if (access(ARQ_CONFIG, F_OK) == 0) {
-        /* remove antigo backup se houver */
-        remove(ARQ_CONFIG_BAK);
-        if (rename(ARQ_CONFIG, ARQ_CONFIG_BAK) != 0) {
-            /* se falha, tenta remover tmp e retorna erro */
-            remove(ARQ_CONFIG_TMP);
-            return 0;
-        }
+/* copia n bytes de s (mais o terminador) para a arena; retorna ponteiro
+   estável ou NULL sem memória */
+static const char *arenaCopiar(struct ArenaTexto *a, const char *s, size_t len) {
+    size_t n = len + 1;
+    struct BlocoTexto *b = a->blocos;
+    if (!b || b->tamanho - b->usado < n) {
+        size_t tam = n > ARENA_BLOCO ? n : ARENA_BLOCO;
+        b = malloc(sizeof(struct BlocoTexto) + tam);
+        if (!b) return NULL;
+        b->usado = 0;
+        b->tamanho = tam;
+        b->prox = a->blocos;
+        a->blocos = b;
     }
+    char *dst = b->dados + b->usado;
+    memcpy(dst, s, len);
+    dst[len] = '\0';
+    b->usado += n;
+    a->total += n;
+    return dst;
+}
+
+/* troca *campo por uma cópia de s (no máximo max-1 caracteres; registros do
+   disco podem vir sem terminador), contabilizando a string antiga como lixo */
+static int arenaSubstituir(struct ArenaTexto *a, const char **campo, const char *s, size_t max) {
+    size_t len = strnlen(s, max);
+    if (len == max) len = max - 1;
+    if (*campo && strlen(*campo) == len && memcmp(*campo, s, len) == 0) return 1;
+    const char *novo = arenaCopiar(a, s, len);
+    if (!novo) return 0;
+    if (*campo) a->desperdicio += strlen(*campo) + 1;
+    *campo = novo;
+    return 1;
+}
 
-    if (rename(ARQ_CONFIG_TMP, ARQ_CONFIG) != 0) {
-        /* tenta restaurar backup */
-        if (access(ARQ_CONFIG_BAK, F_OK) == 0) {
-            rename(ARQ_CONFIG_BAK, ARQ_CONFIG);
+/* ----- Índice de nomes ----- */
+/* copia s normalizado para dst (tamanho max): minúsculas ASCII, sem espaços
+   nas pontas e com espaços/quebras de linha repetidos reduzidos a um espaço */
+static size_t textoNormalizar(const char *s, char *dst, size_t max) {
+    size_t n = 0;
+    int espaco = 0;
+    for (; *s && n < max - 1; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            espaco = n > 0;
+            continue;
         }
-        remove(ARQ_CONFIG_TMP);
-        return 0;
+        if (espaco && n < max - 2) dst[n++] = ' ';
+        espaco = 0;
+        dst[n++] = (char)(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
     }
-
-    /* sucesso */
-    return 1;
+    dst[n] = '\0';
+    return n;
 }
 
-int carregarConfig() {
-    FILE *f = fopen(ARQ_CONFIG, "rb");
-    if (!f) return 0;
-    size_t r = fread(&config, sizeof(struct Config), 1, f);
-    fclose(f);
-    return r == 1;
+static size_t nomeNormalizar(const char *s, char *dst) {
+    return textoNormalizar(s, dst, MAX_NOME);
 }
 
-int salvarProdutosAtomic(struct Produto produtos[], int qtd) {
-    FILE *f = fopen(ARQ_PRODUTOS_TMP, "wb");
-    if (!f) return 0;
-    for (int i = 0; i < qtd; i++) {
-        if (fwrite(&produtos[i], sizeof(struct Produto), 1, f) != 1) {
-            fclose(f);
-            remove(ARQ_PRODUTOS_TMP);
-            return 0;
-        }
+/* FNV-1a com mistura final (os bits baixos escolhem a posição) */
+static unsigned nomeHash(const char *s, size_t n) {
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
     }
-    fflush(f);
-    fclose(f);
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return h;
+}
 
-    /* backup do antigo */
-    if (access(ARQ_PRODUTOS, F_OK) == 0) {
-        remove(ARQ_PRODUTOS_BAK);
-        if (rename(ARQ_PRODUTOS, ARQ_PRODUTOS_BAK) != 0) {
-            /* falha em renomear antigo -> tenta remover tmp e retorna erro */
-            remove(ARQ_PRODUTOS_TMP);
-            return 0;
-        }
-    }
+static void indiceLiberar(struct IndiceNome *ind) {
+    free(ind->idx);
+    free(ind->hash);
+    memset(ind, 0, sizeof(*ind));
+}
 
-    if (rename(ARQ_PRODUTOS_TMP, ARQ_PRODUTOS) != 0) {
-        /* se falhar, tenta restaurar backup */
-        if (access(ARQ_PRODUTOS_BAK, F_OK) == 0) {
-            rename(ARQ_PRODUTOS_BAK, ARQ_PRODUTOS);
-        }
-        remove(ARQ_PRODUTOS_TMP);
+/* coloca (hash, idx) na primeira posição vazia ou removida da sondagem */
+static void indicePosicionar(struct IndiceNome *ind, unsigned h, int idx) {
+    size_t mascara = ind->capacidade - 1;
+    size_t pos = h & mascara;
+    while (ind->idx[pos] >= 0) pos = (pos + 1) & mascara;
+    if (ind->idx[pos] == INDICE_VAZIO) ind->usados++;
+    ind->idx[pos] = idx;
+    ind->hash[pos] = h;
+}
+
+/* realoca com espaço para 'entradas' vivas a no máximo 50% de ocupação,
+   descartando as posições removidas; 0 sem memória (índice antigo fica) */
+static int indiceRedimensionar(struct IndiceNome *ind, size_t entradas) {
+    size_t cap = 64;
+    while (cap < entradas * 2) cap *= 2;
+    int *idx = malloc(cap * sizeof(int));
+    unsigned *hash = malloc(cap * sizeof(unsigned));
+    if (!idx || !hash) {
+        free(idx);
+        free(hash);
         return 0;
     }
-
+    for (size_t i = 0; i < cap; i++) idx[i] = INDICE_VAZIO;
+    struct IndiceNome velho = *ind;
+    ind->idx = idx;
+    ind->hash = hash;
+    ind->capacidade = cap;
+    ind->usados = 0;
+    for (size_t i = 0; i < velho.capacidade; i++)
+        if (velho.idx[i] >= 0) indicePosicionar(ind, velho.hash[i], velho.idx[i]);
+    free(velho.idx);
+    free(velho.hash);
     return 1;
 }
 
-int carregarProdutos(struct Produto produtos[], int *qtd) {
-    FILE *f = fopen(ARQ_PRODUTOS, "rb");
-    if (!f) { *qtd = 0; return 0; }
-    *qtd = 0;
-    while (fread(&produtos[*qtd], sizeof(struct Produto), 1, f) == 1) {
-        (*qtd)++;
-        if (*qtd >= MAX_PRODUTOS) break;
+/* indexa o nome atual do produto idx (nada a fazer com o índice ainda
+   não montado: a montagem lê todos os produtos) */
+static void indiceInserir(struct Catalogo *cat, int idx) {
+    struct IndiceNome *ind = &cat->indice_nome;
+    if (ind->capacidade == 0 || !cat->nome[idx]) return;
+    /* ocupação (removidas incluídas) acima de 70%: cresce/limpa */
+    if ((ind->usados + 1) * 10 > ind->capacidade * 7 &&
+        !indiceRedimensionar(ind, (size_t)catalogoVivos(cat) + 1)) {
+        indiceLiberar(ind);     /* sem memória: remonta na próxima busca */
+        return;
     }
-    fclose(f);
-    return 1;
+    char norm[MAX_NOME];
+    indicePosicionar(ind, nomeHash(norm, nomeNormalizar(cat->nome[idx], norm)), idx);
 }
 
-/* ----- Auxiliares I/O ----- */
-void lerLinha(char *buf, int n) {
-    if (fgets(buf, n, stdin) == NULL) { buf[0] = '\0'; return; }
-    buf[strcspn(buf, "\n")] = '\0';
+/* tira o produto idx do índice (antes de o nome dele mudar ou sumir) */
+static void indiceRemover(struct Catalogo *cat, int idx) {
+    struct IndiceNome *ind = &cat->indice_nome;
+    if (ind->capacidade == 0 || !cat->nome[idx]) return;
+    char norm[MAX_NOME];
+    unsigned h = nomeHash(norm, nomeNormalizar(cat->nome[idx], norm));
+    size_t mascara = ind->capacidade - 1;
+    for (size_t pos = h & mascara; ind->idx[pos] != INDICE_VAZIO; pos = (pos + 1) & mascara) {
+        if (ind->idx[pos] == idx) {
+            ind->idx[pos] = INDICE_REMOVIDO;
+            return;
+        }
+    }
 }
 
-/* ----- Coleta de ingredientes (modo receita) ----- */
-double coletarIngredientesText(char *descricao, int descSize, int *rendimento) {
-    char buf[BUF_SIZE];
-    int n;
-    double custo_total = 0.0;
+#define INDEXAR_GRAO 4096
 
-    descricao[0] = '\0';
+struct HashesNomes {
+    struct Catalogo *cat;
+    unsigned *hash;
+};
 
-    printf("\n%sQuantos ingredientes tem essa receita? %s", YELLOW, RESET);
-    lerLinha(buf, sizeof(buf));
-    n = atoi(buf);
-    if (n < 1) return -1.0;
-    if (n > MAX_INGR) n = MAX_INGR;
+static void nomesHashFaixa(int ini, int fim, int w, void *ctx) {
+    (void)w;
+    struct HashesNomes *h = ctx;
+    char norm[MAX_NOME];
+    for (int i = ini; i < fim; i++)
+        if (!h->cat->excluido[i]) h->hash[i] = nomeHash(norm, nomeNormalizar(h->cat->nome[i], norm));
+}
 
-    for (int i = 0; i < n; i++) {
-        char nome[128];
-        int tipo;
-        double preco, quantidade, custo;
+/* monta o índice com todos os produtos vivos, de uma vez. Normalizar e
+   calcular o hash vai para o executor paralelo; as inserções continuam na
+   ordem dos slots, então a tabela sai igual à montada em série */
+void catalogoIndexarNomes(struct Catalogo *cat) {
+    struct IndiceNome *ind = &cat->indice_nome;
+    indiceLiberar(ind);
+    if (!indiceRedimensionar(ind, (size_t)catalogoVivos(cat))) return;
+    struct HashesNomes h = { cat, malloc((size_t)(cat->qtd > 0 ? cat->qtd : 1) * sizeof(unsigned)) };
+    if (h.hash) {
+        struct Paralelo p = { nomesHashFaixa, NULL, &h, cat->qtd, INDEXAR_GRAO };
+        paraleloExecutar(&p);
+    }
+    char norm[MAX_NOME];
+    for (int i = 0; i < cat->qtd; i++) {
+        if (cat->excluido[i]) continue;
+        indicePosicionar(ind, h.hash ? h.hash[i] : nomeHash(norm, nomeNormalizar(cat->nome[i], norm)), i);
+    }
+    free(h.hash);
+}
 
-        printf("\n%s%s> Ingrediente %d%s\n", BOLD, MAGENTA, i + 1, RESET);
+/* índice do produto com esse nome (comparação normalizada) ou -1 */
+int catalogoBuscarNome(struct Catalogo *cat, const char *nome) {
+    struct IndiceNome *ind = &cat->indice_nome;
+    if (ind->capacidade == 0) catalogoIndexarNomes(cat);
+    if (ind->capacidade == 0) return -1;
+    char alvo[MAX_NOME], norm[MAX_NOME];
+    size_t n = nomeNormalizar(nome, alvo);
+    unsigned h = nomeHash(alvo, n);
+    size_t mascara = ind->capacidade - 1;
+    for (size_t pos = h & mascara; ind->idx[pos] != INDICE_VAZIO; pos = (pos + 1) & mascara) {
+        int i = ind->idx[pos];
+        if (i < 0 || ind->hash[pos] != h) continue;
+        if (nomeNormalizar(cat->nome[i], norm) == n && memcmp(norm, alvo, n) == 0) return i;
+    }
+    return -1;
+}
 
-        printf("%sNome: %s", CYAN, RESET);
-        lerLinha(nome, sizeof(nome));
+/* ----- Índice de trigramas (busca por trecho) ----- */
+#define TRIGRAMA(t) ((((unsigned)(unsigned char)(t)[0] << 16) | \
+                      ((unsigned)(unsigned char)(t)[1] << 8) | (unsigned)(unsigned char)(t)[2]) + 1)
+#define MAX_TRIGRAMAS (MAX_NOME + MAX_DESC)
 
-        printf("%sTipo (1=preco/kg | 2=preco por unidade): %s", CYAN, RESET);
-        lerLinha(buf, sizeof(buf));
-        tipo = atoi(buf);
-        if (tipo != 1 && tipo != 2) tipo = 1;
+static int compararUnsigned(const void *a, const void *b) {
+    unsigned x = *(const unsigned *)a, y = *(const unsigned *)b;
+    return (x > y) - (x < y);
+}
 
-        if (tipo == 2) {
-            printf("%sPreco por unidade (R$): %s", CYAN, RESET);
-            lerLinha(buf, sizeof(buf));
-            preco = atof(buf);
-            printf("%sQuantidade usada (unidades): %s", CYAN, RESET);
-            lerLinha(buf, sizeof(buf));
-            quantidade = atof(buf);
-            custo = preco * quantidade;
-            snprintf(buf, sizeof(buf), "  • %s: %.0f un x R$ %.2f = R$ %.2f\n", nome, quantidade, preco, custo);
-        } else {
-            printf("%sPreco por KG (R$): %s", CYAN, RESET);
-            lerLinha(buf, sizeof(buf));
-            preco = atof(buf);
-            printf("%sQuantidade usada (gramas): %s", CYAN, RESET);
-            lerLinha(buf, sizeof(buf));
-            quantidade = atof(buf);
-            custo = (preco / 1000.0) * quantidade;
-            snprintf(buf, sizeof(buf), "  • %s: %.0fg x R$ %.2f/kg = R$ %.2f\n", nome, quantidade, preco, custo);
+/* trigramas do nome e dos ingredientes do produto (com repetições: quem
+   consome ignora o produto que já está na lista) */
+static int produtoTrigramas(const struct Catalogo *cat, int idx, unsigned *chaves) {
+    char norm[MAX_DESC];
+    int n = 0;
+    const char *textos[2] = { cat->nome[idx], cat->ingredientes_desc[idx] };
+    for (int t = 0; t < 2; t++) {
+        if (!textos[t]) continue;
+        size_t len = textoNormalizar(textos[t], norm, sizeof(norm));
+        for (size_t i = 0; i + 3 <= len; i++) chaves[n++] = TRIGRAMA(norm + i);
+    }
+    return n;
+}
+
+static void trigramaLiberar(struct IndiceTrigrama *ind) {
+    for (size_t i = 0; i < ind->capacidade; i++) free(ind->listas[i].idx);
+    free(ind->listas);
+    memset(ind, 0, sizeof(*ind));
+}
+
+/* lista do trigrama (criada se 'criar'); NULL se não existe ou sem memória */
+static struct ListaTrigrama *trigramaLista(struct IndiceTrigrama *ind, unsigned chave, int criar) {
+    if (criar && (ind->usadas + 1) * 2 > ind->capacidade) {
+        size_t cap = ind->capacidade ? ind->capacidade * 2 : 4096;
+        struct ListaTrigrama *novas = calloc(cap, sizeof(struct ListaTrigrama));
+        if (!novas) return NULL;
+        for (size_t i = 0; i < ind->capacidade; i++) {
+            if (!ind->listas[i].chave) continue;
+            size_t pos = nomeHash((const char *)&ind->listas[i].chave, sizeof(unsigned)) & (cap - 1);
+            while (novas[pos].chave) pos = (pos + 1) & (cap - 1);
+            novas[pos] = ind->listas[i];
         }
+        free(ind->listas);
+        ind->listas = novas;
+        ind->capacidade = cap;
+    }
+    if (ind->capacidade == 0) return NULL;
+    size_t mascara = ind->capacidade - 1;
+    size_t pos = nomeHash((const char *)&chave, sizeof(chave)) & mascara;
+    while (ind->listas[pos].chave && ind->listas[pos].chave != chave) pos = (pos + 1) & mascara;
+    if (ind->listas[pos].chave) return &ind->listas[pos];
+    if (!criar) return NULL;
+    ind->listas[pos].chave = chave;
+    ind->usadas++;
+    return &ind->listas[pos];
+}
 
-        custo_total += custo;
-        if ((int)strlen(descricao) + (int)strlen(buf) < descSize - 1)
-            strncat(descricao, buf, descSize - strlen(descricao) - 1);
-        printf("%s-> Custo de %s: %sR$ %.2f%s\n", GREEN, nome, BOLD, custo, RESET);
+/* primeira posição da lista com valor >= idx */
+static int listaBuscar(const struct ListaTrigrama *l, int idx) {
+    int lo = 0, hi = l->qtd;
+    while (lo < hi) {
+        int meio = lo + (hi - lo) / 2;
+        if (l->idx[meio] < idx) lo = meio + 1;
+        else hi = meio;
     }
+    return lo;
+}
 
-    printf("\n%sRendimento da receita (quantas unidades produz): %s", YELLOW, RESET);
-    lerLinha(buf, sizeof(buf));
-    *rendimento = atoi(buf);
-    if (*rendimento <= 0) *rendimento = 1;
+/* põe o produto idx nas listas dos seus trigramas (no fim da lista quando
+   os produtos chegam em ordem, como na montagem). 0 sem memória */
+static int trigramaAdicionar(struct Catalogo *cat, int idx) {
+    static unsigned chaves[MAX_TRIGRAMAS];
+    int n = produtoTrigramas(cat, idx, chaves);
+    for (int i = 0; i < n; i++) {
+        struct ListaTrigrama *l = trigramaLista(&cat->indice_texto, chaves[i], 1);
+        if (!l) return 0;
+        int pos = l->qtd == 0 || l->idx[l->qtd - 1] < idx ? l->qtd : listaBuscar(l, idx);
+        if (pos < l->qtd && l->idx[pos] == idx) continue;
+        if (l->qtd == l->capacidade) {
+            int cap = l->capacidade ? l->capacidade * 2 : 4;
+            int *novo = realloc(l->idx, (size_t)cap * sizeof(int));
+            if (!novo) return 0;
+            l->idx = novo;
+            l->capacidade = cap;
+        }
+        memmove(&l->idx[pos + 1], &l->idx[pos], (size_t)(l->qtd - pos) * sizeof(int));
+        l->idx[pos] = idx;
+        l->qtd++;
+    }
+    return 1;
+}
 
-    return custo_total;
+/* mantém o índice (se montado) depois que os textos do produto idx entraram */
+static void trigramaInserir(struct Catalogo *cat, int idx) {
+    if (cat->indice_texto.capacidade == 0) return;
+    /* sem memória: descarta; a próxima busca remonta */
+    if (!trigramaAdicionar(cat, idx)) trigramaLiberar(&cat->indice_texto);
 }
 
-/* ----- Cálculo completo por produto ----- */
-void calcularTudo(struct Produto *p) {
-    double custo_base_unitario;
+/* tira o produto idx das listas (antes de os textos dele mudarem/sumirem) */
+static void trigramaRemover(struct Catalogo *cat, int idx) {
+    static unsigned chaves[MAX_TRIGRAMAS];
+    if (cat->indice_texto.capacidade == 0) return;
+    int n = produtoTrigramas(cat, idx, chaves);
+    for (int i = 0; i < n; i++) {
+        struct ListaTrigrama *l = trigramaLista(&cat->indice_texto, chaves[i], 0);
+        if (!l) continue;
+        int pos = listaBuscar(l, idx);
+        if (pos == l->qtd || l->idx[pos] != idx) continue;
+        memmove(&l->idx[pos], &l->idx[pos + 1], (size_t)(l->qtd - pos - 1) * sizeof(int));
+        l->qtd--;
+    }
+}
 
-    if (p->modo == 1) {
-        custo_base_unitario = p->preco_custo;
-    } else {
-        if (p->rendimento <= 0) p->rendimento = 1;
-        double despesasVariaveisPorUn = p->despesas_variaveis / (double)p->rendimento;
-        custo_base_unitario = (p->investimento_total / (double)p->rendimento) + despesasVariaveisPorUn;
+void catalogoIndexarTextos(struct Catalogo *cat) {
+    trigramaLiberar(&cat->indice_texto);
+    for (int i = 0; i < cat->qtd; i++) {
+        if (cat->excluido[i]) continue;
+        if (!trigramaAdicionar(cat, i)) {
+            trigramaLiberar(&cat->indice_texto);
+            return;
+        }
     }
+    /* catálogo vazio: marca como montado mesmo assim */
+    if (cat->indice_texto.capacidade == 0) trigramaLista(&cat->indice_texto, 1, 1);
+}
 
-    double total_fixa = config.gasto_agua + config.gasto_luz + config.gasto_gas;
-    double rateio_fixo_por_unidade = 0.0;
-    if (config.producao_mensal_unidades > 0) {
-        rateio_fixo_por_unidade = total_fixa / (double)config.producao_mensal_unidades;
+static int ehEspaco(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/* o trecho (já normalizado) aparece em s depois de normalizado? Compara
+   direto no texto cru, sem montar a cópia: espaço no trecho casa com
+   qualquer sequência de espaços/quebras, letras sem diferenciar maiúsculas */
+static int contemNormalizado(const char *s, const char *trecho) {
+    unsigned char primeiro = (unsigned char)trecho[0];
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if ((c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c) != primeiro) continue;
+        const char *p = s;
+        const char *t = trecho;
+        while (*t) {
+            unsigned char r = (unsigned char)*p;
+            if (*t == ' ') {
+                if (!ehEspaco(r)) break;
+                while (ehEspaco((unsigned char)*p)) p++;
+            } else {
+                if ((r >= 'A' && r <= 'Z' ? r + ('a' - 'A') : r) != (unsigned char)*t) break;
+                p++;
+            }
+            t++;
+        }
+        if (!*t) return 1;
     }
+    return 0;
+}
 
-    p->custo_unitario = custo_base_unitario + rateio_fixo_por_unidade;
+/* o trecho (já normalizado) aparece no nome ou nos ingredientes do produto? */
+static int produtoContem(const struct Catalogo *cat, int idx, const char *trecho) {
+    /* atalho: o texto cru já contém o trecho normalizado (texto em
+       minúsculas, caso comum); strstr da libc é bem mais rápido */
+    if (strstr(cat->nome[idx], trecho) || strstr(cat->ingredientes_desc[idx], trecho)) return 1;
+    return contemNormalizado(cat->nome[idx], trecho) || contemNormalizado(cat->ingredientes_desc[idx], trecho);
+}
 
-    if (p->usar_mei_comercio) p->imposto_percent = 4.0;
+static int compararListas(const void *a, const void *b) {
+    const struct ListaTrigrama *x = *(struct ListaTrigrama *const *)a;
+    const struct ListaTrigrama *y = *(struct ListaTrigrama *const *)b;
+    return (x->qtd > y->qtd) - (x->qtd < y->qtd);
+}
 
-    /* garantir percentuais válidos antes do cálculo */
-    validarPercentuaisProduto(p);
+/* produtos cujo nome ou ingredientes contêm 'consulta' (sem diferenciar
+   maiúsculas), em ordem de índice. *resultado é alocado (free pelo
+   chamador); retorna a quantidade ou -1 sem memória. Consultas com menos
+   de 3 caracteres não têm trigrama e varrem o catálogo */
+int catalogoBuscarTexto(struct Catalogo *cat, const char *consulta, int **resultado) {
+    static unsigned chaves[MAX_DESC];
+    static struct ListaTrigrama *listas[MAX_DESC];
+    char trecho[MAX_DESC];
+    size_t len = textoNormalizar(consulta, trecho, sizeof(trecho));
+    *resultado = NULL;
+
+    int *cand = NULL;
+    int qtd = 0;
+    if (len < 3) {
+        cand = malloc((size_t)(cat->qtd > 0 ? cat->qtd : 1) * sizeof(int));
+        if (!cand) return -1;
+        for (int i = 0; i < cat->qtd; i++)
+            if (!cat->excluido[i]) cand[qtd++] = i;
+    } else {
+        if (cat->indice_texto.capacidade == 0) catalogoIndexarTextos(cat);
+        if (cat->indice_texto.capacidade == 0) return -1;
+        int n = 0;
+        for (size_t i = 0; i + 3 <= len; i++) chaves[n++] = TRIGRAMA(trecho + i);
+        qsort(chaves, (size_t)n, sizeof(unsigned), compararUnsigned);
+        int u = 0;
+        for (int i = 0; i < n; i++) {
+            if (u > 0 && chaves[u - 1] == chaves[i]) continue;
+            chaves[u] = chaves[i];
+            listas[u] = trigramaLista(&cat->indice_texto, chaves[i], 0);
+            if (!listas[u] || listas[u]->qtd == 0) return 0;  /* trigrama sem produto */
+            u++;
+        }
+        /* a menor lista dá os candidatos; as outras só filtram */
+        qsort(listas, (size_t)u, sizeof(listas[0]), compararListas);
+        cand = malloc((size_t)listas[0]->qtd * sizeof(int));
+        if (!cand) return -1;
+        memcpy(cand, listas[0]->idx, (size_t)listas[0]->qtd * sizeof(int));
+        qtd = listas[0]->qtd;
+        for (int k = 1; k < u && qtd > 0; k++) {
+            int m = 0, pos = 0;
+            const int *l = listas[k]->idx;
+            int tam = listas[k]->qtd;
+            for (int i = 0; i < qtd && pos < tam; i++) {
+                /* galope a partir da última posição (listas crescentes): passos
+                   dobrando até passar do candidato, depois busca binária */
+                int passo = 1;
+                while (pos + passo < tam && l[pos + passo] < cand[i]) passo *= 2;
+                int lo = pos + passo / 2, hi = pos + passo < tam ? pos + passo + 1 : tam;
+                if (l[pos] >= cand[i]) lo = hi = pos;
+                while (lo < hi) {
+                    int meio = lo + (hi - lo) / 2;
+                    if (l[meio] < cand[i]) lo = meio + 1;
+                    else hi = meio;
+                }
+                pos = lo;
+                if (pos < tam && l[pos] == cand[i]) cand[m++] = cand[i];
+            }
+            /* listas em ordem crescente de tamanho: se esta quase não filtrou,
+               as próximas (maiores) também não vão; a confirmação no texto
+               cuida do resto */
+            int pouco = m > qtd - qtd / 10;
+            qtd = m;
+            if (pouco) break;
+        }
+    }
 
-    double lucro_valor = p->custo_unitario * (p->lucro_produtor_percent / 100.0);
-    double preco_com_lucro = p->custo_unitario + lucro_valor;
+    /* confirma no texto: ter os trigramas não garante o trecho inteiro */
+    int m = 0;
+    for (int i = 0; i < qtd; i++)
+        if (produtoContem(cat, cand[i], trecho)) cand[m++] = cand[i];
+    *resultado = cand;
+    return m;
+}
 
-    double total_percent = p->imposto_percent + p->taxa_cartao_percent;
+/* ----- Índices ordenados (faixa e top-K) ----- */
+/* fração do preço que sobra de lucro depois de imposto e taxa do cartão (%) */
+double margemEfetiva(const struct ColunasPreco *c, int i) {
+    double preco = c->preco_produtor[i];
+    if (preco == 0.0) return 0.0;
+    double total_percent = c->imposto_percent[i] + c->taxa_cartao_percent[i];
     if (total_percent >= 100.0) total_percent = 99.0;
+    return (preco * (1.0 - total_percent / 100.0) - c->custo_unitario[i]) / preco * 100.0;
+}
 
-    p->preco_produtor = preco_com_lucro / (1.0 - (total_percent / 100.0));
+static double chaveOrdem(const struct ColunasPreco *c, int ordem, int i) {
+    switch (ordem) {
+        case ORDEM_PRECO: return c->preco_produtor[i];
+        case ORDEM_CUSTO: return c->custo_unitario[i];
+        default: return margemEfetiva(c, i);
+    }
 }
 
-/* ----- Configurar despesas fixas globais ----- */
-void configurarDespesasFixas() {
-    char buf[BUF_SIZE];
-    imprimir_cabecalho("CONFIGURAR DESPESAS FIXAS MENSAIS");
+/* ordem total: chave crescente (NaN depois de tudo), empate pelo slot */
+static int entradaMenor(double ca, int ia, double cb, int ib) {
+    int na = ca != ca, nb = cb != cb;
+    if (na != nb) return nb;
+    if (!na && ca != cb) return ca < cb;
+    return ia < ib;
+}
 
-    printf("\n%s%sVALORES ATUAIS:%s\n", BOLD, YELLOW, RESET);
-    imprimir_valor("Agua", config.gasto_agua);
-    imprimir_valor("Luz", config.gasto_luz);
-    imprimir_valor("Gas", config.gasto_gas);
-    printf("%sProducao mensal          :%s %d unidades\n\n", CYAN, RESET, config.producao_mensal_unidades);
+static int compararEntradas(const void *a, const void *b) {
+    const struct EntradaOrdem *x = a, *y = b;
+    if (entradaMenor(x->chave, x->idx, y->chave, y->idx)) return -1;
+    return entradaMenor(y->chave, y->idx, x->chave, x->idx);
+}
 
-    printf("%sInforme gasto mensal com AGUA (R$): %s", CYAN, RESET);
-    lerLinha(buf, sizeof(buf));
-    if (buf[0] != '\0') config.gasto_agua = atof(buf);
+/* bloco onde (chave, idx) está ou entraria: o primeiro cuja última entrada
+   não é menor; depois do último, o último */
+static int ordemBloco(const struct IndiceOrdem *o, double chave, int idx) {
+    int lo = 0, hi = o->qtd_blocos - 1;
+    while (lo < hi) {
+        int meio = lo + (hi - lo) / 2;
+        const struct BlocoOrdem *b = o->blocos[meio];
+        const struct EntradaOrdem *u = &b->e[b->qtd - 1];
+        if (entradaMenor(u->chave, u->idx, chave, idx)) lo = meio + 1;
+        else hi = meio;
+    }
+    return lo;
+}
 
-    printf("%sInforme gasto mensal com LUZ (R$): %s", CYAN, RESET);
-    lerLinha(buf, sizeof(buf));
-    if (buf[0] != '\0') config.gasto_luz = atof(buf);
+/* primeira posição do bloco cuja entrada não é menor que (chave, idx) */
+static int blocoPosicao(const struct BlocoOrdem *b, double chave, int idx) {
+    int lo = 0, hi = b->qtd;
+    while (lo < hi) {
+        int meio = lo + (hi - lo) / 2;
+        if (entradaMenor(b->e[meio].chave, b->e[meio].idx, chave, idx)) lo = meio + 1;
+        else hi = meio;
+    }
+    return lo;
+}
 
-    printf("%sInforme gasto mensal com GAS (R$): %s", CYAN, RESET);
-    lerLinha(buf, sizeof(buf));
-    if (buf[0] != '\0') config.gasto_gas = atof(buf);
+static void ordemLiberar(struct IndiceOrdem *o) {
+    for (int b = 0; b < o->qtd_blocos; b++) free(o->blocos[b]);
+    free(o->blocos);
+    memset(o, 0, sizeof(*o));
+}
 
-    printf("%sInforme a PRODUCAO MENSAL (unidades/mes): %s", CYAN, RESET);
-    lerLinha(buf, sizeof(buf));
-    if (buf[0] != '\0') config.producao_mensal_unidades = atoi(buf);
+static void ordenadosLiberar(struct IndicesOrdenados *ord) {
+    for (int k = 0; k < NUM_ORDENS; k++) ordemLiberar(&ord->ordem[k]);
+    ord->versao = 0;
+}
 
-    if (!salvarConfigAtomic()) {
-        imprimir_aviso("Falha ao salvar configuracoes em disco.");
-    } else {
-        imprimir_sucesso("Configuracoes atualizadas com sucesso!");
+/* abre espaço para um bloco novo na posição b do vetor de blocos */
+static struct BlocoOrdem *ordemNovoBloco(struct IndiceOrdem *o, int b) {
+    if (o->qtd_blocos == o->cap_blocos) {
+        int cap = o->cap_blocos ? o->cap_blocos * 2 : 16;
+        struct BlocoOrdem **novo = realloc(o->blocos, (size_t)cap * sizeof(*novo));
+        if (!novo) return NULL;
+        o->blocos = novo;
+        o->cap_blocos = cap;
     }
-    pausar();
+    struct BlocoOrdem *bl = malloc(sizeof(*bl));
+    if (!bl) return NULL;
+    bl->qtd = 0;
+    memmove(&o->blocos[b + 1], &o->blocos[b], (size_t)(o->qtd_blocos - b) * sizeof(*o->blocos));
+    o->blocos[b] = bl;
+    o->qtd_blocos++;
+    return bl;
 }
 
-/* ----- Listar produtos ----- */
-void listarProdutos(struct Produto produtos[], int qtd) {
-    imprimir_cabecalho("LISTA DE PRODUTOS CADASTRADOS");
+struct MontagemOrdens {
+    struct Catalogo *cat;
+    struct EntradaOrdem *tmp[NUM_ORDENS];
+    int n[NUM_ORDENS];
+};
 
-    if (qtd == 0) {
-        imprimir_aviso("Nenhum produto cadastrado ainda.");
-        pausar();
-        return;
+/* um pedaço por índice: cada um ordena o seu vetor temporário */
+static void ordensOrdenar(int ini, int fim, int w, void *ctx) {
+    (void)w;
+    struct MontagemOrdens *m = ctx;
+    for (int k = ini; k < fim; k++) {
+        struct EntradaOrdem *tmp = m->tmp[k];
+        int n = 0;
+        for (int i = 0; i < m->cat->qtd; i++) {
+            if (m->cat->excluido[i]) continue;
+            tmp[n].chave = chaveOrdem(&m->cat->col, k, i);
+            tmp[n].idx = i;
+            n++;
+        }
+        qsort(tmp, (size_t)n, sizeof(*tmp), compararEntradas);
+        m->n[k] = n;
     }
+}
 
-    for (int i = 0; i < qtd; i++) {
-        struct Produto *p = &produtos[i];
+/* monta os três índices com os preços da config atual: ordena tudo em
+   vetores temporários (os três ao mesmo tempo, no executor paralelo) e
+   corta em blocos 3/4 cheios (folga para inserções) */
+static int ordenadosMontar(struct Catalogo *cat) {
+    struct IndicesOrdenados *ord = &cat->ordenados;
+    ordenadosLiberar(ord);
+    catalogoAtualizarPrecos(cat);
+    int vivos = catalogoVivos(cat);
+    struct MontagemOrdens m = { cat, { NULL }, { 0 } };
+    int ok = 1;
+    for (int k = 0; k < NUM_ORDENS; k++) {
+        m.tmp[k] = malloc((size_t)(vivos > 0 ? vivos : 1) * sizeof(*m.tmp[k]));
+        ok = ok && m.tmp[k];
+    }
+    if (ok) {
+        struct Paralelo p = { ordensOrdenar, NULL, &m, NUM_ORDENS, 1 };
+        paraleloExecutar(&p);
+    }
+    const int cheio = ORDEM_BLOCO * 3 / 4;
+    for (int k = 0; ok && k < NUM_ORDENS; k++) {
+        struct IndiceOrdem *o = &ord->ordem[k];
+        int n = m.n[k];
+        for (int ini = 0; ini < n || o->qtd_blocos == 0; ini += cheio) {
+            struct BlocoOrdem *bl = ordemNovoBloco(o, o->qtd_blocos);
+            if (!bl) {
+                ok = 0;
+                break;
+            }
+            bl->qtd = n - ini < cheio ? n - ini : cheio;
+            memcpy(bl->e, m.tmp[k] + ini, (size_t)bl->qtd * sizeof(*m.tmp[k]));
+        }
+        o->qtd = n;
+    }
+    for (int k = 0; k < NUM_ORDENS; k++) free(m.tmp[k]);
+    if (!ok) {
+        ordenadosLiberar(ord);
+        return 0;
+    }
+    ord->versao = config_versao;
+    return 1;
+}
 
-        printf("\n%s%s+--- PRODUTO #%d --------------------------------------------------+%s\n", BOLD, BLUE, i+1, RESET);
-        printf("%s|%s %s%-60s%s\n", BLUE, RESET, BOLD, p->nome, RESET);
-        printf("%s+-------------------------------------------------------------------+%s\n", BLUE, RESET);
+/* os índices valem para a config atual? (senão não há o que manter) */
+static int ordenadosVigentes(const struct Catalogo *cat) {
+    return cat->ordenados.versao != 0 && cat->ordenados.versao == config_versao;
+}
 
-        if (p->modo == 1) {
-            printf("%sModo                         :%s Custo direto por unidade\n", CYAN, RESET);
-            imprimir_valor("Custo informado/unidade", p->preco_custo);
-        } else {
-            printf("%sModo                         :%s Receita (ingredientes)\n", CYAN, RESET);
-            imprimir_valor("Investimento total", p->investimento_total);
-            printf("%sRendimento                   :%s %d unidades\n", CYAN, RESET, p->rendimento);
-            printf("\n%s  Ingredientes:%s\n%s", YELLOW, RESET, p->ingredientes_desc);
-            imprimir_valor("Despesas variaveis", p->despesas_variaveis);
+/* tira o produto idx dos índices (com o preço que ele tem agora) */
+static void ordenadosRemover(struct Catalogo *cat, int idx) {
+    if (!ordenadosVigentes(cat)) return;
+    catalogoAtualizarPreco(cat, idx);
+    for (int k = 0; k < NUM_ORDENS; k++) {
+        struct IndiceOrdem *o = &cat->ordenados.ordem[k];
+        double chave = chaveOrdem(&cat->col, k, idx);
+        int b = ordemBloco(o, chave, idx);
+        struct BlocoOrdem *bl = o->blocos[b];
+        int pos = blocoPosicao(bl, chave, idx);
+        if (pos == bl->qtd || bl->e[pos].idx != idx) {
+            /* não deveria acontecer: descarta e remonta na próxima consulta */
+            ordenadosLiberar(&cat->ordenados);
+            return;
         }
+        memmove(&bl->e[pos], &bl->e[pos + 1], (size_t)(bl->qtd - pos - 1) * sizeof(bl->e[0]));
+        bl->qtd--;
+        o->qtd--;
+        /* bloco vazio sai do vetor (sempre sobra ao menos um) */
+        if (bl->qtd == 0 && o->qtd_blocos > 1) {
+            free(bl);
+            memmove(&o->blocos[b], &o->blocos[b + 1], (size_t)(o->qtd_blocos - b - 1) * sizeof(*o->blocos));
+            o->qtd_blocos--;
+        }
+    }
+}
 
-        double rateio = (config.producao_mensal_unidades > 0) ?
-            (config.gasto_agua + config.gasto_luz + config.gasto_gas) / config.producao_mensal_unidades : 0.0;
-        imprimir_valor("Rateio despesas fixas/un", rateio);
-        imprimir_valor("CUSTO UNITARIO FINAL", p->custo_unitario);
+/* reprecifica o produto idx e o põe no lugar certo de cada índice; bloco
+   cheio é dividido ao meio */
+static void ordenadosInserir(struct Catalogo *cat, int idx) {
+    if (!ordenadosVigentes(cat)) return;
+    catalogoAtualizarPreco(cat, idx);
+    for (int k = 0; k < NUM_ORDENS; k++) {
+        struct IndiceOrdem *o = &cat->ordenados.ordem[k];
+        double chave = chaveOrdem(&cat->col, k, idx);
+        int b = ordemBloco(o, chave, idx);
+        struct BlocoOrdem *bl = o->blocos[b];
+        if (bl->qtd == ORDEM_BLOCO) {
+            struct BlocoOrdem *dir = ordemNovoBloco(o, b + 1);
+            if (!dir) {
+                ordenadosLiberar(&cat->ordenados);
+                return;
+            }
+            dir->qtd = ORDEM_BLOCO / 2;
+            memcpy(dir->e, &bl->e[ORDEM_BLOCO / 2], (size_t)dir->qtd * sizeof(bl->e[0]));
+            bl->qtd = ORDEM_BLOCO / 2;
+            const struct EntradaOrdem *u = &bl->e[bl->qtd - 1];
+            if (entradaMenor(u->chave, u->idx, chave, idx)) bl = dir;
+        }
+        int pos = blocoPosicao(bl, chave, idx);
+        memmove(&bl->e[pos + 1], &bl->e[pos], (size_t)(bl->qtd - pos) * sizeof(bl->e[0]));
+        bl->e[pos].chave = chave;
+        bl->e[pos].idx = idx;
+        bl->qtd++;
+        o->qtd++;
+    }
+}
 
-        printf("\n%s  Configuracoes financeiras:%s\n", YELLOW, RESET);
-        printf("%sImposto                      :%s %.2f%% %s\n",
-               CYAN, RESET, p->imposto_percent, p->usar_mei_comercio ? "(MEI Comercio)" : "");
-        printf("%sTaxa cartao                  :%s %.2f%%\n", CYAN, RESET, p->taxa_cartao_percent);
-        printf("%sLucro desejado               :%s %.2f%%\n", CYAN, RESET, p->lucro_produtor_percent);
+/* índice pedido, com preços da config atual (remonta se preciso); NULL sem
+   memória */
+const struct IndiceOrdem *catalogoOrdenado(struct Catalogo *cat, int ordem) {
+    if (!ordenadosVigentes(cat) && !ordenadosMontar(cat)) return NULL;
+    return &cat->ordenados.ordem[ordem];
+}
 
-        printf("\n%s%s> PRECO FINAL SUGERIDO: R$ %.2f%s\n", BOLD, GREEN, p->preco_produtor, RESET);
-        imprimir_linha('-', 70);
+/* cursor na primeira entrada com chave >= 'chave' (ou > 'chave', com
+   depois != 0); a faixa [min, max] vai de ordemLimite(min, 0) até antes
+   de ordemLimite(max, 1). NaN fica depois de qualquer limite */
+void ordemLimite(const struct IndiceOrdem *o, double chave, int depois, struct CursorOrdem *c) {
+    c->o = o;
+    int lo = 0, hi = o->qtd_blocos;
+    while (lo < hi) {
+        int meio = lo + (hi - lo) / 2;
+        const struct BlocoOrdem *b = o->blocos[meio];
+        double u = b->qtd ? b->e[b->qtd - 1].chave : chave;
+        if (b->qtd && u == u && (depois ? u <= chave : u < chave)) lo = meio + 1;
+        else hi = meio;
     }
+    c->bloco = lo;
+    c->pos = 0;
+    if (lo == o->qtd_blocos) return;
+    const struct BlocoOrdem *b = o->blocos[lo];
+    int a = 0, z = b->qtd;
+    while (a < z) {
+        int meio = a + (z - a) / 2;
+        double v = b->e[meio].chave;
+        if (v == v && (depois ? v <= chave : v < chave)) a = meio + 1;
+        else z = meio;
+    }
+    c->pos = a;
+    if (c->pos == b->qtd) cursorAvancar(c, 1);
+}
 
-    pausar();
+/* cursor na menor (ultimo == 0) ou na maior entrada */
+void ordemExtremo(const struct IndiceOrdem *o, int ultimo, struct CursorOrdem *c) {
+    c->o = o;
+    c->bloco = ultimo ? o->qtd_blocos - 1 : 0;
+    c->pos = ultimo && o->qtd_blocos ? o->blocos[c->bloco]->qtd - 1 : 0;
+    if (o->qtd_blocos && (c->pos < 0 || c->pos >= o->blocos[c->bloco]->qtd)) cursorAvancar(c, ultimo ? -1 : 1);
 }
 
-/* ----- Editar produto ----- */
-void editarProduto(struct Produto produtos[], int qtd) {
-    if (qtd == 0) {
-        imprimir_aviso("Nenhum produto para editar.");
-        pausar();
-        return;
+/* entrada sob o cursor; NULL se ele saiu do índice */
+const struct EntradaOrdem *cursorEntrada(const struct CursorOrdem *c) {
+    if (c->bloco < 0 || c->bloco >= c->o->qtd_blocos) return NULL;
+    const struct BlocoOrdem *b = c->o->blocos[c->bloco];
+    return c->pos >= 0 && c->pos < b->qtd ? &b->e[c->pos] : NULL;
+}
+
+/* anda uma entrada para frente (passo 1) ou para trás (-1), pulando blocos
+   vazios */
+void cursorAvancar(struct CursorOrdem *c, int passo) {
+    c->pos += passo;
+    while (c->bloco >= 0 && c->bloco < c->o->qtd_blocos &&
+           (c->pos < 0 || c->pos >= c->o->blocos[c->bloco]->qtd)) {
+        c->bloco += passo;
+        if (c->bloco < 0 || c->bloco >= c->o->qtd_blocos) break;
+        c->pos = passo > 0 ? 0 : c->o->blocos[c->bloco]->qtd - 1;
     }
+}
 
-    listarProdutos(produtos, qtd);
+/* ----- Catálogo (colunas no heap com crescimento geométrico) ----- */
+void catalogoIniciar(struct Catalogo *cat) {
+    memset(cat, 0, sizeof(*cat));
+}
 
-    char buf[BUF_SIZE];
-    printf("\n%sNumero do produto para editar: %s", YELLOW, RESET);
-    lerLinha(buf, sizeof(buf));
-    int idx = atoi(buf) - 1;
+void catalogoLiberar(struct Catalogo *cat) {
+#define X(tipo, campo) free(cat->col.campo);
+    COLUNAS_PRECO(X)
+#undef X
+    free(cat->versao_preco);
+    free(cat->nome);
+    free(cat->ingredientes_desc);
+    free(cat->excluido);
+    free(cat->livres);
+    indiceLiberar(&cat->indice_nome);
+    trigramaLiberar(&cat->indice_texto);
+    ordenadosLiberar(&cat->ordenados);
+    arenaLiberar(&cat->textos);
+    if (cat->mapa && cat->mapa_no_heap) free((void *)cat->mapa);
+    else if (cat->mapa) munmap((void *)cat->mapa, cat->mapa_tamanho);
+    struct Alteracoes *alteracoes = cat->alteracoes;
+    catalogoIniciar(cat);
+    /* quem acompanha continua acompanhando a próxima carga */
+    cat->alteracoes = alteracoes;
+    if (alteracoes) alteracoes->tudo = 1;
+}
 
-    if (idx < 0 || idx >= qtd) {
-        imprimir_erro("Numero invalido!");
-        pausar();
+/* anota o slot em cat->alteracoes (se alguém acompanha) */
+static void catalogoMarcar(struct Catalogo *cat, int idx) {
+    struct Alteracoes *a = cat->alteracoes;
+    if (!a || a->tudo) return;
+    if (a->qtd == a->capacidade) {
+        int cap = a->capacidade ? a->capacidade * 2 : 64;
+        int *novo = realloc(a->idx, (size_t)cap * sizeof(int));
+        if (!novo) {
+            a->tudo = 1;
+            return;
+        }
+        a->idx = novo;
+        a->capacidade = cap;
+    }
+    a->idx[a->qtd++] = idx;
+}
+
+/* o texto está dentro do arquivo mapeado (e não na arena)? */
+static int noMapa(const struct Catalogo *cat, const char *s) {
+    return cat->mapa && s >= cat->mapa && s < cat->mapa + cat->mapa_tamanho;
+}
+
+/* acrescenta um produto que está dentro do mapa sem copiar os textos
+   (só as colunas numéricas); textos sem terminador vão para a arena */
+static int catalogoAdicionarMapeado(struct Catalogo *cat, const struct Produto *p) {
+    if (cat->qtd >= cat->capacidade) {
+        if (cat->capacidade > 0x7fffffff / 2) return -1;
+        int nova = cat->capacidade < CATALOGO_CAP_INICIAL ? CATALOGO_CAP_INICIAL : cat->capacidade * 2;
+        if (!catalogoReservar(cat, nova)) return -1;
+    }
+    int idx = cat->qtd;
+    cat->nome[idx] = NULL;
+    cat->ingredientes_desc[idx] = NULL;
+    if (memchr(p->nome, '\0', sizeof(p->nome)))
+        cat->nome[idx] = p->nome;
+    else if (!arenaSubstituir(&cat->textos, &cat->nome[idx], p->nome, sizeof(p->nome)))
+        return -1;
+    if (memchr(p->ingredientes_desc, '\0', sizeof(p->ingredientes_desc)))
+        cat->ingredientes_desc[idx] = p->ingredientes_desc;
+    else if (!arenaSubstituir(&cat->textos, &cat->ingredientes_desc[idx], p->ingredientes_desc,
+                              sizeof(p->ingredientes_desc)))
+        return -1;
+#define X(tipo, campo) cat->col.campo[idx] = p->campo;
+    COLUNAS_PRECO(X)
+#undef X
+    cat->versao_preco[idx] = 0;
+    cat->excluido[idx] = 0;
+    cat->qtd++;
+    return idx;
+}
+
+/* garante espaço para pelo menos 'capacidade' produtos; retorna 0 sem memória */
+int catalogoReservar(struct Catalogo *cat, int capacidade) {
+    if (capacidade <= cat->capacidade) return 1;
+    size_t n = (size_t)capacidade;
+    /* cada coluna é realocada separadamente; se uma falhar, as já crescidas
+       continuam válidas e a capacidade antiga segue correta */
+#define X(tipo, campo) { \
+        tipo *novo = realloc(cat->col.campo, n * sizeof(tipo)); \
+        if (!novo) return 0; \
+        cat->col.campo = novo; \
+    }
+    COLUNAS_PRECO(X)
+#undef X
+    unsigned *versoes = realloc(cat->versao_preco, n * sizeof(unsigned));
+    if (!versoes) return 0;
+    cat->versao_preco = versoes;
+    const char **nomes = realloc(cat->nome, n * sizeof(char *));
+    if (!nomes) return 0;
+    cat->nome = nomes;
+    const char **descs = realloc(cat->ingredientes_desc, n * sizeof(char *));
+    if (!descs) return 0;
+    cat->ingredientes_desc = descs;
+    unsigned char *excluido = realloc(cat->excluido, n);
+    if (!excluido) return 0;
+    cat->excluido = excluido;
+    int *livres = realloc(cat->livres, n * sizeof(int));
+    if (!livres) return 0;
+    cat->livres = livres;
+    cat->capacidade = capacidade;
+    return 1;
+}
+
+/* tira da pilha de livres a lápide idx, que voltou a ter produto (busca a
+   partir do topo: no cadastro ela é o próprio topo) */
+static void livresRetirar(struct Catalogo *cat, int idx) {
+    for (int k = cat->qtd_livres - 1; k >= 0; k--) {
+        if (cat->livres[k] != idx) continue;
+        memmove(&cat->livres[k], &cat->livres[k + 1], (size_t)(cat->qtd_livres - k - 1) * sizeof(int));
+        cat->qtd_livres--;
         return;
     }
+}
 
-    struct Produto *p = &produtos[idx];
-    imprimir_cabecalho("EDITAR PRODUTO");
+/* grava uma cópia de *p no slot idx: no fim (idx == qtd) ou sobre uma
+   lápide/produto existente. É o que o replay do log usa, com o índice que
+   foi registrado; retorna o índice ou -1 se faltar memória */
+int catalogoInserirEm(struct Catalogo *cat, int idx, const struct Produto *p) {
+    if (idx < 0 || idx > cat->qtd) return -1;
+    if (idx < cat->qtd) {
+        if (!catalogoGravar(cat, idx, p)) return -1;
+        /* lápide reaproveitada sai da pilha, senão cada exclusão seguinte
+           do mesmo slot a empilharia de novo */
+        if (cat->excluido[idx]) livresRetirar(cat, idx);
+        cat->excluido[idx] = 0;
+        return idx;
+    }
+    if (cat->qtd >= cat->capacidade) {
+        /* dobra a capacidade: inserções em O(1) amortizado */
+        if (cat->capacidade > 0x7fffffff / 2) return -1;
+        int nova = cat->capacidade < CATALOGO_CAP_INICIAL ? CATALOGO_CAP_INICIAL : cat->capacidade * 2;
+        if (!catalogoReservar(cat, nova)) return -1;
+    }
+    cat->nome[idx] = NULL;
+    cat->ingredientes_desc[idx] = NULL;
+    if (!catalogoGravar(cat, idx, p)) return -1;
+    cat->excluido[idx] = 0;
+    cat->qtd++;
+    return idx;
+}
 
-    printf("%sNovo nome [Enter mantem: %s]: %s", CYAN, p->nome, RESET);
-    lerLinha(buf, sizeof(buf));
-    if (buf[0] != '\0') {
-        strncpy(p->nome, buf, sizeof(p->nome)-1);
-        p->nome[sizeof(p->nome)-1] = '\0';
+/* acrescenta uma cópia de *p, reaproveitando o slot livre mais recente se
+   houver; retorna o índice ou -1 se faltar memória */
+int catalogoAdicionar(struct Catalogo *cat, const struct Produto *p) {
+    int idx = cat->qtd_livres > 0 ? cat->livres[cat->qtd_livres - 1] : cat->qtd;
+    return catalogoInserirEm(cat, idx, p);
+}
+
+int catalogoVivos(const struct Catalogo *cat) {
+    return cat->qtd - cat->qtd_livres;
+}
+
+/* idx aponta para um produto (e não para uma lápide)? */
+int catalogoValido(const struct Catalogo *cat, int idx) {
+    return idx >= 0 && idx < cat->qtd && !cat->excluido[idx];
+}
+
+/* monta um struct Produto completo (quente + frio) a partir do catálogo,
+   com o preço já atualizado para a config corrente */
+void catalogoObter(struct Catalogo *cat, int idx, struct Produto *p) {
+    catalogoAtualizarPreco(cat, idx);
+#define X(tipo, campo) p->campo = cat->col.campo[idx];
+    COLUNAS_PRECO(X)
+#undef X
+    /* strncpy completa com zeros: o registro em disco fica determinístico */
+    strncpy(p->nome, cat->nome[idx], sizeof(p->nome) - 1);
+    p->nome[sizeof(p->nome) - 1] = '\0';
+    strncpy(p->ingredientes_desc, cat->ingredientes_desc[idx], sizeof(p->ingredientes_desc) - 1);
+    p->ingredientes_desc[sizeof(p->ingredientes_desc) - 1] = '\0';
+}
+
+/* quando mais da metade da arena é lixo, copia só as strings vivas para uma
+   arena nova (custo O(bytes vivos), amortizado pelas edições que geraram o lixo).
+   Textos que apontam para o arquivo mapeado continuam onde estão */
+static void catalogoCompactarTextos(struct Catalogo *cat) {
+    struct ArenaTexto *velha = &cat->textos;
+    if (velha->desperdicio < ARENA_BLOCO || velha->desperdicio * 2 < velha->total) return;
+
+    struct ArenaTexto nova = { NULL, 0, 0 };
+    const char **nomes = malloc((size_t)cat->capacidade * sizeof(char *));
+    const char **descs = malloc((size_t)cat->capacidade * sizeof(char *));
+    int ok = nomes && descs;
+    for (int i = 0; ok && i < cat->qtd; i++) {
+        const char *n = cat->nome[i];
+        const char *d = cat->ingredientes_desc[i];
+        if (cat->excluido[i]) {
+            nomes[i] = descs[i] = NULL;
+            continue;
+        }
+        nomes[i] = noMapa(cat, n) ? n : arenaCopiar(&nova, n, strlen(n));
+        descs[i] = noMapa(cat, d) ? d : arenaCopiar(&nova, d, strlen(d));
+        ok = nomes[i] && descs[i];
+    }
+    if (!ok) {
+        /* sem memória: mantém a arena antiga, que continua válida */
+        free(nomes);
+        free(descs);
+        arenaLiberar(&nova);
+        return;
     }
+    free(cat->nome);
+    free(cat->ingredientes_desc);
+    cat->nome = nomes;
+    cat->ingredientes_desc = descs;
+    arenaLiberar(velha);
+    *velha = nova;
+}
 
-    printf("%sAlterar modo/ingredientes? (s/n): %s", CYAN, RESET);
-    lerLinha(buf, sizeof(buf));
-    if (buf[0] == 's' || buf[0] == 'S') {
-        printf("%sNovo modo (1=custo direto | 2=receita): %s", CYAN, RESET);
-        lerLinha(buf, sizeof(buf));
-        p->modo = atoi(buf);
-        if (p->modo == 1) {
-            printf("%sPreco de custo/un (R$): %s", CYAN, RESET);
-            lerLinha(buf, sizeof(buf));
-            p->preco_custo = atof(buf);
-            p->investimento_total = p->preco_custo;
-            p->rendimento = 1;
-            p->ingredientes_desc[0] = '\0';
-            p->despesas_variaveis = 0.0;
-        } else {
-            double custoCalc = coletarIngredientesText(p->ingredientes_desc, sizeof(p->ingredientes_desc), &p->rendimento);
-            if (custoCalc >= 0.0) p->investimento_total = custoCalc;
-            printf("%sDespesas variaveis (R$) [Enter mantem %.2f]: %s", CYAN, p->despesas_variaveis, RESET);
-            lerLinha(buf, sizeof(buf));
-            if (buf[0] != '\0') p->despesas_variaveis = atof(buf);
+/* grava *p na posição idx; textos só são copiados se mudaram. O item fica
+   sujo: o preço é refeito na próxima leitura (registros do disco podem ter
+   sido calculados com outra config). Produto editado deixa de apontar para o
+   arquivo mapeado (cópia na escrita): o registro dele pode ser reescrito no
+   lugar logo em seguida */
+int catalogoGravar(struct Catalogo *cat, int idx, const struct Produto *p) {
+    /* o índice de trechos só é refeito se algum texto mudou */
+    int textos_mudam = !cat->nome[idx] || !cat->ingredientes_desc[idx] ||
+                       strncmp(cat->nome[idx], p->nome, sizeof(p->nome)) != 0 ||
+                       strncmp(cat->ingredientes_desc[idx], p->ingredientes_desc,
+                               sizeof(p->ingredientes_desc)) != 0;
+    catalogoMarcar(cat, idx);
+    indiceRemover(cat, idx);
+    if (textos_mudam) trigramaRemover(cat, idx);
+    if (cat->nome[idx]) ordenadosRemover(cat, idx);
+    if (noMapa(cat, cat->nome[idx])) cat->nome[idx] = NULL;
+    if (noMapa(cat, cat->ingredientes_desc[idx])) cat->ingredientes_desc[idx] = NULL;
+    int ok = arenaSubstituir(&cat->textos, &cat->nome[idx], p->nome, sizeof(p->nome)) &&
+             arenaSubstituir(&cat->textos, &cat->ingredientes_desc[idx], p->ingredientes_desc,
+                             sizeof(p->ingredientes_desc));
+    indiceInserir(cat, idx);
+    if (textos_mudam) trigramaInserir(cat, idx);
+    if (!ok) {
+        ordenadosLiberar(&cat->ordenados);
+        return 0;
+    }
+#define X(tipo, campo) cat->col.campo[idx] = p->campo;
+    COLUNAS_PRECO(X)
+#undef X
+    cat->versao_preco[idx] = 0;
+    ordenadosInserir(cat, idx);
+    catalogoCompactarTextos(cat);
+    return 1;
+}
+
+/* exclusão O(1): o slot vira lápide e entra na pilha de livres */
+void catalogoRemover(struct Catalogo *cat, int idx) {
+    if (cat->excluido[idx]) return;
+    catalogoMarcar(cat, idx);
+    indiceRemover(cat, idx);
+    trigramaRemover(cat, idx);
+    ordenadosRemover(cat, idx);
+    if (cat->nome[idx] && !noMapa(cat, cat->nome[idx]))
+        cat->textos.desperdicio += strlen(cat->nome[idx]) + 1;
+    if (cat->ingredientes_desc[idx] && !noMapa(cat, cat->ingredientes_desc[idx]))
+        cat->textos.desperdicio += strlen(cat->ingredientes_desc[idx]) + 1;
+    cat->nome[idx] = NULL;
+    cat->ingredientes_desc[idx] = NULL;
+    cat->excluido[idx] = 1;
+    cat->livres[cat->qtd_livres++] = idx;
+    catalogoCompactarTextos(cat);
+}
+
+/* refaz a pilha de livres a partir das lápides (depois da carga/replay);
+   o menor índice fica no topo */
+void catalogoReconstruirLivres(struct Catalogo *cat) {
+    cat->qtd_livres = 0;
+    for (int i = cat->qtd - 1; i >= 0; i--)
+        if (cat->excluido[i]) cat->livres[cat->qtd_livres++] = i;
+}
+
+/* remove as lápides deslocando os produtos vivos para frente, numa única
+   passada O(n); os índices mudam, então só roda junto de uma regravação
+   completa do arquivo (salvarProdutosAtomic) */
+void catalogoCompactar(struct Catalogo *cat) {
+    if (cat->qtd_livres == 0) return;
+    int j = 0;
+    for (int i = 0; i < cat->qtd; i++) {
+        if (cat->excluido[i]) continue;
+        if (i != j) {
+#define X(tipo, campo) cat->col.campo[j] = cat->col.campo[i];
+            COLUNAS_PRECO(X)
+#undef X
+            cat->versao_preco[j] = cat->versao_preco[i];
+            cat->nome[j] = cat->nome[i];
+            cat->ingredientes_desc[j] = cat->ingredientes_desc[i];
+            cat->excluido[j] = 0;
         }
+        j++;
     }
+    cat->qtd = j;
+    cat->qtd_livres = 0;
+    if (cat->alteracoes) cat->alteracoes->tudo = 1;
+    /* os índices mudaram: o índice de nomes é remontado e o de trechos
+       descartado (volta a ser montado na próxima busca) */
+    if (cat->indice_nome.capacidade) catalogoIndexarNomes(cat);
+    trigramaLiberar(&cat->indice_texto);
+    ordenadosLiberar(&cat->ordenados);
+}
 
-    printf("%sUsar MEI comercio? (s/n) [atual: %s]: %s", CYAN, p->usar_mei_comercio ? "sim" : "nao", RESET);
-    lerLinha(buf, sizeof(buf));
-    if (buf[0] == 's' || buf[0] == 'S') {
-        p->usar_mei_comercio = 1;
-        p->imposto_percent = 4.0;
+/* reprecifica o item idx se o preço foi calculado com config antiga;
+   retorna 1 se percentuais foram ajustados */
+int catalogoAtualizarPreco(struct Catalogo *cat, int idx) {
+    if (cat->versao_preco[idx] == config_versao) return 0;
+    int ajustes = calcularLote(&cat->col, idx, idx + 1, rateioDespesasFixas());
+    cat->versao_preco[idx] = config_versao;
+    return ajustes;
+}
+
+#define REPRECIFICAR_GRAO 4096
+
+struct Reprecificacao {
+    struct Catalogo *cat;
+    double rateio;
+    int ini;
+    int ajustes[PARALELO_MAX_TRABALHADORES];
+};
+
+/* trechos contíguos de itens sujos vão juntos para o kernel SIMD */
+static void reprecificarFaixa(int ini, int fim, int w, void *ctx) {
+    struct Reprecificacao *r = ctx;
+    struct Catalogo *cat = r->cat;
+    int i = r->ini + ini;
+    fim += r->ini;
+    while (i < fim) {
+        if (cat->versao_preco[i] == config_versao) { i++; continue; }
+        int ini_sujo = i;
+        while (i < fim && cat->versao_preco[i] != config_versao)
+            cat->versao_preco[i++] = config_versao;
+        r->ajustes[w] += calcularLote(&cat->col, ini_sujo, i, r->rateio);
+    }
+}
+
+/* reprecifica todos os itens sujos, em lote e no executor paralelo (a
+   partir do primeiro sujo: sem nenhum, não sobe thread); retorna quantos
+   tiveram percentuais ajustados */
+int catalogoAtualizarPrecos(struct Catalogo *cat) {
+    int i = 0;
+    while (i < cat->qtd && cat->versao_preco[i] == config_versao) i++;
+    if (i == cat->qtd) return 0;
+    struct Reprecificacao r = { cat, rateioDespesasFixas(), i, { 0 } };
+    struct Paralelo p = { reprecificarFaixa, NULL, &r, cat->qtd - i, REPRECIFICAR_GRAO };
+    paraleloExecutar(&p);
+    int ajustes = 0;
+    for (int w = 0; w < PARALELO_MAX_TRABALHADORES; w++) ajustes += r.ajustes[w];
+    return ajustes;
+}
+
+/* ----- Funções de arquivo (atômico com temp + rename + backup) ----- */
+/* abre (ou cria) produtos.lck na primeira vez; 0 se não houver como
+   coordenar (diretório só de leitura): o processo trabalha sozinho */
+static int compartilhamentoAbrir(void) {
+    if (!compartilhado.aberto) {
+        compartilhado.aberto = 1;
+        compartilhado.fd = open(ARQ_PRODUTOS_LCK, O_RDWR | O_CREAT, 0644);
+    }
+    return compartilhado.fd >= 0;
+}
+
+/* gravar só sob a trava de produtos.lck (ou sem coordenação nenhuma); um
+   leitor que recarrega os arquivos não conserta nem converte nada */
+static int gravacaoPermitida(void) {
+    return !compartilhamentoAbrir() || compartilhado.travado > 0;
+}
+
+/* cópia simples de arq em bak, para quando o link não é possível (sistema
+   de arquivos sem hard links) */
+static int arquivoCopiar(const char *arq, const char *bak) {
+    FILE *in = fopen(arq, "rb");
+    if (!in) return 0;
+    FILE *out = fopen(bak, "wb");
+    if (!out) {
+        fclose(in);
+        return 0;
+    }
+    char buf[65536];
+    size_t n;
+    int ok = 1;
+    while (ok && (n = fread(buf, 1, sizeof(buf), in)) > 0) ok = fwrite(buf, 1, n, out) == n;
+    ok = ok && !ferror(in) && fflush(out) == 0;
+    fclose(in);
+    if (fclose(out) != 0) ok = 0;
+    if (!ok) remove(bak);
+    return ok;
+}
+
+/* põe o temporário já gravado no lugar de arq com um rename só: quem lê
+   sem a trava nunca encontra arq faltando. O antigo fica em bak por um
+   hard link (ou por uma cópia) feito antes */
+static int trocarPorTemporario(const char *tmp, const char *arq, const char *bak) {
+    remove(bak);
+    if (link(arq, bak) != 0 && errno != ENOENT && !arquivoCopiar(arq, bak)) {
+        remove(tmp);
+        return 0;
+    }
+    if (rename(tmp, arq) != 0) {
+        remove(tmp);
+        return 0;
+    }
+    return 1;
+}
+
+int salvarConfigAtomic() {
+    /* escreve temporário */
+    struct CabecalhoConfig cab;
+    memset(&cab, 0, sizeof(cab));
+    memcpy(cab.magic, CONFIG_MAGIC, sizeof(cab.magic));
+    cab.ordem = FORMATO_ORDEM;
+    cab.esquema = CONFIG_ESQUEMA;
+    cab.tamanho = sizeof(struct Config);
+    cab.crc = crc32Atualizar(crc32Atualizar(0, &cab, offsetof(struct CabecalhoConfig, crc)),
+                             &config, sizeof(struct Config));
+
+    FILE *f = fopen(ARQ_CONFIG_TMP, "wb");
+    if (!f) return 0;
+    if (fwrite(&cab, sizeof(cab), 1, f) != 1 || fwrite(&config, sizeof(struct Config), 1, f) != 1) {
+        fclose(f);
+        remove(ARQ_CONFIG_TMP);
+        return 0;
+    }
+    /* disco cheio ou erro de E/S: o arquivo bom fica onde está */
+    int gravado = fflush(f) == 0 && fsync(fileno(f)) == 0;
+    if (fclose(f) != 0 || !gravado) {
+        remove(ARQ_CONFIG_TMP);
+        return 0;
+    }
+    if (!trocarPorTemporario(ARQ_CONFIG_TMP, ARQ_CONFIG, ARQ_CONFIG_BAK)) return 0;
+    compartilhado.alterou |= ALTEROU_CONFIG;
+    return 1;
+}
+
+/* aceita o formato com cabeçalho e o struct Config cru das versões
+   anteriores; este é regravado no formato novo */
+int carregarConfig() {
+    FILE *f = fopen(ARQ_CONFIG, "rb");
+    if (!f) return 0;
+    struct CabecalhoConfig cab;
+    struct Config lida;
+    memset(&lida, 0, sizeof(lida));
+    int ok = 0, legado = 0;
+    if (fread(&cab, sizeof(cab), 1, f) == 1 && memcmp(cab.magic, CONFIG_MAGIC, sizeof(cab.magic)) == 0) {
+        ok = cab.ordem == FORMATO_ORDEM && cab.esquema <= CONFIG_ESQUEMA &&
+             cab.tamanho == sizeof(struct Config) &&
+             fread(&lida, sizeof(lida), 1, f) == 1 &&
+             crc32Atualizar(crc32Atualizar(0, &cab, offsetof(struct CabecalhoConfig, crc)),
+                            &lida, sizeof(lida)) == cab.crc;
     } else {
-        p->usar_mei_comercio = 0;
-        printf("%sImposto (%%) [atual %.2f, Enter mantem]: %s", CYAN, p->imposto_percent, RESET);
-        lerLinha(buf, sizeof(buf));
-        if (buf[0] != '\0') p->imposto_percent = atof(buf);
+        rewind(f);
+        ok = legado = fread(&lida, sizeof(lida), 1, f) == 1;
     }
+    fclose(f);
+    if (!ok) return 0;
+    config = lida;
+    config_versao++;
+    if (legado && gravacaoPermitida()) salvarConfigAtomic();
+    return 1;
+}
 
-    printf("%sTaxa cartao [atual %.2f, Enter mantem]: %s", CYAN, p->taxa_cartao_percent, RESET);
-    lerLinha(buf, sizeof(buf));
-    if (buf[0] != '\0') p->taxa_cartao_percent = atof(buf);
+static unsigned crcIngredientes(const struct CabecalhoIngredientes *cab, const struct Ingrediente *itens,
+                                const struct ItemReceita *linhas) {
+    unsigned crc = crc32Atualizar(0, cab, offsetof(struct CabecalhoIngredientes, crc));
+    crc = crc32Atualizar(crc, itens, cab->qtd * sizeof(struct Ingrediente));
+    return crc32Atualizar(crc, linhas, cab->qtd_linhas * sizeof(struct ItemReceita));
+}
 
-    printf("%sLucro produtor [atual %.2f, Enter mantem]: %s", CYAN, p->lucro_produtor_percent, RESET);
-    lerLinha(buf, sizeof(buf));
-    if (buf[0] != '\0') p->lucro_produtor_percent = atof(buf);
+int salvarIngredientesAtomic() {
+    const struct TabelaIngredientes *t = &ingredientes;
+    struct CabecalhoIngredientes cab;
+    memset(&cab, 0, sizeof(cab));
+    memcpy(cab.magic, INGREDIENTES_MAGIC, sizeof(cab.magic));
+    cab.ordem = FORMATO_ORDEM;
+    cab.esquema = INGREDIENTES_ESQUEMA;
+    cab.tamanho_item = sizeof(struct Ingrediente);
+    cab.tamanho_linha = sizeof(struct ItemReceita);
+    cab.qtd = (unsigned)t->qtd;
+    cab.qtd_linhas = (unsigned)t->qtd_linhas;
+    cab.crc = crcIngredientes(&cab, t->itens, t->linhas);
+
+    FILE *f = fopen(ARQ_INGREDIENTES_TMP, "wb");
+    if (!f) return 0;
+    if (fwrite(&cab, sizeof(cab), 1, f) != 1 ||
+        fwrite(t->itens, sizeof(struct Ingrediente), (size_t)t->qtd, f) != (size_t)t->qtd ||
+        fwrite(t->linhas, sizeof(struct ItemReceita), (size_t)t->qtd_linhas, f) != (size_t)t->qtd_linhas) {
+        fclose(f);
+        remove(ARQ_INGREDIENTES_TMP);
+        return 0;
+    }
+    /* disco cheio ou erro de E/S: o arquivo bom fica onde está */
+    int gravado = fflush(f) == 0 && fsync(fileno(f)) == 0;
+    if (fclose(f) != 0 || !gravado) {
+        remove(ARQ_INGREDIENTES_TMP);
+        return 0;
+    }
+    if (!trocarPorTemporario(ARQ_INGREDIENTES_TMP, ARQ_INGREDIENTES, ARQ_INGREDIENTES_BAK)) return 0;
+    compartilhado.alterou |= ALTEROU_INGREDIENTES;
+    return 1;
+}
 
-    /* validar e recalcular */
-    validarPercentuaisProduto(p);
-    calcularTudo(p);
-    if (!salvarProdutosAtomic(produtos, qtd))
-        imprimir_aviso("Falha ao salvar apos edicao.");
+/* carrega a tabela; sem arquivo ou com arquivo inválido ela fica vazia e o
+   retorno é 0. Linhas com id de ingrediente fora da tabela são descartadas */
+int carregarIngredientes() {
+    struct TabelaIngredientes *t = &ingredientes;
+    FILE *f = fopen(ARQ_INGREDIENTES, "rb");
+    if (!f) return 0;
+    struct CabecalhoIngredientes cab;
+    struct Ingrediente *itens = NULL;
+    struct ItemReceita *linhas = NULL;
+    unsigned *hash = NULL;
+    int ok = fread(&cab, sizeof(cab), 1, f) == 1 &&
+             memcmp(cab.magic, INGREDIENTES_MAGIC, sizeof(cab.magic)) == 0 &&
+             cab.ordem == FORMATO_ORDEM && cab.esquema <= INGREDIENTES_ESQUEMA &&
+             cab.tamanho_item == sizeof(struct Ingrediente) &&
+             cab.tamanho_linha == sizeof(struct ItemReceita) &&
+             cab.qtd <= INT_MAX / 2 && cab.qtd_linhas <= INT_MAX / 2;
+    if (ok) {
+        itens = malloc(((size_t)cab.qtd + 1) * sizeof(*itens));
+        hash = malloc(((size_t)cab.qtd + 1) * sizeof(*hash));
+        linhas = malloc(((size_t)cab.qtd_linhas + 1) * sizeof(*linhas));
+        ok = itens && hash && linhas &&
+             fread(itens, sizeof(*itens), cab.qtd, f) == cab.qtd &&
+             fread(linhas, sizeof(*linhas), cab.qtd_linhas, f) == cab.qtd_linhas &&
+             crcIngredientes(&cab, itens, linhas) == cab.crc;
+    }
+    fclose(f);
+    if (!ok) {
+        free(itens);
+        free(hash);
+        free(linhas);
+        return 0;
+    }
 
-    imprimir_sucesso("Produto atualizado e recalculado!");
-    pausar();
+    char norm[MAX_NOME];
+    for (unsigned i = 0; i < cab.qtd; i++) {
+        itens[i].nome[MAX_NOME - 1] = '\0';
+        hash[i] = nomeHash(norm, nomeNormalizar(itens[i].nome, norm));
+    }
+    int n = 0;
+    for (unsigned i = 0; i < cab.qtd_linhas; i++) {
+        if (linhas[i].ingrediente < 0 || (unsigned)linhas[i].ingrediente >= cab.qtd) continue;
+        linhas[n] = linhas[i];
+        linhas[n].produto[MAX_NOME - 1] = '\0';
+        n++;
+    }
+
+    free(t->itens);
+    free(t->hash);
+    free(t->linhas);
+    free(t->inicio_uso);
+    free(t->usos);
+    memset(t, 0, sizeof(*t));
+    t->itens = itens;
+    t->hash = hash;
+    t->qtd = t->capacidade = (int)cab.qtd;
+    t->linhas = linhas;
+    t->qtd_linhas = n;
+    t->capacidade_linhas = (int)cab.qtd_linhas;
+    return 1;
 }
 
-/* ----- Excluir produto ----- */
-void excluirProdutoIndex(struct Produto produtos[], int *qtd, int idx) {
-    if (idx < 0 || idx >= *qtd) {
-        imprimir_erro("Indice invalido para exclusao.");
-        return;
+/* regravação completa pela esteira: com os preços já atualizados,
+   catalogoObter só lê o catálogo e as faixas podem ser montadas em paralelo */
+struct Regravacao {
+    struct Catalogo *cat;
+    int proximo;
+    FILE *f;
+};
+
+static int regravacaoPreparar(struct TarefaLote *t, void *ctx) {
+    struct Regravacao *r = ctx;
+    if (r->proximo >= r->cat->qtd) return 0;
+    t->primeiro = r->proximo;
+    t->qtd = r->cat->qtd - r->proximo < ESTEIRA_LOTE ? r->cat->qtd - r->proximo : ESTEIRA_LOTE;
+    r->proximo += t->qtd;
+    return 1;
+}
+
+static void regravacaoProcessar(struct TarefaLote *t, void *ctx) {
+    struct Regravacao *r = ctx;
+    for (int j = 0; j < t->qtd; j++) {
+        catalogoObter(r->cat, t->primeiro + j, &t->reg[j].produto);
+        selarRegistro(&t->reg[j]);
     }
-    for (int i = idx; i < (*qtd) - 1; i++)
-        produtos[i] = produtos[i + 1];
-    (*qtd)--;
 }
 
-void excluirProduto(struct Produto produtos[], int *qtd) {
-    if (*qtd == 0) {
-        imprimir_aviso("Nenhum produto para excluir.");
-        pausar();
-        return;
+static int regravacaoConsumir(struct TarefaLote *t, void *ctx) {
+    struct Regravacao *r = ctx;
+    return fwrite(t->reg, sizeof(struct RegistroProduto), (size_t)t->qtd, r->f) == (size_t)t->qtd;
+}
+
+int salvarProdutosAtomic(struct Catalogo *cat) {
+    /* regravação completa: lápides saem aqui; nenhum preço desatualizado
+       vai para o disco */
+    catalogoCompactar(cat);
+    catalogoAtualizarPrecos(cat);
+
+    FILE *f = fopen(ARQ_PRODUTOS_TMP, "wb");
+    if (!f) return 0;
+    struct CabecalhoProdutos cab;
+    cabecalhoPreencher(&cab, (unsigned long long)cat->qtd);
+    if (fwrite(&cab, sizeof(cab), 1, f) != 1) {
+        fclose(f);
+        remove(ARQ_PRODUTOS_TMP);
+        return 0;
+    }
+    /* os registros (produto + selo + crc) são montados em paralelo pela
+       esteira, uma faixa do catálogo por tarefa, e gravados em ordem com um
+       fwrite por tarefa */
+    static struct Esteira esteira;
+    struct Regravacao r = { cat, 0, f };
+    esteira.preparar = regravacaoPreparar;
+    esteira.processar = regravacaoProcessar;
+    esteira.consumir = regravacaoConsumir;
+    esteira.ctx = &r;
+    if (!esteiraExecutar(&esteira)) {
+        fclose(f);
+        remove(ARQ_PRODUTOS_TMP);
+        return 0;
+    }
+    /* o log será descartado depois do rename: o base precisa estar no
+       disco, senão o antigo e o log continuam valendo */
+    int gravado = fflush(f) == 0 && fsync(fileno(f)) == 0;
+    if (fclose(f) != 0 || !gravado) {
+        remove(ARQ_PRODUTOS_TMP);
+        return 0;
     }
 
-    listarProdutos(produtos, *qtd);
+    if (!trocarPorTemporario(ARQ_PRODUTOS_TMP, ARQ_PRODUTOS, ARQ_PRODUTOS_BAK)) return 0;
 
-    char buf[BUF_SIZE];
-    printf("\n%s%sNumero do produto para EXCLUIR: %s", BOLD, RED, RESET);
-    lerLinha(buf, sizeof(buf));
-    int idx = atoi(buf) - 1;
+    cat->versao_salva = config_versao;
+    compartilhado.alterou |= ALTEROU_BASE;
 
-    if (idx < 0 || idx >= *qtd) {
-        imprimir_erro("Numero invalido!");
-        pausar();
-        return;
+    /* tudo que estava no log agora está no base: recomeça um log vazio,
+       amarrado ao arquivo novo */
+    if (sincronizarDiretorio() && baseAbrir())
+        diarioAbrir(NULL, diario.base_ino);
+    return 1;
+}
+
+/* mapeia produtos.dat só para leitura; sem mmap, lê o arquivo para o heap */
+static int mapearBase(struct Catalogo *cat, int fd, size_t tamanho) {
+    if (tamanho == 0) return 1;
+    void *m = mmap(NULL, tamanho, PROT_READ, MAP_SHARED, fd, 0);
+    if (m != MAP_FAILED) {
+        madvise(m, tamanho, MADV_SEQUENTIAL);
+        cat->mapa = m;
+        cat->mapa_tamanho = tamanho;
+        return 1;
+    }
+    char *buf = malloc(tamanho);
+    if (!buf) return 0;
+    if (pread(fd, buf, tamanho, 0) != (ssize_t)tamanho) {
+        free(buf);
+        return 0;
     }
+    cat->mapa = buf;
+    cat->mapa_tamanho = tamanho;
+    cat->mapa_no_heap = 1;
+    return 1;
+}
 
-    printf("%s%sTem certeza? (s/n): %s", BOLD, RED, RESET);
-    lerLinha(buf, sizeof(buf));
-    if (buf[0] != 's' && buf[0] != 'S') {
-        printf("Operacao cancelada.\n");
-        pausar();
+/* converte o registro i de um layout antigo (ou com outra disposição de
+   campos) para struct Produto */
+static void registroConverter(const char *dados, int formato, const struct CabecalhoProdutos *cab,
+                              long long i, struct Produto *p) {
+    memset(p, 0, sizeof(*p));
+    if (formato == FORMATO_FLOAT) {
+        /* projetosipri: custo + despesas por unidade, lucro e imposto em % */
+        struct ProdutoFloat f;
+        memcpy(&f, dados + i * (long long)sizeof(f), sizeof(f));
+        memcpy(p->nome, f.nome, sizeof(f.nome));
+        p->nome[sizeof(f.nome) - 1] = '\0';
+        p->modo = 2;
+        p->rendimento = 1;
+        p->preco_custo = f.custo;
+        p->investimento_total = f.custo;
+        p->despesas_variaveis = f.despesas;
+        p->imposto_percent = f.imposto;
+        p->lucro_produtor_percent = f.lucro_desejado;
+        p->preco_produtor = f.preco_ideal;
         return;
     }
+    if (formato == FORMATO_CAMPOS) {
+        const char *r = dados + cab->tam_cabecalho + i * (long long)cab->tam_registro;
+#define X(campo) memcpy(&p->campo, r + cab->offset_campo[CAMPO_##campo], sizeof(p->campo));
+        CAMPOS_PRODUTO(X)
+#undef X
+    } else {
+        /* cru e selado começam pelo struct Produto */
+        size_t tam = formato == FORMATO_CRU ? sizeof(struct Produto) : TAM_SELADO;
+        memcpy(p, dados + i * (long long)tam, sizeof(*p));
+    }
+    p->nome[sizeof(p->nome) - 1] = '\0';
+    p->ingredientes_desc[sizeof(p->ingredientes_desc) - 1] = '\0';
+}
+
+/* selo/crc de um registro lido pelos deslocamentos do cabeçalho */
+static int registroValidoEm(const char *r, unsigned offset_selo, unsigned offset_crc) {
+    unsigned selo, crc;
+    memcpy(&selo, r + offset_selo, sizeof(selo));
+    memcpy(&crc, r + offset_crc, sizeof(crc));
+    return selo == REGISTRO_SELO && crc == crc32Atualizar(0, r, offset_crc);
+}
+
+/* guarda os bytes de um registro com checksum inválido que o log não
+   reescreveu: o índice (int64) e o registro cru, como estava no base. Só
+   acrescenta; o slot vira lápide, e a regravação não pode apagar a única
+   cópia do que havia ali */
+static int quarentenaGuardar(const char *r, unsigned tam, long long idx) {
+    FILE *f = fopen(ARQ_PRODUTOS_QUARENTENA, "ab");
+    if (!f) return 0;
+    int ok = fwrite(&idx, sizeof(idx), 1, f) == 1 && fwrite(r, tam, 1, f) == 1 &&
+             fflush(f) == 0 && fsync(fileno(f)) == 0;
+    return fclose(f) == 0 && ok;
+}
+
+int carregarProdutos(struct Catalogo *cat) {
+    /* a versão dos preços em disco não muda por recarregar o arquivo */
+    unsigned versao_salva = cat->versao_salva;
+    catalogoLiberar(cat);
+    cat->versao_salva = versao_salva;
+    int fd = open(ARQ_PRODUTOS, O_RDONLY);
+    if (fd < 0) {
+        /* ainda sem arquivo base: o que existir está no log; cria o base */
+        diario.base_ino = 0;
+        if (!diarioAbrir(cat, 0)) return 0;
+        return gravacaoPermitida() ? salvarProdutosAtomic(cat) : 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !mapearBase(cat, fd, (size_t)st.st_size)) {
+        close(fd);
+        return 0;
+    }
+    close(fd);
+
+    struct CabecalhoProdutos cab;
+    int formato = formatoBase(cat->mapa, cat->mapa_tamanho, &cab);
+    if (formato == FORMATO_DESCONHECIDO) return 0;
+
+    /* a quantidade vem do cabeçalho: aloca uma vez só. Registros que o
+       cabeçalho promete mas o arquivo não tem contam como corrompidos */
+    long long total = (long long)cab.qtd;
+    long long cabem = cat->mapa_tamanho > cab.tam_cabecalho
+                    ? (long long)(cat->mapa_tamanho - cab.tam_cabecalho) / (long long)cab.tam_registro : 0;
+    if (total > cabem) {
+        cat->registros_corrompidos += (int)(total - cabem);
+        total = cabem;
+    }
+    if (total > 0x7fffffffLL) total = 0x7fffffffLL;
+    if (!catalogoReservar(cat, (int)total)) return 0;
+
+    int rasgados = 0;
+    if (formato == FORMATO_ATUAL) {
+        /* só as colunas numéricas são copiadas; textos ficam no mapa */
+        const struct RegistroProduto *r = (const struct RegistroProduto *)(cat->mapa + cab.tam_cabecalho);
+        for (long long i = 0; i < total; i++) {
+            int idx = catalogoAdicionarMapeado(cat, &r[i].produto);
+            if (idx < 0) return 0;
+            if (r[i].selo == REGISTRO_LAPIDE && registroValido(&r[i])) {
+                cat->nome[idx] = cat->ingredientes_desc[idx] = NULL;
+                cat->excluido[idx] = 1;
+                continue;
+            }
+            /* checksum errado: escrita interrompida; o log deve reescrevê-lo */
+            if (!registroValido(&r[i])) {
+                cat->versao_preco[idx] = VERSAO_CORROMPIDA;
+                rasgados++;
+            }
+        }
+    } else {
+        /* layout antigo: converte registro a registro (textos para a arena) */
+        static struct Produto p;
+        for (long long i = 0; i < total; i++) {
+            registroConverter(cat->mapa, formato, &cab, i, &p);
+            int idx = catalogoAdicionar(cat, &p);
+            if (idx < 0) return 0;
+            cat->versao_preco[idx] = 0;
+            if (formato != FORMATO_CAMPOS && formato != FORMATO_SELADO) continue;
+            const char *r = cat->mapa + cab.tam_cabecalho + i * (long long)cab.tam_registro;
+            if (!registroValidoEm(r, cab.offset_selo, cab.offset_crc)) {
+                cat->versao_preco[idx] = VERSAO_CORROMPIDA;
+                rasgados++;
+            }
+        }
+    }
+    if (!cat->mapa_no_heap && cat->mapa) madvise((void *)cat->mapa, cat->mapa_tamanho, MADV_NORMAL);
+
+    /* reaplica as alterações que ainda estão só no log */
+    if (!diarioAbrir(cat, (unsigned long long)st.st_ino)) return 0;
+
+    /* registros rasgados que o log não reescreveu: corrupção de verdade. Os
+       bytes vão para a quarentena e o slot vira lápide (uma lápide rasgada
+       também: o produto excluído não volta) */
+    int quarentena_ok = 1;
+    for (int i = 0; i < cat->qtd; i++) {
+        if (cat->versao_preco[i] != VERSAO_CORROMPIDA) continue;
+        cat->registros_corrompidos++;
+        cat->versao_preco[i] = 0;
+        if (gravacaoPermitida())
+            quarentena_ok &= quarentenaGuardar(cat->mapa + cab.tam_cabecalho + i * (long long)cab.tam_registro,
+                                               cab.tam_registro, i);
+        catalogoRemover(cat, i);
+    }
+    catalogoReconstruirLivres(cat);
+    catalogoIndexarNomes(cat);
+
+    /* layout antigo é convertido uma vez para o formato atual; registros
+       rasgados (os consertados pelo log e os que viraram lápide) são
+       regravados limpos, mas só com os bytes perdidos já na quarentena */
+    if ((formato != FORMATO_ATUAL || rasgados > 0) && quarentena_ok && gravacaoPermitida())
+        return salvarProdutosAtomic(cat);
+    /* sem a trava, o base pode ter sido trocado depois de mapeado */
+    return baseAbrir() && diario.base_ino == (unsigned long long)st.st_ino;
+}
+
+/* ----- Diário (write-ahead log) ----- */
+/* CRC-32 (polinômio 0xEDB88320) com "slice-by-8": 8 bytes por passo,
+   para a verificação dos registros na carga não pesar na abertura */
+static unsigned crc32_tabela[8][256];
+static pthread_once_t crc32_pronta = PTHREAD_ONCE_INIT;
+
+/* uma vez só: a primeira chamada pode vir de vários trabalhadores da
+   esteira ao mesmo tempo */
+static void crc32Montar(void) {
+    unsigned (*tabela)[256] = crc32_tabela;
+    for (unsigned i = 0; i < 256; i++) {
+        unsigned c = i;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        tabela[0][i] = c;
+    }
+    for (unsigned i = 0; i < 256; i++)
+        for (int t = 1; t < 8; t++)
+            tabela[t][i] = (tabela[t - 1][i] >> 8) ^ tabela[0][tabela[t - 1][i] & 0xff];
+}
+
+unsigned crc32Atualizar(unsigned crc, const void *dados, size_t n) {
+    pthread_once(&crc32_pronta, crc32Montar);
+    const unsigned (*tabela)[256] = (const unsigned (*)[256])crc32_tabela;
+    const unsigned char *p = dados;
+    crc = ~crc;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (n >= 8) {
+        unsigned lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = tabela[7][lo & 0xff] ^ tabela[6][(lo >> 8) & 0xff] ^
+              tabela[5][(lo >> 16) & 0xff] ^ tabela[4][lo >> 24] ^
+              tabela[3][hi & 0xff] ^ tabela[2][(hi >> 8) & 0xff] ^
+              tabela[1][(hi >> 16) & 0xff] ^ tabela[0][hi >> 24];
+        p += 8;
+        n -= 8;
+    }
+#endif
+    while (n--) crc = tabela[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static unsigned crcEntrada(const struct EntradaDiario *e, const struct Produto *p) {
+    unsigned crc = crc32Atualizar(0, e, offsetof(struct EntradaDiario, crc));
+    return e->tamanho ? crc32Atualizar(crc, p, e->tamanho) : crc;
+}
+
+/* garante que renames feitos no diretório corrente estão no disco */
+int sincronizarDiretorio() {
+    int fd = open(".", O_RDONLY);
+    if (fd < 0) return 0;
+    int ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+/* escreve tudo ou falha (write pode gravar só parte) */
+static int escreverTudo(int fd, const void *dados, size_t n) {
+    const char *p = dados;
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return 1;
+}
+
+static int lerTudo(int fd, void *dados, size_t n) {
+    char *p = dados;
+    while (n > 0) {
+        ssize_t r = read(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return 0;
+        p += r;
+        n -= (size_t)r;
+    }
+    return 1;
+}
+
+/* crc de um registro de produtos.dat (produto + selo) */
+static unsigned crcRegistro(const struct RegistroProduto *r) {
+    return crc32Atualizar(0, r, offsetof(struct RegistroProduto, crc));
+}
+
+void selarRegistro(struct RegistroProduto *r) {
+    r->selo = REGISTRO_SELO;
+    r->crc = crcRegistro(r);
+}
+
+int registroValido(const struct RegistroProduto *r) {
+    return (r->selo == REGISTRO_SELO || r->selo == REGISTRO_LAPIDE) && r->crc == crcRegistro(r);
+}
+
+/* cabeçalho de produtos.dat descrevendo a disposição deste binário */
+void cabecalhoPreencher(struct CabecalhoProdutos *cab, unsigned long long qtd) {
+    memset(cab, 0, sizeof(*cab));
+    memcpy(cab->magic, FORMATO_MAGIC, sizeof(cab->magic));
+    cab->ordem = FORMATO_ORDEM;
+    cab->esquema = FORMATO_ESQUEMA;
+    cab->tam_cabecalho = sizeof(*cab);
+    cab->tam_registro = sizeof(struct RegistroProduto);
+    cab->qtd = qtd;
+    cab->num_campos = NUM_CAMPOS;
+#define X(campo) \
+    cab->offset_campo[CAMPO_##campo] = offsetof(struct Produto, campo); \
+    cab->tamanho_campo[CAMPO_##campo] = sizeof(((struct Produto *)0)->campo);
+    CAMPOS_PRODUTO(X)
+#undef X
+    cab->offset_selo = offsetof(struct RegistroProduto, selo);
+    cab->offset_crc = offsetof(struct RegistroProduto, crc);
+    cab->crc = crc32Atualizar(0, cab, offsetof(struct CabecalhoProdutos, crc));
+}
+
+/* o cabeçalho lido descreve campos com os mesmos tamanhos dos nossos,
+   todos dentro do registro? */
+static int cabecalhoLegivel(const struct CabecalhoProdutos *cab) {
+    if (cab->ordem != FORMATO_ORDEM || cab->esquema == 0 || cab->esquema > FORMATO_ESQUEMA ||
+        cab->crc != crc32Atualizar(0, cab, offsetof(struct CabecalhoProdutos, crc)) ||
+        cab->num_campos != NUM_CAMPOS || cab->tam_cabecalho < sizeof(*cab) || cab->tam_registro == 0)
+        return 0;
+#define X(campo) \
+    if (cab->tamanho_campo[CAMPO_##campo] != sizeof(((struct Produto *)0)->campo) || \
+        cab->offset_campo[CAMPO_##campo] + cab->tamanho_campo[CAMPO_##campo] > cab->tam_registro) \
+        return 0;
+    CAMPOS_PRODUTO(X)
+#undef X
+    return cab->offset_selo + sizeof(unsigned) <= cab->tam_registro &&
+           cab->offset_crc + sizeof(unsigned) <= cab->tam_registro;
+}
+
+/* identifica o layout de produtos.dat e preenche *cab com a descrição dele
+   (para os layouts sem cabeçalho, uma descrição equivalente). O struct cru
+   de 680 bytes e o de floats de 76 só se confundem quando o tamanho é
+   múltiplo dos dois; aí decide o campo modo do primeiro registro */
+int formatoBase(const char *dados, size_t tamanho, struct CabecalhoProdutos *cab) {
+    if (tamanho >= sizeof(*cab) && memcmp(dados, FORMATO_MAGIC, 8) == 0) {
+        memcpy(cab, dados, sizeof(*cab));
+        if (!cabecalhoLegivel(cab)) return FORMATO_DESCONHECIDO;
+        struct CabecalhoProdutos nosso;
+        cabecalhoPreencher(&nosso, cab->qtd);
+        int igual = cab->tam_cabecalho == nosso.tam_cabecalho && cab->tam_registro == nosso.tam_registro &&
+                    memcmp(cab->offset_campo, nosso.offset_campo, sizeof(nosso.offset_campo)) == 0 &&
+                    cab->offset_selo == nosso.offset_selo && cab->offset_crc == nosso.offset_crc;
+        return igual ? FORMATO_ATUAL : FORMATO_CAMPOS;
+    }
+
+    int formato = FORMATO_DESCONHECIDO;
+    size_t tam = 1;
+    if (tamanho == 0 || (tamanho % TAM_SELADO == 0 &&
+                         registroValidoEm(dados, sizeof(struct Produto), sizeof(struct Produto) + sizeof(unsigned)))) {
+        formato = FORMATO_SELADO;
+        tam = TAM_SELADO;
+    } else if (tamanho % sizeof(struct Produto) == 0) {
+        int modo;
+        memcpy(&modo, dados + offsetof(struct Produto, modo), sizeof(modo));
+        if (tamanho % sizeof(struct ProdutoFloat) != 0 || modo == 1 || modo == 2) {
+            formato = FORMATO_CRU;
+            tam = sizeof(struct Produto);
+        }
+    }
+    if (formato == FORMATO_DESCONHECIDO && tamanho % sizeof(struct ProdutoFloat) == 0) {
+        formato = FORMATO_FLOAT;
+        tam = sizeof(struct ProdutoFloat);
+    }
+    if (formato == FORMATO_DESCONHECIDO) return formato;
+
+    cabecalhoPreencher(cab, tamanho / tam);
+    cab->tam_cabecalho = 0;
+    cab->tam_registro = (unsigned)tam;
+    cab->offset_selo = sizeof(struct Produto);
+    cab->offset_crc = sizeof(struct Produto) + sizeof(unsigned);
+    return formato;
+}
+
+/* (re)abre produtos.dat para anexar registros */
+int baseAbrir() {
+    struct stat st;
+    if (diario.base_fd >= 0) close(diario.base_fd);
+    diario.desalinhado = 0;
+    diario.base_fd = open(ARQ_PRODUTOS, O_RDWR);
+    if (diario.base_fd < 0 || fstat(diario.base_fd, &st) != 0) {
+        if (diario.base_fd >= 0) close(diario.base_fd);
+        diario.base_fd = -1;
+        diario.desalinhado = 1;
+        return 0;
+    }
+    diario.base_ino = (unsigned long long)st.st_ino;
+    diario.base_tamanho = (long long)st.st_size;
+
+    /* a quantidade do cabeçalho acompanha as inserções feitas no lugar */
+    struct CabecalhoProdutos cab;
+    if (pread(diario.base_fd, &cab, sizeof(cab), 0) != (ssize_t)sizeof(cab) ||
+        memcmp(cab.magic, FORMATO_MAGIC, sizeof(cab.magic)) != 0) {
+        diario.desalinhado = 1;
+        return 0;
+    }
+    diario.base_qtd = cab.qtd;
+    return 1;
+}
+
+/* Importação em lote: os produtos novos vão direto para o fim do base, sem
+   passar pelo log (uma cópia de cada registro, não duas). Só vale com o base
+   alinhado, sem nada pendente e com a mesma quantidade de slots da memória */
+int baseAnexavel(const struct Catalogo *cat) {
+    return diario.base_fd >= 0 && !diario.desalinhado && diario.usado == 0 &&
+           diario.base_qtd == (unsigned long long)cat->qtd;
+}
+
+/* grava n registros já selados no lugar deles (a partir do slot idx), após
+   o fim do base, com um único pwrite. O cabeçalho ainda não os conta: se a
+   importação cair no meio, a carga ignora a cauda e o base continua como era */
+int baseAnexarRegistros(const struct RegistroProduto *r, int n, int idx) {
+    if (n == 0) return !diario.desalinhado;
+    off_t off = (off_t)sizeof(struct CabecalhoProdutos) + (off_t)idx * (off_t)sizeof(*r);
+    size_t tam = (size_t)n * sizeof(*r);
+    if (diario.desalinhado || pwrite(diario.base_fd, r, tam, off) != (ssize_t)tam) {
+        diario.desalinhado = 1;
+        return 0;
+    }
+    if ((long long)off + (long long)tam > diario.base_tamanho)
+        diario.base_tamanho = (long long)off + (long long)tam;
+    return 1;
+}
+
+/* registros anexados no disco primeiro, cabeçalho com a quantidade nova
+   depois: é a troca do cabeçalho que efetiva a importação inteira */
+int baseAnexarConfirmar(int qtd) {
+    if (diario.desalinhado || fdatasync(diario.base_fd) != 0) {
+        diario.desalinhado = 1;
+        return 0;
+    }
+    struct CabecalhoProdutos cab;
+    cabecalhoPreencher(&cab, (unsigned long long)qtd);
+    if (pwrite(diario.base_fd, &cab, sizeof(cab), 0) != (ssize_t)sizeof(cab) ||
+        fdatasync(diario.base_fd) != 0) {
+        diario.desalinhado = 1;
+        return 0;
+    }
+    diario.base_qtd = (unsigned long long)qtd;
+    compartilhado.alterou |= ALTEROU_BASE;
+    return 1;
+}
+
+/* aplica uma entrada do log ao catálogo; 0 se ela não faz sentido aqui.
+   Inserção num índice que já existe é o caso de o registro já ter sido
+   gravado no base (ou de reaproveitar uma lápide): vira sobrescrita, e
+   excluir uma lápide não muda nada (replay idempotente) */
+static int diarioAplicar(struct Catalogo *cat, const struct EntradaDiario *e, const struct Produto *p) {
+    switch (e->tipo) {
+        case LOG_INSERIR:
+            return catalogoInserirEm(cat, e->idx, p) >= 0;
+        case LOG_ATUALIZAR:
+            return catalogoValido(cat, e->idx) && catalogoGravar(cat, e->idx, p);
+        case LOG_EXCLUIR:
+            if (e->idx < 0 || e->idx >= cat->qtd) return 0;
+            catalogoRemover(cat, e->idx);
+            return 1;
+    }
+    return 0;
+}
+
+/* reaplica as entradas do log a partir de de (até ate; ate < 0: até a
+   primeira entrada inválida) e retorna onde termina a última válida */
+static long long diarioReaplicar(struct Catalogo *cat, long long de, long long ate) {
+    long long fim_valido = de;
+    struct EntradaDiario e;
+    static struct Produto p;
+    if (lseek(diario.fd, de, SEEK_SET) < 0) return de;
+    while ((ate < 0 || fim_valido + (long long)sizeof(e) <= ate) && lerTudo(diario.fd, &e, sizeof(e))) {
+        if (e.tamanho != 0 && e.tamanho != sizeof(struct Produto)) break;
+        if (ate >= 0 && fim_valido + (long long)sizeof(e) + e.tamanho > ate) break;
+        memset(&p, 0, sizeof(p));
+        if (e.tamanho && !lerTudo(diario.fd, &p, e.tamanho)) break;
+        if (crcEntrada(&e, &p) != e.crc) break;
+        if (!diarioAplicar(cat, &e, &p)) break;
+        fim_valido += (long long)sizeof(e) + e.tamanho;
+    }
+    return fim_valido;
+}
+
+/* abre o log do arquivo base indicado. Com cat != NULL, reaplica as entradas
+   válidas (recuperação); um log de outro base, ou cat == NULL, é trocado por
+   um vazio. Uma entrada rasgada por queda no meio da escrita encerra o
+   replay e é cortada do arquivo. Sem a trava nada é gravado: o replay vai
+   só até o tamanho publicado e um log que não casa fica fechado */
+int diarioAbrir(struct Catalogo *cat, unsigned long long base_ino) {
+    int grava = gravacaoPermitida();
+    if (diario.fd >= 0) close(diario.fd);
+    diario.usado = 0;
+    diario.tamanho = 0;
+    diario.fd = open(ARQ_PRODUTOS_WAL, grava ? O_RDWR | O_CREAT : O_RDWR, 0644);
+    if (diario.fd < 0) return cat == NULL || !grava;
+
+    struct CabecalhoDiario cab;
+    int casa = cat != NULL &&
+               lerTudo(diario.fd, &cab, sizeof(cab)) &&
+               memcmp(cab.magic, DIARIO_MAGIC, sizeof(cab.magic)) == 0 &&
+               cab.base_ino == base_ino;
+
+    if (casa) {
+        long long fim_valido = diarioReaplicar(cat, sizeof(cab), grava ? -1 : compartilhado.limite_log);
+        if (grava && (ftruncate(diario.fd, fim_valido) != 0 || lseek(diario.fd, 0, SEEK_END) < 0)) {
+            close(diario.fd);
+            diario.fd = -1;
+            return 0;
+        }
+        diario.tamanho = fim_valido;
+        return 1;
+    }
+    close(diario.fd);
+    diario.fd = -1;
+    if (!grava) return 1;
+
+    /* o log novo é outro arquivo (rename), não o antigo truncado: um leitor
+       que ainda o tenha aberto continua lendo as entradas do base dele */
+    memset(&cab, 0, sizeof(cab));
+    memcpy(cab.magic, DIARIO_MAGIC, sizeof(cab.magic));
+    cab.base_ino = base_ino;
+    int fd = open(ARQ_PRODUTOS_WAL_TMP, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return 0;
+    if (!escreverTudo(fd, &cab, sizeof(cab)) || fdatasync(fd) != 0 ||
+        rename(ARQ_PRODUTOS_WAL_TMP, ARQ_PRODUTOS_WAL) != 0) {
+        close(fd);
+        remove(ARQ_PRODUTOS_WAL_TMP);
+        return 0;
+    }
+    diario.fd = fd;
+    diario.tamanho = sizeof(cab);
+    compartilhado.alterou |= ALTEROU_BASE;
+    return 1;
+}
+
+/* enfileira a alteração do produto idx (para exclusão, o idx já removido);
+   só vai para o disco em diarioConfirmar */
+int diarioRegistrar(struct Catalogo *cat, int tipo, int idx) {
+    static struct Produto p;
+    struct EntradaDiario e;
+    e.tipo = (unsigned)tipo;
+    e.idx = idx;
+    e.tamanho = tipo == LOG_EXCLUIR ? 0 : sizeof(struct Produto);
+    if (e.tamanho) catalogoObter(cat, idx, &p);
+    e.crc = crcEntrada(&e, &p);
+
+    size_t n = sizeof(e) + e.tamanho;
+    if (diario.usado + n > diario.capacidade) {
+        size_t nova = diario.capacidade ? diario.capacidade * 2 : 64 * 1024;
+        while (nova < diario.usado + n) nova *= 2;
+        char *novo = realloc(diario.buf, nova);
+        if (!novo) return 0;
+        diario.buf = novo;
+        diario.capacidade = nova;
+    }
+    memcpy(diario.buf + diario.usado, &e, sizeof(e));
+    if (e.tamanho) memcpy(diario.buf + diario.usado + sizeof(e), &p, e.tamanho);
+    diario.usado += n;
+    return 1;
+}
+
+/* grava as entradas pendentes no fim do log com um write e um fdatasync
+   (group commit). O base não é tocado: leitores de outros processos podem
+   estar com ele mapeado. Chamado sob a trava (catalogoTravar) */
+int diarioConfirmar(struct Catalogo *cat) {
+    if (diario.fd < 0) {
+        /* sem log disponível: volta ao salvamento completo */
+        diario.usado = 0;
+        return salvarProdutosAtomic(cat);
+    }
+    if (diario.usado > 0) {
+        if (lseek(diario.fd, diario.tamanho, SEEK_SET) < 0 ||
+            !escreverTudo(diario.fd, diario.buf, diario.usado) || fdatasync(diario.fd) != 0) {
+            /* não dá para saber o que chegou ao disco: o log passa a ser suspeito,
+               então consolida tudo no base (que também zera o log) */
+            diario.usado = 0;
+            return salvarProdutosAtomic(cat);
+        }
+        diario.tamanho += (long long)diario.usado;
+        diario.usado = 0;
+        compartilhado.alterou |= ALTEROU_LOG;
+    }
+    /* lápides demais: uma regravação completa compacta o arquivo */
+    if (cat->qtd_livres >= FRAGMENTACAO_MIN_LAPIDES &&
+        (long long)cat->qtd_livres * 100 >= (long long)cat->qtd * FRAGMENTACAO_MAX_PERCENT)
+        return salvarProdutosAtomic(cat);
+    /* o replay na carga cresce com o log: consolida quando ele passa de
+       metade do base (custo amortizado pelas entradas acumuladas) */
+    if (diario.tamanho < DIARIO_LIMITE_MIN || diario.tamanho * 2 < diario.base_tamanho) return 1;
+    return salvarProdutosAtomic(cat);
+}
+
+/* ----- Acesso concorrente (produtos.lck) ----- */
+static unsigned crcEstado(const struct EstadoCompartilhado *e) {
+    return crc32Atualizar(0, e, offsetof(struct EstadoCompartilhado, crc));
+}
+
+/* lê o estado publicado; arquivo vazio (ninguém publicou ainda) é o estado
+   zero. Uma leitura que pegou o pwrite do gravador pela metade não fecha o
+   crc e é repetida */
+static int estadoLer(struct EstadoCompartilhado *e) {
+    memset(e, 0, sizeof(*e));
+    if (!compartilhamentoAbrir()) return 1;
+    for (int t = 0; t < SINCRONIZAR_TENTATIVAS; t++) {
+        ssize_t n = pread(compartilhado.fd, e, sizeof(*e), 0);
+        if (n == 0) {
+            memset(e, 0, sizeof(*e));
+            return 1;
+        }
+        if (n == (ssize_t)sizeof(*e) && crcEstado(e) == e->crc) return 1;
+        sched_yield();
+    }
+    return 0;
+}
+
+static int travaGravacao(int tipo) {
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = (short)tipo;
+    fl.l_whence = SEEK_SET;
+    fl.l_len = 1;
+    while (fcntl(compartilhado.fd, F_SETLKW, &fl) != 0)
+        if (errno != EINTR) return 0;
+    return 1;
+}
+
+/* aplica as entradas que outros processos confirmaram depois da última
+   leitura: até ate, ou, sob a trava (ate < 0), até o fim válido, cortando o
+   que um gravador derrubado no meio deixou pela metade */
+static int diarioAcompanhar(struct Catalogo *cat, long long ate) {
+    long long inicio = diario.tamanho;
+    long long fim = diarioReaplicar(cat, inicio, ate);
+    if (ate < 0 && ftruncate(diario.fd, fim) != 0) return 0;
+    diario.tamanho = fim;
+    /* a pilha volta à ordem de sempre: menor índice no topo */
+    if (fim > inicio) catalogoReconstruirLivres(cat);
+    return ate < 0 || fim == ate;
+}
+
+/* recarrega o catálogo inteiro no estado publicado *e. Sem a trava, um
+   gravador pode consolidar no meio da carga: o inode do base e o tamanho do
+   log lidos precisam bater com o estado, senão relê o estado e tenta de
+   novo; esgotadas as tentativas, carrega sob a trava */
+static int catalogoRecarregar(struct Catalogo *cat, struct EstadoCompartilhado *e) {
+    if (gravacaoPermitida()) return carregarProdutos(cat);
+    for (int t = 0; t < SINCRONIZAR_TENTATIVAS; t++) {
+        compartilhado.limite_log = e->log_tamanho;
+        int ok = carregarProdutos(cat) && diario.base_ino == e->base_ino && diario.tamanho == e->log_tamanho;
+        compartilhado.limite_log = -1;
+        if (ok) return 1;
+        sched_yield();
+        if (!estadoLer(e)) return 0;
+    }
+    if (!catalogoTravar(cat)) return 0;
+    catalogoDestravar();
+    *e = compartilhado.visto;
+    return 1;
+}
+
+/* traz config, ingredientes e (com cat) o catálogo para o último estado
+   publicado; sem novidade custa um pread. Não trava: é o que as telas de
+   consulta chamam antes de mostrar qualquer coisa. 0 se a carga falhou */
+int catalogoSincronizar(struct Catalogo *cat) {
+    struct EstadoCompartilhado e;
+    struct EstadoCompartilhado *visto = &compartilhado.visto;
+    if (!estadoLer(&e)) return 0;
+    if (e.geracao == visto->geracao) {
+        /* a geração só é anotada com o catálogo junto: ele já está em dia */
+        if (cat && compartilhado.travado) compartilhado.produtos_em_dia = 1;
+        return 1;
+    }
+    /* uma versão só conta como vista depois de carregada: se a carga falhar,
+       a próxima chamada tenta de novo */
+    int pendente = 0;
+    if (e.versao_config != visto->versao_config) {
+        if (carregarConfig()) {
+            /* a regravação com os preços novos fica com quem mudou a config */
+            if (cat) cat->versao_salva = config_versao;
+            visto->versao_config = e.versao_config;
+        } else {
+            pendente = 1;
+        }
+    }
+    if (e.versao_ingredientes != visto->versao_ingredientes) {
+        if (carregarIngredientes()) visto->versao_ingredientes = e.versao_ingredientes;
+        else pendente = 1;
+    }
+    if (!cat) return 1;
+
+    /* mesmo base: basta a cauda do log; base trocado: recarrega */
+    int ok = e.versao_base == visto->versao_base && diario.fd >= 0 && e.log_tamanho >= diario.tamanho &&
+             diarioAcompanhar(cat, compartilhado.travado ? -1 : e.log_tamanho);
+    if (!ok && !catalogoRecarregar(cat, &e)) return 0;
+    struct EstadoCompartilhado anterior = *visto;
+    *visto = e;
+    if (pendente) {
+        /* o catálogo está em dia, mas a geração fica por anotar */
+        visto->geracao = anterior.geracao;
+        visto->versao_config = anterior.versao_config;
+        visto->versao_ingredientes = anterior.versao_ingredientes;
+    }
+    if (compartilhado.travado) compartilhado.produtos_em_dia = 1;
+    return 1;
+}
+
+/* pega a trava de gravação (espera só quem estiver confirmando) e alcança o
+   estado mais recente; 0 se não conseguiu, já sem a trava. Toda gravação de
+   produtos.dat, do log, de config.dat e de ingredientes.dat fica entre
+   catalogoTravar e catalogoDestravar; cat == NULL não traz o catálogo */
+int catalogoTravar(struct Catalogo *cat) {
+    if (compartilhado.travado++ == 0) {
+        compartilhado.alterou = 0;
+        compartilhado.produtos_em_dia = 0;
+        if (compartilhamentoAbrir() && !travaGravacao(F_WRLCK)) {
+            compartilhado.travado = 0;
+            return 0;
+        }
+    }
+    if (catalogoSincronizar(cat)) return 1;
+    catalogoDestravar();
+    return 0;
+}
+
+/* publica o que foi gravado desde catalogoTravar (uma geração nova) e solta
+   a trava. Um log maior que o publicado (gravador que caiu antes de
+   publicar) também é publicado por quem o reaplicou */
+void catalogoDestravar(void) {
+    if (compartilhado.travado == 0 || --compartilhado.travado > 0) return;
+    struct EstadoCompartilhado e;
+    int em_dia = compartilhado.produtos_em_dia;
+    if (compartilhado.fd >= 0 && estadoLer(&e)) {
+        if (em_dia && (e.base_ino != diario.base_ino || e.log_tamanho != diario.tamanho))
+            compartilhado.alterou |= ALTEROU_LOG;
+        if (compartilhado.alterou) {
+            e.geracao++;
+            if (compartilhado.alterou & ALTEROU_BASE) e.versao_base++;
+            if (compartilhado.alterou & ALTEROU_CONFIG) e.versao_config++;
+            if (compartilhado.alterou & ALTEROU_INGREDIENTES) e.versao_ingredientes++;
+            if (em_dia) {
+                e.base_ino = diario.base_ino;
+                e.log_tamanho = diario.tamanho;
+            }
+            e.crc = crcEstado(&e);
+            /* a memória deste processo é exatamente o estado publicado */
+            if (pwrite(compartilhado.fd, &e, sizeof(e), 0) == (ssize_t)sizeof(e)) {
+                compartilhado.visto.versao_config = e.versao_config;
+                compartilhado.visto.versao_ingredientes = e.versao_ingredientes;
+                if (em_dia) compartilhado.visto = e;
+            }
+        }
+    }
+    compartilhado.alterou = 0;
+    compartilhado.produtos_em_dia = 0;
+    if (compartilhado.fd >= 0) travaGravacao(F_UNLCK);
+}
+
+/* ----- Esteira de lote (threads) ----- */
+static void anelColocar(struct AnelTarefas *a, struct TarefaLote *t) {
+    size_t cauda = atomic_load_explicit(&a->cauda, memory_order_relaxed);
+    /* cada trabalhador tem só ESTEIRA_PROFUNDIDADE tarefas: nunca enche */
+    while (cauda - atomic_load_explicit(&a->cabeca, memory_order_acquire) == ESTEIRA_PROFUNDIDADE)
+        sched_yield();
+    a->itens[cauda % ESTEIRA_PROFUNDIDADE] = t;
+    atomic_store_explicit(&a->cauda, cauda + 1, memory_order_release);
+}
+
+static struct TarefaLote *anelTirar(struct AnelTarefas *a) {
+    size_t cabeca = atomic_load_explicit(&a->cabeca, memory_order_relaxed);
+    int voltas = 0;
+    while (atomic_load_explicit(&a->cauda, memory_order_acquire) == cabeca) {
+        /* espera curta girando; depois cede o processador */
+        if (++voltas < 64) {
+#ifdef SIPRI_X86
+            _mm_pause();
+#endif
+        } else {
+            sched_yield();
+        }
+    }
+    struct TarefaLote *t = a->itens[cabeca % ESTEIRA_PROFUNDIDADE];
+    atomic_store_explicit(&a->cabeca, cabeca + 1, memory_order_release);
+    return t;
+}
+
+static void *esteiraLeitor(void *arg) {
+    struct Esteira *e = arg;
+    long seq = 0;
+    for (;; seq++) {
+        struct TarefaLote *t = anelTirar(&e->livres[seq % e->n]);
+        t->seq = seq;
+        t->qtd = 0;
+        t->ajustes = 0;
+        int ultima = atomic_load(&e->parar) || !e->preparar(t, e->ctx);
+        t->ultima = ultima;
+        anelColocar(&e->entrada[seq % e->n], t);
+        if (ultima) break;
+    }
+    /* os outros trabalhadores também precisam da sentinela para terminar */
+    for (int k = 1; k < e->n; k++) {
+        struct TarefaLote *t = anelTirar(&e->livres[(seq + k) % e->n]);
+        t->ultima = 1;
+        anelColocar(&e->entrada[(seq + k) % e->n], t);
+    }
+    return NULL;
+}
+
+struct TrabalhadorEsteira {
+    struct Esteira *e;
+    int w;
+};
+
+static void *esteiraTrabalhador(void *arg) {
+    struct TrabalhadorEsteira *tr = arg;
+    struct Esteira *e = tr->e;
+    for (;;) {
+        struct TarefaLote *t = anelTirar(&e->entrada[tr->w]);
+        /* depois de colocada na saída a tarefa já pode ter voltado ao leitor */
+        int ultima = t->ultima;
+        if (!ultima) e->processar(t, e->ctx);
+        anelColocar(&e->saida[tr->w], t);
+        if (ultima) return NULL;
+    }
+}
+
+static void tarefaLiberar(struct TarefaLote *t) {
+    free(t->reg);
+    free(t->estado);
+    free(t->linha_reg);
+}
+
+static int tarefaAlocar(struct TarefaLote *t) {
+    memset(t, 0, sizeof(*t));
+    /* registros zerados: o preenchimento entre os campos vai limpo para o disco */
+    t->reg = aligned_alloc(FORMATO_ALINHAMENTO, ESTEIRA_LOTE * sizeof(struct RegistroProduto));
+    t->estado = malloc(ESTEIRA_LOTE);
+    t->linha_reg = malloc(ESTEIRA_LOTE * sizeof(long));
+    if (!t->reg || !t->estado || !t->linha_reg) {
+        tarefaLiberar(t);
+        return 0;
+    }
+    memset(t->reg, 0, ESTEIRA_LOTE * sizeof(struct RegistroProduto));
+    return 1;
+}
+
+static int esteiraTrabalhadores(void) {
+    int n = lote_trabalhadores;
+    if (n < 0) {
+        /* leitor e gravador também trabalham: um trabalhador a menos */
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n = cpus > 1 ? (int)cpus - 1 : 0;
+    }
+    return n > ESTEIRA_MAX_TRABALHADORES ? ESTEIRA_MAX_TRABALHADORES : n;
+}
+
+/* roda a esteira até o leitor esgotar a entrada; retorna 0 se faltou
+   memória ou se consumir falhou (o resto da entrada é descartado). Sem
+   threads (0 trabalhadores ou pthread_create falhando) os três estágios
+   rodam em sequência na thread que chamou, com o mesmo resultado */
+int esteiraExecutar(struct Esteira *e) {
+    static struct TarefaLote tarefas[ESTEIRA_MAX_TRABALHADORES * ESTEIRA_PROFUNDIDADE];
+    static struct TrabalhadorEsteira trabalhadores[ESTEIRA_MAX_TRABALHADORES];
+    pthread_t threads[ESTEIRA_MAX_TRABALHADORES], leitor;
+    int n = esteiraTrabalhadores();
+    int total = n > 0 ? n * ESTEIRA_PROFUNDIDADE : 1;
+    int ok = 1;
+
+    for (int i = 0; i < total; i++) {
+        if (tarefaAlocar(&tarefas[i])) continue;
+        while (i-- > 0) tarefaLiberar(&tarefas[i]);
+        return 0;
+    }
+    atomic_store(&e->parar, 0);
+    e->n = n;
+    for (int w = 0; w < n; w++) {
+        atomic_store(&e->livres[w].cabeca, 0);
+        atomic_store(&e->livres[w].cauda, 0);
+        atomic_store(&e->entrada[w].cabeca, 0);
+        atomic_store(&e->entrada[w].cauda, 0);
+        atomic_store(&e->saida[w].cabeca, 0);
+        atomic_store(&e->saida[w].cauda, 0);
+        for (int k = 0; k < ESTEIRA_PROFUNDIDADE; k++)
+            anelColocar(&e->livres[w], &tarefas[w * ESTEIRA_PROFUNDIDADE + k]);
+    }
+
+    /* sobem os trabalhadores; se algum não subir, a esteira fica com os que
+       subiram (o rodízio usa e->n, fixado antes do leitor começar) */
+    int criados = 0;
+    while (criados < n) {
+        trabalhadores[criados].e = e;
+        trabalhadores[criados].w = criados;
+        if (pthread_create(&threads[criados], NULL, esteiraTrabalhador, &trabalhadores[criados]) != 0) break;
+        criados++;
+    }
+    e->n = criados;
+    int com_leitor = criados > 0 && pthread_create(&leitor, NULL, esteiraLeitor, e) == 0;
+    if (criados > 0 && !com_leitor) {
+        /* sem leitor: encerra os trabalhadores e segue sem threads */
+        for (int w = 0; w < criados; w++) {
+            struct TarefaLote *t = anelTirar(&e->livres[w]);
+            t->ultima = 1;
+            anelColocar(&e->entrada[w], t);
+            pthread_join(threads[w], NULL);
+        }
+        criados = 0;
+    }
+
+    if (criados == 0) {
+        struct TarefaLote *t = &tarefas[0];
+        for (long seq = 0;; seq++) {
+            t->seq = seq;
+            t->qtd = 0;
+            t->ajustes = 0;
+            if (!e->preparar(t, e->ctx)) break;
+            e->processar(t, e->ctx);
+            if (!e->consumir(t, e->ctx)) {
+                ok = 0;
+                break;
+            }
+        }
+    } else {
+        for (long seq = 0;; seq++) {
+            struct AnelTarefas *saida = &e->saida[seq % criados];
+            struct TarefaLote *t = anelTirar(saida);
+            if (t->ultima) break;
+            /* depois de um erro, só esvazia a esteira */
+            if (ok && !e->consumir(t, e->ctx)) {
+                ok = 0;
+                atomic_store(&e->parar, 1);
+            }
+            anelColocar(&e->livres[seq % criados], t);
+        }
+        pthread_join(leitor, NULL);
+        for (int w = 0; w < criados; w++) pthread_join(threads[w], NULL);
+    }
+    for (int i = 0; i < total; i++) tarefaLiberar(&tarefas[i]);
+    return ok;
+}
+
+/* ----- Executor paralelo (roubo de trabalho) ----- */
+/* deque de pedaços de um trabalhador: o trecho [ini, fim) de índices de
+   pedaço num atômico só, (ini << 32) | fim, mexido por CAS. O valor é o
+   estado inteiro do deque, então um CAS que acerta um valor já visto antes
+   continua certo */
+struct DequePedacos {
+    _Alignas(64) atomic_ullong faixa;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t rodada_nova;     /* as threads esperam a próxima passada */
+    pthread_cond_t rodada_fim;      /* quem chamou espera as threads */
+    int threads;                    /* além de quem chama; -1: ainda não subiram */
+    unsigned rodada;
+    int ativos;                     /* threads que ainda não acabaram a passada */
+    atomic_int ocupado;
+    /* passada em andamento */
+    const struct Paralelo *p;
+    int trabalhadores;
+    int pedacos;
+    int juntados;
+    atomic_uchar *pronto;           /* por pedaço: juntar só depois de pronto */
+    struct DequePedacos deque[PARALELO_MAX_TRABALHADORES];
+} executor = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+               -1, 0, 0, 0, NULL, 0, 0, 0, NULL, { { 0 } } };
+
+static unsigned long long faixaPedacos(unsigned ini, unsigned fim) {
+    return (unsigned long long)ini << 32 | fim;
+}
+
+/* trabalhadores do executor, contando quem chama: -1 = um por processador,
+   0 = tudo na thread que chamou */
+static int paraleloTrabalhadores(void) {
+    int n = lote_trabalhadores;
+    if (n < 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n = cpus > 0 ? (int)cpus : 1;
+    }
+    if (n < 1) n = 1;
+    return n > PARALELO_MAX_TRABALHADORES ? PARALELO_MAX_TRABALHADORES : n;
+}
+
+/* pedaço da frente do deque, ou -1 se vazio */
+static int dequeTirar(struct DequePedacos *d) {
+    unsigned long long v = atomic_load(&d->faixa);
+    for (;;) {
+        unsigned ini = (unsigned)(v >> 32), fim = (unsigned)v;
+        if (ini >= fim) return -1;
+        if (atomic_compare_exchange_weak(&d->faixa, &v, faixaPedacos(ini + 1, fim))) return (int)ini;
+    }
+}
+
+/* passa para o deque (vazio) de w a metade de trás do primeiro deque com
+   trabalho, a partir do vizinho; 0 se todos estão vazios */
+static int dequeRoubar(int w) {
+    int n = executor.trabalhadores;
+    for (int k = 1; k < n; k++) {
+        struct DequePedacos *vitima = &executor.deque[(w + k) % n];
+        unsigned long long v = atomic_load(&vitima->faixa);
+        for (;;) {
+            unsigned ini = (unsigned)(v >> 32), fim = (unsigned)v;
+            if (ini >= fim) break;
+            unsigned meio = ini + (fim - ini) / 2;
+            if (atomic_compare_exchange_weak(&vitima->faixa, &v, faixaPedacos(ini, meio))) {
+                atomic_store(&executor.deque[w].faixa, faixaPedacos(meio, fim));
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* quem chamou junta, em ordem, os pedaços que já ficaram prontos */
+static void paraleloJuntarProntos(void) {
+    const struct Paralelo *p = executor.p;
+    if (!p->juntar) return;
+    while (executor.juntados < executor.pedacos &&
+           atomic_load_explicit(&executor.pronto[executor.juntados], memory_order_acquire))
+        p->juntar(executor.juntados++, p->ctx);
+}
+
+static void paraleloTrabalhar(int w) {
+    const struct Paralelo *p = executor.p;
+    for (;;) {
+        int k = dequeTirar(&executor.deque[w]);
+        if (k < 0) {
+            if (paralelo_deterministico || !dequeRoubar(w)) return;
+            continue;
+        }
+        int ini = k * p->grao;
+        p->corpo(ini, p->n - ini < p->grao ? p->n : ini + p->grao, w, p->ctx);
+        atomic_store_explicit(&executor.pronto[k], 1, memory_order_release);
+        if (w == 0) paraleloJuntarProntos();
+    }
+}
+
+static void *paraleloThread(void *arg) {
+    int w = (int)(intptr_t)arg;
+    unsigned vista = 0;
+    pthread_mutex_lock(&executor.mutex);
+    for (;;) {
+        while (executor.rodada == vista) pthread_cond_wait(&executor.rodada_nova, &executor.mutex);
+        vista = executor.rodada;
+        pthread_mutex_unlock(&executor.mutex);
+        paraleloTrabalhar(w);
+        pthread_mutex_lock(&executor.mutex);
+        if (--executor.ativos == 0) pthread_cond_signal(&executor.rodada_fim);
+    }
+    return NULL;
+}
+
+/* sobe as threads uma vez só, com os sinais bloqueados (ficam para a
+   thread principal, como no servidor); as que não subirem fazem falta só
+   no desempenho */
+static void paraleloIniciar(void) {
+    int n = paraleloTrabalhadores() - 1;
+    sigset_t todos, antes;
+    sigfillset(&todos);
+    pthread_sigmask(SIG_BLOCK, &todos, &antes);
+    for (executor.threads = 0; executor.threads < n; executor.threads++) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, paraleloThread, (void *)(intptr_t)(executor.threads + 1)) != 0) break;
+        pthread_detach(t);
+    }
+    pthread_sigmask(SIG_SETMASK, &antes, NULL);
+}
+
+static void paraleloRodada(const struct Paralelo *p, int pedacos, atomic_uchar *pronto) {
+    int n = executor.threads + 1;
+    executor.p = p;
+    executor.trabalhadores = n;
+    executor.pedacos = pedacos;
+    executor.juntados = 0;
+    executor.pronto = pronto;
+    for (int w = 0; w < n; w++)
+        atomic_store(&executor.deque[w].faixa,
+                     faixaPedacos((unsigned)((long long)pedacos * w / n), (unsigned)((long long)pedacos * (w + 1) / n)));
+    pthread_mutex_lock(&executor.mutex);
+    executor.ativos = executor.threads;
+    executor.rodada++;
+    pthread_cond_broadcast(&executor.rodada_nova);
+    pthread_mutex_unlock(&executor.mutex);
+
+    paraleloTrabalhar(0);
+
+    pthread_mutex_lock(&executor.mutex);
+    while (executor.ativos > 0) pthread_cond_wait(&executor.rodada_fim, &executor.mutex);
+    pthread_mutex_unlock(&executor.mutex);
+    paraleloJuntarProntos();
+}
+
+/* executa p->corpo em todos os pedaços de [0, p->n) e, se houver, p->juntar
+   em cada um, na ordem. Sem threads (ou com o executor ocupado) faz o mesmo
+   em sequência, com w = 0 */
+void paraleloExecutar(const struct Paralelo *p) {
+    int pedacos = p->n > 0 ? (p->n - 1) / p->grao + 1 : 0;
+    if (pedacos >= 2 && !atomic_exchange(&executor.ocupado, 1)) {
+        if (executor.threads < 0) paraleloIniciar();
+        atomic_uchar *pronto = executor.threads > 0 ? calloc((size_t)pedacos, sizeof(*pronto)) : NULL;
+        if (pronto) paraleloRodada(p, pedacos, pronto);
+        atomic_store(&executor.ocupado, 0);
+        if (pronto) {
+            free(pronto);
+            return;
+        }
+    }
+    for (int k = 0; k < pedacos; k++) {
+        int ini = k * p->grao;
+        p->corpo(ini, p->n - ini < p->grao ? p->n : ini + p->grao, 0, p->ctx);
+        if (p->juntar) p->juntar(k, p->ctx);
+    }
+}
+
+/* ----- Auxiliares I/O ----- */
+void lerLinha(char *buf, int n) {
+    if (fgets(buf, n, stdin) == NULL) { buf[0] = '\0'; return; }
+    buf[strcspn(buf, "\n")] = '\0';
+}
+
+/* ----- Tabela de ingredientes ----- */
+/* id do ingrediente com esse nome (comparação normalizada) ou -1 */
+int ingredienteBuscar(const char *nome) {
+    const struct TabelaIngredientes *t = &ingredientes;
+    char alvo[MAX_NOME], norm[MAX_NOME];
+    size_t n = nomeNormalizar(nome, alvo);
+    unsigned h = nomeHash(alvo, n);
+    for (int i = 0; i < t->qtd; i++) {
+        if (t->hash[i] != h) continue;
+        if (nomeNormalizar(t->itens[i].nome, norm) == n && memcmp(norm, alvo, n) == 0) return i;
+    }
+    return -1;
+}
+
+/* id do ingrediente que representa o produto como sub-receita, ou -1 */
+static int ingredienteDoProduto(const char *produto) {
+    const struct TabelaIngredientes *t = &ingredientes;
+    char norm[MAX_NOME];
+    unsigned h = nomeHash(norm, nomeNormalizar(produto, norm));
+    for (int i = 0; i < t->qtd; i++)
+        if (t->hash[i] == h && t->itens[i].tipo == INGR_PRODUTO && strcmp(t->itens[i].nome, produto) == 0)
+            return i;
+    return -1;
+}
+
+/* acrescenta um ingrediente novo; retorna o id ou -1 sem memória */
+int ingredienteAdicionar(const char *nome, int tipo, double preco) {
+    struct TabelaIngredientes *t = &ingredientes;
+    if (t->qtd == t->capacidade) {
+        int cap = t->capacidade ? t->capacidade * 2 : 32;
+        struct Ingrediente *itens = realloc(t->itens, (size_t)cap * sizeof(*itens));
+        if (!itens) return -1;
+        t->itens = itens;
+        unsigned *hash = realloc(t->hash, (size_t)cap * sizeof(*hash));
+        if (!hash) return -1;
+        t->hash = hash;
+        t->capacidade = cap;
+    }
+    struct Ingrediente *g = &t->itens[t->qtd];
+    memset(g, 0, sizeof(*g));
+    strncpy(g->nome, nome, sizeof(g->nome) - 1);
+    g->tipo = tipo == INGR_POR_UNIDADE || tipo == INGR_PRODUTO ? tipo : INGR_POR_KG;
+    g->preco = preco;
+    char norm[MAX_NOME];
+    t->hash[t->qtd] = nomeHash(norm, nomeNormalizar(g->nome, norm));
+    /* o índice reverso tem uma entrada por ingrediente */
+    t->usos_validos = 0;
+    return t->qtd++;
+}
+
+/* cadastra um ingrediente novo e já grava a tabela, sob a trava: outro
+   usuário pode ter cadastrado o mesmo nome enquanto este digitava (fica o
+   dele). Retorna o id ou -1. Assim o id dado às receitas em montagem vale
+   em qualquer processo que recarregue a tabela */
+int ingredienteCadastrar(const char *nome, int tipo, double preco) {
+    if (!catalogoTravar(NULL)) return -1;
+    int id = ingredienteBuscar(nome);
+    if (id < 0 && (id = ingredienteAdicionar(nome, tipo, preco)) >= 0 && !salvarIngredientesAtomic()) {
+        /* só em memória: a próxima sincronização recarrega a tabela do disco */
+        compartilhado.visto.versao_ingredientes = ~0ULL;
+        id = -1;
+    }
+    catalogoDestravar();
+    return id;
+}
+
+double ingredienteCusto(const struct Ingrediente *g, double quantidade) {
+    if (g->tipo == INGR_POR_KG) return (g->preco / 1000.0) * quantidade;
+    return g->preco * quantidade;
+}
+
+/* monta o índice reverso ingrediente -> linhas por contagem (O(linhas));
+   0 sem memória */
+static int ingredientesIndexarUsos(void) {
+    struct TabelaIngredientes *t = &ingredientes;
+    if (t->usos_validos) return 1;
+    int *inicio = calloc((size_t)t->qtd + 1, sizeof(int));
+    int *usos = malloc(((size_t)t->qtd_linhas + 1) * sizeof(int));
+    if (!inicio || !usos) {
+        free(inicio);
+        free(usos);
+        return 0;
+    }
+    for (int r = 0; r < t->qtd_linhas; r++) inicio[t->linhas[r].ingrediente + 1]++;
+    for (int g = 0; g < t->qtd; g++) inicio[g + 1] += inicio[g];
+    /* preenche de trás para frente, decrementando o fim de cada faixa: as
+       linhas de cada ingrediente ficam em ordem crescente */
+    int *fim = malloc(((size_t)t->qtd + 1) * sizeof(int));
+    if (!fim) {
+        free(inicio);
+        free(usos);
+        return 0;
+    }
+    memcpy(fim, inicio + 1, (size_t)t->qtd * sizeof(int));
+    for (int r = t->qtd_linhas - 1; r >= 0; r--) usos[--fim[t->linhas[r].ingrediente]] = r;
+    free(fim);
+    free(t->inicio_uso);
+    free(t->usos);
+    t->inicio_uso = inicio;
+    t->usos = usos;
+    t->usos_validos = 1;
+    return 1;
+}
+
+/* quantas receitas (produtos distintos) usam o ingrediente g */
+static int ingredienteReceitas(int g) {
+    const struct TabelaIngredientes *t = &ingredientes;
+    if (!ingredientesIndexarUsos()) return 0;
+    int n = 0;
+    const char *ultimo = NULL;
+    for (int k = t->inicio_uso[g]; k < t->inicio_uso[g + 1]; k++) {
+        const char *produto = t->linhas[t->usos[k]].produto;
+        if (!ultimo || strcmp(ultimo, produto) != 0) n++;
+        ultimo = produto;
+    }
+    return n;
+}
+
+/* primeira linha da receita do produto (e quantas são, em *n) ou -1 */
+static int receitaLocalizar(const char *produto, int *n) {
+    const struct TabelaIngredientes *t = &ingredientes;
+    *n = 0;
+    for (int r = 0; r < t->qtd_linhas; r++) {
+        if (strcmp(t->linhas[r].produto, produto) != 0) continue;
+        while (r + *n < t->qtd_linhas && strcmp(t->linhas[r + *n].produto, produto) == 0) (*n)++;
+        return r;
+    }
+    return -1;
+}
+
+/* bloco de linhas do mesmo produto que contém a linha r */
+static int receitaBloco(int r, int *n) {
+    const struct ItemReceita *l = ingredientes.linhas;
+    int ini = r, fim = r + 1;
+    while (ini > 0 && strcmp(l[ini - 1].produto, l[r].produto) == 0) ini--;
+    while (fim < ingredientes.qtd_linhas && strcmp(l[fim].produto, l[r].produto) == 0) fim++;
+    *n = fim - ini;
+    return ini;
+}
+
+/* tira as linhas do produto; retorna 1 se havia alguma */
+int receitaRemover(const char *produto) {
+    struct TabelaIngredientes *t = &ingredientes;
+    int n, ini = receitaLocalizar(produto, &n);
+    if (ini < 0) return 0;
+    memmove(&t->linhas[ini], &t->linhas[ini + n], (size_t)(t->qtd_linhas - ini - n) * sizeof(*t->linhas));
+    t->qtd_linhas -= n;
+    t->usos_validos = 0;
+    return 1;
+}
+
+/* troca as linhas do produto pelas n de itens (só ingrediente e quantidade
+   são lidos); 0 sem memória, com as linhas antigas mantidas */
+int receitaDefinir(const char *produto, const struct ItemReceita *itens, int n) {
+    struct TabelaIngredientes *t = &ingredientes;
+    int antigas, ini = receitaLocalizar(produto, &antigas);
+    if (t->qtd_linhas - antigas + n > t->capacidade_linhas) {
+        int cap = t->capacidade_linhas ? t->capacidade_linhas : 64;
+        while (cap < t->qtd_linhas - antigas + n) cap *= 2;
+        struct ItemReceita *linhas = realloc(t->linhas, (size_t)cap * sizeof(*linhas));
+        if (!linhas) return 0;
+        t->linhas = linhas;
+        t->capacidade_linhas = cap;
+    }
+    if (ini >= 0) receitaRemover(produto);
+    for (int i = 0; i < n; i++) {
+        struct ItemReceita *l = &t->linhas[t->qtd_linhas++];
+        memset(l, 0, sizeof(*l));
+        strncpy(l->produto, produto, sizeof(l->produto) - 1);
+        l->ingrediente = itens[i].ingrediente;
+        l->quantidade = itens[i].quantidade;
+    }
+    t->usos_validos = 0;
+    return 1;
+}
+
+/* acompanha a troca de nome do produto, na receita dele e no ingrediente
+   que o representa como sub-receita; retorna 1 se algo mudou */
+int receitaRenomear(const char *antigo, const char *novo) {
+    struct TabelaIngredientes *t = &ingredientes;
+    int mudou = 0;
+    int g = ingredienteDoProduto(antigo);
+    if (g >= 0) {
+        memset(t->itens[g].nome, 0, sizeof(t->itens[g].nome));
+        strncpy(t->itens[g].nome, novo, sizeof(t->itens[g].nome) - 1);
+        char norm[MAX_NOME];
+        t->hash[g] = nomeHash(norm, nomeNormalizar(t->itens[g].nome, norm));
+        mudou = 1;
+    }
+    int n, ini = receitaLocalizar(antigo, &n);
+    if (ini < 0) return mudou;
+    for (int r = ini; r < ini + n; r++) {
+        memset(t->linhas[r].produto, 0, sizeof(t->linhas[r].produto));
+        strncpy(t->linhas[r].produto, novo, sizeof(t->linhas[r].produto) - 1);
+    }
+    return 1;
+}
+
+/* a receita do produto s usa o produto p, direta ou indiretamente (por
+   sub-receitas)? Usar s na receita de p criaria um ciclo */
+static int receitaUsaProduto(const char *s, const char *p) {
+    const struct TabelaIngredientes *t = &ingredientes;
+    if (strcmp(s, p) == 0) return 1;
+    unsigned char *visto = calloc((size_t)t->qtd + 1, 1);
+    int *pilha = malloc(((size_t)t->qtd + 1) * sizeof(int));
+    /* sem memória para checar: na dúvida, recusa */
+    int usa = !visto || !pilha;
+    int topo = 0;
+    const char *atual = s;
+    while (!usa && atual) {
+        int n, ini = receitaLocalizar(atual, &n);
+        for (int r = ini; ini >= 0 && r < ini + n && !usa; r++) {
+            int g = t->linhas[r].ingrediente;
+            if (t->itens[g].tipo != INGR_PRODUTO || visto[g]) continue;
+            visto[g] = 1;
+            usa = strcmp(t->itens[g].nome, p) == 0;
+            pilha[topo++] = g;
+        }
+        atual = topo > 0 ? t->itens[pilha[--topo]].nome : NULL;
+    }
+    free(visto);
+    free(pilha);
+    return usa;
+}
+
+/* texto de exibição (e de busca) da receita, refeito das linhas: o que não
+   couber em max vira um "(+N ingredientes)" no fim, em vez de sumir */
+static void receitaDescrever(const struct ItemReceita *linhas, int n, char *desc, size_t max) {
+    const size_t reserva = 40;
+    size_t usado = 0;
+    desc[0] = '\0';
+    for (int i = 0; i < n; i++) {
+        const struct Ingrediente *g = &ingredientes.itens[linhas[i].ingrediente];
+        char linha[BUF_SIZE];
+        char t_qtd[DINHEIRO_TAM], t_preco[DINHEIRO_TAM], t_custo[DINHEIRO_TAM];
+        double custo = ingredienteCusto(g, linhas[i].quantidade);
+        t_qtd[numeroFormatarCurto(linhas[i].quantidade, t_qtd)] = '\0';
+        int len;
+        if (g->tipo != INGR_POR_KG)
+            len = snprintf(linha, sizeof(linha), "  • %s: %s un x R$ %s = R$ %s\n", g->nome, t_qtd,
+                           dinheiroTexto(g->preco, t_preco), dinheiroTexto(custo, t_custo));
+        else
+            len = snprintf(linha, sizeof(linha), "  • %s: %sg x R$ %s/kg = R$ %s\n", g->nome, t_qtd,
+                           dinheiroTexto(g->preco, t_preco), dinheiroTexto(custo, t_custo));
+        size_t limite = i == n - 1 ? max - 1 : max - 1 - reserva;
+        if (usado + (size_t)len > limite) {
+            snprintf(desc + usado, max - usado, "  • (+%d ingredientes)\n", n - i);
+            return;
+        }
+        memcpy(desc + usado, linha, (size_t)len + 1);
+        usado += (size_t)len;
+    }
+}
+
+static double receitaCusto(const struct ItemReceita *linhas, int n) {
+    double total = 0.0;
+    for (int i = 0; i < n; i++)
+        total += ingredienteCusto(&ingredientes.itens[linhas[i].ingrediente], linhas[i].quantidade);
+    return total;
+}
+
+/* custo por unidade do produto antes do rateio das despesas fixas (mesmas
+   contas de precificarEscalar): o preço dele como sub-receita */
+double custoBaseProduto(const struct ColunasPreco *c, int i) {
+    if (c->modo[i] == 1) return c->preco_custo[i];
+    int rendimento = c->rendimento[i] > 0 ? c->rendimento[i] : 1;
+    return c->investimento_total[i] / (double)rendimento + c->despesas_variaveis[i] / (double)rendimento;
+}
+
+/* refaz investimento, texto e preço do produto idx a partir das linhas
+   [ini, ini + n) e registra no log (sem confirmar). 0 se não gravou */
+static int receitaRecalcular(struct Catalogo *cat, int idx, int ini, int n) {
+    struct Produto p;
+    catalogoObter(cat, idx, &p);
+    if (p.modo != 2) return 0;
+    p.investimento_total = receitaCusto(&ingredientes.linhas[ini], n);
+    receitaDescrever(&ingredientes.linhas[ini], n, p.ingredientes_desc, sizeof(p.ingredientes_desc));
+    if (!catalogoGravar(cat, idx, &p)) return 0;
+    catalogoAtualizarPreco(cat, idx);
+    return diarioRegistrar(cat, LOG_ATUALIZAR, idx);
+}
+
+/* produto da receita que usa a linha usos[k] (bloco em *ini, *n), ou -1 */
+static int usoProduto(struct Catalogo *cat, int k, int *ini, int *n) {
+    *ini = receitaBloco(ingredientes.usos[k], n);
+    return catalogoBuscarNome(cat, ingredientes.linhas[*ini].produto);
+}
+
+/* os preços dos ingredientes alterados já mudaram: recalcula só o subgrafo
+   alcançável a partir deles (receitas que os usam, receitas que usam essas
+   como sub-receita...), em ordem topológica, para que cada produto seja
+   refeito uma única vez e depois de todos os seus insumos. Os nós são os
+   produtos (índices do catálogo). As gravações vão para o log sem
+   confirmar. Retorna quantas receitas foram recalculadas, ou -1 sem memória */
+int ingredientesPropagar(struct Catalogo *cat, const int *alterados, int n) {
+    struct TabelaIngredientes *t = &ingredientes;
+    if (!ingredientesIndexarUsos()) return -1;
+    size_t qtd = (size_t)cat->qtd + 1;
+    int *no = malloc(qtd * sizeof(int));        /* ingrediente que representa o produto */
+    int *bloco = malloc(qtd * sizeof(int));     /* linha inicial da receita; -1: fora do subgrafo */
+    int *grau = calloc(qtd, sizeof(int));       /* insumos afetados ainda não recalculados */
+    int *afetados = malloc(qtd * sizeof(int));
+    int *ordem = malloc(qtd * sizeof(int));
+    unsigned char *visto = calloc((size_t)t->qtd + 1, 1);
+    int *pilha = malloc(((size_t)t->qtd + 1) * sizeof(int));
+    int recalculadas = -1;
+    if (!no || !bloco || !grau || !afetados || !ordem || !visto || !pilha) goto fim;
+
+    for (int i = 0; i < cat->qtd; i++) no[i] = bloco[i] = -1;
+    for (int g = 0; g < t->qtd; g++) {
+        if (t->itens[g].tipo != INGR_PRODUTO) continue;
+        int idx = catalogoBuscarNome(cat, t->itens[g].nome);
+        if (idx >= 0) no[idx] = g;
+    }
+
+    /* 1. subgrafo afetado: busca em profundidade pelos usos */
+    int topo = 0, qtd_afetados = 0;
+    for (int k = 0; k < n; k++) {
+        if (visto[alterados[k]]) continue;
+        visto[alterados[k]] = 1;
+        pilha[topo++] = alterados[k];
+    }
+    while (topo > 0) {
+        int g = pilha[--topo];
+        int ultimo = -1;
+        for (int k = t->inicio_uso[g]; k < t->inicio_uso[g + 1]; k++) {
+            int ini, nl;
+            int q = usoProduto(cat, k, &ini, &nl);
+            /* as linhas do mesmo produto são vizinhas em usos */
+            if (ini == ultimo) continue;
+            ultimo = ini;
+            if (q < 0 || bloco[q] >= 0) continue;
+            bloco[q] = ini;
+            afetados[qtd_afetados++] = q;
+            if (no[q] >= 0 && !visto[no[q]]) {
+                visto[no[q]] = 1;
+                pilha[topo++] = no[q];
+            }
+        }
+    }
+
+    /* 2. grau de entrada de cada produto dentro do subgrafo */
+    for (int a = 0; a < qtd_afetados; a++) {
+        int g = no[afetados[a]];
+        if (g < 0) continue;
+        int ultimo = -1;
+        for (int k = t->inicio_uso[g]; k < t->inicio_uso[g + 1]; k++) {
+            int ini, nl;
+            int q = usoProduto(cat, k, &ini, &nl);
+            if (ini == ultimo || q < 0) continue;
+            ultimo = ini;
+            grau[q]++;
+        }
+    }
+
+    /* 3. Kahn: recalcula quem não espera mais nenhum insumo; o custo novo
+       do produto vira o preço do ingrediente que o representa */
+    int cabeca = 0, cauda = 0;
+    for (int a = 0; a < qtd_afetados; a++)
+        if (grau[afetados[a]] == 0) ordem[cauda++] = afetados[a];
+    recalculadas = 0;
+    while (cabeca < cauda) {
+        int q = ordem[cabeca++];
+        int nl;
+        int ini = receitaBloco(bloco[q], &nl);
+        if (receitaRecalcular(cat, q, ini, nl)) recalculadas++;
+        int g = no[q];
+        if (g < 0) continue;
+        t->itens[g].preco = custoBaseProduto(&cat->col, q);
+        int ultimo = -1;
+        for (int k = t->inicio_uso[g]; k < t->inicio_uso[g + 1]; k++) {
+            int r = usoProduto(cat, k, &ini, &nl);
+            if (ini == ultimo || r < 0) continue;
+            ultimo = ini;
+            if (--grau[r] == 0) ordem[cauda++] = r;
+        }
+    }
+    /* sobra com grau > 0 só num ciclo, que a coleta de ingredientes impede */
+
+fim:
+    free(no);
+    free(bloco);
+    free(grau);
+    free(afetados);
+    free(ordem);
+    free(visto);
+    free(pilha);
+    return recalculadas;
+}
+
+/* troca o preço de n ingredientes de uma vez (lista de fornecedor) e
+   recalcula as receitas afetadas numa só propagação, confirmada no log de
+   uma vez. Retorna quantas foram, ou -1 se algo não pôde ser gravado */
+int ingredientesAlterarPrecos(struct Catalogo *cat, const int *ids, const double *precos, int n) {
+    for (int k = 0; k < n; k++) ingredientes.itens[ids[k]].preco = precos[k];
+    int recalculadas = ingredientesPropagar(cat, ids, n);
+    if (recalculadas > 0 && !diarioConfirmar(cat)) recalculadas = -1;
+    if (!salvarIngredientesAtomic()) recalculadas = -1;
+    return recalculadas;
+}
+
+/* o produto idx mudou (custo, nome): se ele é sub-receita de outros, o
+   ingrediente que o representa recebe o custo novo e as receitas que o usam
+   são refeitas. Retorna quantas foram, ou -1 se algo não pôde ser gravado */
+int produtoPropagar(struct Catalogo *cat, int idx) {
+    int g = ingredienteDoProduto(cat->nome[idx]);
+    if (g < 0) return 0;
+    double custo = custoBaseProduto(&cat->col, idx);
+    return ingredientesAlterarPrecos(cat, &g, &custo, 1);
+}
+
+/* ----- Coleta de ingredientes (modo receita) ----- */
+/* os ingredientes já na tabela entram com o preço cadastrado (alterado só
+   pelo menu de ingredientes, que recalcula todas as receitas que o usam);
+   o nome de um produto do catálogo entra como sub-receita, a não ser que
+   crie um ciclo com o produto (nome) sendo montado; os demais nomes são
+   cadastrados (e gravados na hora) como ingredientes novos. Sem catálogo (cálculo rápido), não há
+   sub-receitas. itens recebe ingrediente e quantidade de cada um, para
+   receitaDefinir; descricao, o texto montado das linhas */
+double coletarIngredientes(struct Catalogo *cat, const char *produto, struct ItemReceita *itens,
+                           int *qtd_itens, char *descricao, int descSize, int *rendimento) {
+    char buf[BUF_SIZE];
+    int n;
+    double custo_total = 0.0;
+
+    descricao[0] = '\0';
+    *qtd_itens = 0;
+
+    printf("\n%sQuantos ingredientes tem essa receita? %s", YELLOW, RESET);
+    lerLinha(buf, sizeof(buf));
+    n = atoi(buf);
+    if (n < 1) return -1.0;
+    if (n > MAX_INGR) n = MAX_INGR;
+
+    for (int i = 0; i < n; i++) {
+        char nome[MAX_NOME];
+        double quantidade, custo;
+        char t_preco[DINHEIRO_TAM], t_custo[DINHEIRO_TAM];
+
+        printf("\n%s%s> Ingrediente %d%s\n", BOLD, MAGENTA, i + 1, RESET);
+
+        printf("%sNome: %s", CYAN, RESET);
+        lerLinha(nome, sizeof(nome));
+
+        int id = ingredienteBuscar(nome);
+        int sub = id < 0 && cat ? catalogoBuscarNome(cat, nome) : -1;
+        const char *sub_nome = id >= 0 && ingredientes.itens[id].tipo == INGR_PRODUTO ? ingredientes.itens[id].nome
+                             : sub >= 0 ? cat->nome[sub] : NULL;
+        if (sub_nome && produto && receitaUsaProduto(sub_nome, produto)) {
+            imprimir_erro("Esse produto usa (ou e) a receita sendo montada: ingrediente ignorado.");
+            continue;
+        }
+        if (sub >= 0) {
+            id = ingredienteCadastrar(cat->nome[sub], INGR_PRODUTO, custoBaseProduto(&cat->col, sub));
+            if (id < 0) {
+                imprimir_erro("Falha ao gravar a tabela de ingredientes.");
+                return -1.0;
+            }
+        }
+        if (id >= 0) {
+            const struct Ingrediente *g = &ingredientes.itens[id];
+            printf("%s%s: R$ %s %s%s\n", GREEN, g->tipo == INGR_PRODUTO ? "Sub-receita (produto cadastrado)" : "Ja cadastrado",
+                   dinheiroTexto(g->preco, t_preco), g->tipo == INGR_POR_KG ? "por kg" : "por unidade", RESET);
+        } else {
+            int tipo;
+            double preco;
+            printf("%sTipo (1=preco/kg | 2=preco por unidade): %s", CYAN, RESET);
+            lerLinha(buf, sizeof(buf));
+            tipo = atoi(buf);
+            if (tipo != INGR_POR_KG && tipo != INGR_POR_UNIDADE) tipo = INGR_POR_KG;
+
+            printf("%s%s (R$): %s", CYAN, tipo == INGR_POR_UNIDADE ? "Preco por unidade" : "Preco por KG", RESET);
+            lerLinha(buf, sizeof(buf));
+            preco = lerValor(buf);
+            id = ingredienteCadastrar(nome, tipo, preco);
+            if (id < 0) {
+                imprimir_erro("Falha ao gravar a tabela de ingredientes.");
+                return -1.0;
+            }
+        }
+
+        const struct Ingrediente *g = &ingredientes.itens[id];
+        if (g->tipo == INGR_POR_KG)
+            printf("%sQuantidade usada (gramas): %s", CYAN, RESET);
+        else
+            printf("%sQuantidade usada (unidades): %s", CYAN, RESET);
+        lerLinha(buf, sizeof(buf));
+        quantidade = lerValor(buf);
+        custo = ingredienteCusto(g, quantidade);
+
+        itens[*qtd_itens].ingrediente = id;
+        itens[*qtd_itens].quantidade = quantidade;
+        (*qtd_itens)++;
+        custo_total += custo;
+        printf("%s-> Custo de %s: %sR$ %s%s\n", GREEN, g->nome, BOLD, dinheiroTexto(custo, t_custo), RESET);
+    }
+    /* todos recusados: como se não houvesse ingredientes */
+    if (*qtd_itens == 0) return -1.0;
+    receitaDescrever(itens, *qtd_itens, descricao, (size_t)descSize);
+
+    printf("\n%sRendimento da receita (quantas unidades produz): %s", YELLOW, RESET);
+    lerLinha(buf, sizeof(buf));
+    *rendimento = atoi(buf);
+    if (*rendimento <= 0) *rendimento = 1;
+
+    return custo_total;
+}
+
+/* ----- Cálculo completo por produto ----- */
+#if SIPRI_CENTAVOS
+/* ----- Motor em centavos (SIPRI_CENTAVOS) ----- */
+/* Dinheiro em int64 de centavos e percentuais em pontos-base (centésimos de
+   ponto percentual: 6,5% = 650). Regras de arredondamento, todas definidas:
+   - entrada: valor * 100 arredondado ao centavo mais próximo, empate longe do
+     zero (o que se digita com 2 casas vira exatamente seus centavos);
+   - rateio, custo por unidade da receita e lucro: divisão arredondada ao mais
+     próximo, empate longe do zero;
+   - preço final (divisão por 1 - percentual/100): arredondado para cima, para
+     que imposto e taxa nunca comam parte do lucro pedido. */
+#define PONTOS_BASE 10000LL
+
+static long long centavosArredondar(double v) {
+    double p = v * 100.0;
+    if (!(p > -9e18 && p < 9e18)) return 0;     /* nan ou fora do int64 */
+    long long t = (long long)p;
+    double resto = p - (double)t;               /* exato: |p| < 2^63 */
+    return t + (resto >= 0.5) - (resto <= -0.5);     /* sem desvio */
+}
+
+/* n / d com d > 0, empate longe do zero */
+static long long dividirArredondando(long long n, long long d) {
+    return n >= 0 ? (n + d / 2) / d : -((-n + d / 2) / d);
+}
+
+/* teto de n / d com d > 0 */
+static long long dividirParaCima(long long n, long long d) {
+    long long q = n / d;
+    return (n % d > 0) ? q + 1 : q;
+}
+#endif
+
+/* rateio das despesas fixas mensais por unidade produzida */
+double rateioDespesasFixas() {
+    double rateio_fixo_por_unidade = 0.0;
+    if (config.producao_mensal_unidades > 0) {
+#if SIPRI_CENTAVOS
+        long long total_fixa = centavosArredondar(config.gasto_agua) + centavosArredondar(config.gasto_luz) +
+                               centavosArredondar(config.gasto_gas);
+        rateio_fixo_por_unidade = (double)dividirArredondando(total_fixa, config.producao_mensal_unidades) / 100.0;
+#else
+        double total_fixa = config.gasto_agua + config.gasto_luz + config.gasto_gas;
+        rateio_fixo_por_unidade = total_fixa / (double)config.producao_mensal_unidades;
+#endif
+    }
+    return rateio_fixo_por_unidade;
+}
+
+#if !SIPRI_CENTAVOS
+/* referência escalar: precifica o item i das colunas; retorna 1 se ajustou
+   percentuais. Os caminhos SIMD abaixo reproduzem exatamente estas operações,
+   na mesma ordem, para que o resultado seja idêntico bit a bit */
+static int precificarEscalar(struct ColunasPreco *c, int i, double rateio) {
+    double custo_base_unitario;
+
+    if (c->modo[i] == 1) {
+        custo_base_unitario = c->preco_custo[i];
+    } else {
+        if (c->rendimento[i] <= 0) c->rendimento[i] = 1;
+        double despesasVariaveisPorUn = c->despesas_variaveis[i] / (double)c->rendimento[i];
+        custo_base_unitario = (c->investimento_total[i] / (double)c->rendimento[i]) + despesasVariaveisPorUn;
+    }
+
+    c->custo_unitario[i] = custo_base_unitario + rateio;
+
+    if (c->usar_mei_comercio[i]) c->imposto_percent[i] = 4.0;
+
+    /* garantir percentuais válidos antes do cálculo */
+    int ajustado = ajustarPercentuais(&c->imposto_percent[i], &c->taxa_cartao_percent[i],
+                                      &c->lucro_produtor_percent[i]);
+
+    double lucro_valor = c->custo_unitario[i] * (c->lucro_produtor_percent[i] / 100.0);
+    double preco_com_lucro = c->custo_unitario[i] + lucro_valor;
+
+    double total_percent = c->imposto_percent[i] + c->taxa_cartao_percent[i];
+    if (total_percent >= 100.0) total_percent = 99.0;
+
+    c->preco_produtor[i] = preco_com_lucro / (1.0 - (total_percent / 100.0));
+    return ajustado;
+}
+
+#ifdef SIPRI_X86
+/* SSE2: 2 produtos por iteração; seleção sem desvio via máscaras and/andnot/or */
+static inline __m128d selecionar_pd(__m128d mascara, __m128d senao, __m128d entao) {
+    return _mm_or_pd(_mm_and_pd(mascara, entao), _mm_andnot_pd(mascara, senao));
+}
+
+static inline __m128i selecionar_epi32(__m128i mascara, __m128i senao, __m128i entao) {
+    return _mm_or_si128(_mm_and_si128(mascara, entao), _mm_andnot_si128(mascara, senao));
+}
+
+__attribute__((target("sse2")))
+static int precificarSse2(struct ColunasPreco *c, int ini, int fim, double rateio) {
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d cem = _mm_set1_pd(100.0);
+    const __m128d noventa_nove = _mm_set1_pd(99.0);
+    const __m128d noventa_oito = _mm_set1_pd(98.0);
+    const __m128d quatro = _mm_set1_pd(4.0);
+    const __m128d um = _mm_set1_pd(1.0);
+    const __m128d vrateio = _mm_set1_pd(rateio);
+    const __m128i um_i = _mm_set1_epi32(1);
+    const __m128i zero_i = _mm_setzero_si128();
+    int ajustes = 0;
+    int i = ini;
+
+    for (; i + 2 <= fim; i += 2) {
+        __m128i modo = _mm_loadl_epi64((const __m128i *)&c->modo[i]);
+        __m128i rend = _mm_loadl_epi64((const __m128i *)&c->rendimento[i]);
+        __m128i mei = _mm_loadl_epi64((const __m128i *)&c->usar_mei_comercio[i]);
+
+        /* rendimento <= 0 vira 1, mas só é gravado no modo receita */
+        __m128i direto_i = _mm_cmpeq_epi32(modo, um_i);
+        __m128i rend_ef = selecionar_epi32(_mm_cmpgt_epi32(rend, zero_i), um_i, rend);
+        _mm_storel_epi64((__m128i *)&c->rendimento[i], selecionar_epi32(direto_i, rend_ef, rend));
+
+        __m128d direto = _mm_castsi128_pd(_mm_unpacklo_epi32(direto_i, direto_i));
+        __m128i sem_mei_i = _mm_cmpeq_epi32(mei, zero_i);
+        __m128d sem_mei = _mm_castsi128_pd(_mm_unpacklo_epi32(sem_mei_i, sem_mei_i));
+
+        __m128d r = _mm_cvtepi32_pd(rend_ef);
+        __m128d receita = _mm_add_pd(_mm_div_pd(_mm_loadu_pd(&c->investimento_total[i]), r),
+                                     _mm_div_pd(_mm_loadu_pd(&c->despesas_variaveis[i]), r));
+        __m128d base = selecionar_pd(direto, receita, _mm_loadu_pd(&c->preco_custo[i]));
+        __m128d cu = _mm_add_pd(base, vrateio);
+
+        __m128d imp = selecionar_pd(sem_mei, quatro, _mm_loadu_pd(&c->imposto_percent[i]));
+        __m128d taxa = _mm_loadu_pd(&c->taxa_cartao_percent[i]);
+        __m128d lucro = _mm_loadu_pd(&c->lucro_produtor_percent[i]);
+
+        /* negativos viram 0 (e contam como ajuste); depois limita a 0..99 */
+        __m128d neg_imp = _mm_cmplt_pd(imp, zero);
+        __m128d neg_taxa = _mm_cmplt_pd(taxa, zero);
+        __m128d neg_lucro = _mm_cmplt_pd(lucro, zero);
+        __m128d mudou = _mm_or_pd(neg_imp, _mm_or_pd(neg_taxa, neg_lucro));
+        imp = selecionar_pd(neg_imp, imp, zero);
+        taxa = selecionar_pd(neg_taxa, taxa, zero);
+        lucro = selecionar_pd(neg_lucro, lucro, zero);
+        imp = selecionar_pd(_mm_cmpgt_pd(imp, noventa_nove), imp, noventa_nove);
+        taxa = selecionar_pd(_mm_cmpgt_pd(taxa, noventa_nove), taxa, noventa_nove);
+        lucro = selecionar_pd(_mm_cmpgt_pd(lucro, noventa_nove), lucro, noventa_nove);
+
+        __m128d total = _mm_add_pd(imp, taxa);
+        __m128d excede = _mm_cmpge_pd(total, noventa_nove);
+        __m128d fator = _mm_div_pd(noventa_oito, total);
+        imp = selecionar_pd(excede, imp, _mm_mul_pd(imp, fator));
+        taxa = selecionar_pd(excede, taxa, _mm_mul_pd(taxa, fator));
+        mudou = _mm_or_pd(mudou, excede);
+        ajustes += __builtin_popcount(_mm_movemask_pd(mudou));
+
+        __m128d lucro_valor = _mm_mul_pd(cu, _mm_div_pd(lucro, cem));
+        __m128d preco_com_lucro = _mm_add_pd(cu, lucro_valor);
+        __m128d total_percent = _mm_add_pd(imp, taxa);
+        total_percent = selecionar_pd(_mm_cmpge_pd(total_percent, cem), total_percent, noventa_nove);
+        __m128d preco = _mm_div_pd(preco_com_lucro, _mm_sub_pd(um, _mm_div_pd(total_percent, cem)));
+
+        _mm_storeu_pd(&c->custo_unitario[i], cu);
+        _mm_storeu_pd(&c->imposto_percent[i], imp);
+        _mm_storeu_pd(&c->taxa_cartao_percent[i], taxa);
+        _mm_storeu_pd(&c->lucro_produtor_percent[i], lucro);
+        _mm_storeu_pd(&c->preco_produtor[i], preco);
+    }
+    for (; i < fim; i++) ajustes += precificarEscalar(c, i, rateio);
+    return ajustes;
+}
+
+/* AVX2: 4 produtos por iteração; escolhido em tempo de execução se a CPU suportar */
+__attribute__((target("avx2")))
+static int precificarAvx2(struct ColunasPreco *c, int ini, int fim, double rateio) {
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d cem = _mm256_set1_pd(100.0);
+    const __m256d noventa_nove = _mm256_set1_pd(99.0);
+    const __m256d noventa_oito = _mm256_set1_pd(98.0);
+    const __m256d quatro = _mm256_set1_pd(4.0);
+    const __m256d um = _mm256_set1_pd(1.0);
+    const __m256d vrateio = _mm256_set1_pd(rateio);
+    const __m128i um_i = _mm_set1_epi32(1);
+    const __m128i zero_i = _mm_setzero_si128();
+    int ajustes = 0;
+    int i = ini;
+
+    for (; i + 4 <= fim; i += 4) {
+        __m128i modo = _mm_loadu_si128((const __m128i *)&c->modo[i]);
+        __m128i rend = _mm_loadu_si128((const __m128i *)&c->rendimento[i]);
+        __m128i mei = _mm_loadu_si128((const __m128i *)&c->usar_mei_comercio[i]);
+
+        /* rendimento <= 0 vira 1, mas só é gravado no modo receita */
+        __m128i direto_i = _mm_cmpeq_epi32(modo, um_i);
+        __m128i rend_ef = _mm_blendv_epi8(um_i, rend, _mm_cmpgt_epi32(rend, zero_i));
+        _mm_storeu_si128((__m128i *)&c->rendimento[i], _mm_blendv_epi8(rend_ef, rend, direto_i));
+
+        __m256d direto = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(direto_i));
+        __m256d sem_mei = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm_cmpeq_epi32(mei, zero_i)));
+
+        __m256d r = _mm256_cvtepi32_pd(rend_ef);
+        __m256d receita = _mm256_add_pd(_mm256_div_pd(_mm256_loadu_pd(&c->investimento_total[i]), r),
+                                        _mm256_div_pd(_mm256_loadu_pd(&c->despesas_variaveis[i]), r));
+        __m256d base = _mm256_blendv_pd(receita, _mm256_loadu_pd(&c->preco_custo[i]), direto);
+        __m256d cu = _mm256_add_pd(base, vrateio);
+
+        __m256d imp = _mm256_blendv_pd(quatro, _mm256_loadu_pd(&c->imposto_percent[i]), sem_mei);
+        __m256d taxa = _mm256_loadu_pd(&c->taxa_cartao_percent[i]);
+        __m256d lucro = _mm256_loadu_pd(&c->lucro_produtor_percent[i]);
+
+        /* negativos viram 0 (e contam como ajuste); depois limita a 0..99 */
+        __m256d neg_imp = _mm256_cmp_pd(imp, zero, _CMP_LT_OQ);
+        __m256d neg_taxa = _mm256_cmp_pd(taxa, zero, _CMP_LT_OQ);
+        __m256d neg_lucro = _mm256_cmp_pd(lucro, zero, _CMP_LT_OQ);
+        __m256d mudou = _mm256_or_pd(neg_imp, _mm256_or_pd(neg_taxa, neg_lucro));
+        imp = _mm256_blendv_pd(imp, zero, neg_imp);
+        taxa = _mm256_blendv_pd(taxa, zero, neg_taxa);
+        lucro = _mm256_blendv_pd(lucro, zero, neg_lucro);
+        imp = _mm256_blendv_pd(imp, noventa_nove, _mm256_cmp_pd(imp, noventa_nove, _CMP_GT_OQ));
+        taxa = _mm256_blendv_pd(taxa, noventa_nove, _mm256_cmp_pd(taxa, noventa_nove, _CMP_GT_OQ));
+        lucro = _mm256_blendv_pd(lucro, noventa_nove, _mm256_cmp_pd(lucro, noventa_nove, _CMP_GT_OQ));
+
+        __m256d total = _mm256_add_pd(imp, taxa);
+        __m256d excede = _mm256_cmp_pd(total, noventa_nove, _CMP_GE_OQ);
+        __m256d fator = _mm256_div_pd(noventa_oito, total);
+        imp = _mm256_blendv_pd(imp, _mm256_mul_pd(imp, fator), excede);
+        taxa = _mm256_blendv_pd(taxa, _mm256_mul_pd(taxa, fator), excede);
+        mudou = _mm256_or_pd(mudou, excede);
+        ajustes += __builtin_popcount(_mm256_movemask_pd(mudou));
+
+        __m256d lucro_valor = _mm256_mul_pd(cu, _mm256_div_pd(lucro, cem));
+        __m256d preco_com_lucro = _mm256_add_pd(cu, lucro_valor);
+        __m256d total_percent = _mm256_add_pd(imp, taxa);
+        total_percent = _mm256_blendv_pd(total_percent, noventa_nove,
+                                         _mm256_cmp_pd(total_percent, cem, _CMP_GE_OQ));
+        __m256d preco = _mm256_div_pd(preco_com_lucro, _mm256_sub_pd(um, _mm256_div_pd(total_percent, cem)));
+
+        _mm256_storeu_pd(&c->custo_unitario[i], cu);
+        _mm256_storeu_pd(&c->imposto_percent[i], imp);
+        _mm256_storeu_pd(&c->taxa_cartao_percent[i], taxa);
+        _mm256_storeu_pd(&c->lucro_produtor_percent[i], lucro);
+        _mm256_storeu_pd(&c->preco_produtor[i], preco);
+    }
+    for (; i < fim; i++) ajustes += precificarEscalar(c, i, rateio);
+    return ajustes;
+}
+#endif
+
+/* precifica os itens [ini, fim) das colunas numa passada só, sem imprimir
+   nada; retorna quantos produtos tiveram percentuais ajustados */
+int calcularLote(struct ColunasPreco *c, int ini, int fim, double rateio) {
+#ifdef SIPRI_X86
+    if (fim - ini >= 4 && __builtin_cpu_supports("avx2")) return precificarAvx2(c, ini, fim, rateio);
+    if (fim - ini >= 2 && __builtin_cpu_supports("sse2")) return precificarSse2(c, ini, fim, rateio);
+#endif
+    int ajustes = 0;
+    for (int i = ini; i < fim; i++) ajustes += precificarEscalar(c, i, rateio);
+    return ajustes;
+}
+
+#else
+/* mesmas regras de precificarEscalar, em centavos; retorna quantos produtos
+   tiveram percentuais ajustados. O rateio chega em reais, mas já é múltiplo
+   exato de centavo (ver rateioDespesasFixas). Valores fora de ±VALOR_MAX
+   (que só chegam de arquivos antigos) estourariam o int64: o produto fica
+   com custo e preço nan em vez de um número errado */
+int calcularLote(struct ColunasPreco *c, int ini, int fim, double rateio) {
+    long long rateio_c = centavosArredondar(rateio);
+    int rateio_ok = rateio >= -3 * VALOR_MAX && rateio <= 3 * VALOR_MAX;
+    int ajustes = 0;
+    for (int i = ini; i < fim; i++) {
+        if (!rateio_ok || !valorNaFaixa(c->preco_custo[i]) || !valorNaFaixa(c->investimento_total[i]) ||
+            !valorNaFaixa(c->despesas_variaveis[i])) {
+            c->custo_unitario[i] = NAN;
+            c->preco_produtor[i] = NAN;
+            continue;
+        }
+        long long base;
+        if (c->modo[i] == 1) {
+            base = centavosArredondar(c->preco_custo[i]);
+        } else {
+            if (c->rendimento[i] <= 0) c->rendimento[i] = 1;
+            base = dividirArredondando(centavosArredondar(c->investimento_total[i]) +
+                                       centavosArredondar(c->despesas_variaveis[i]),
+                                       c->rendimento[i]);
+        }
+        long long custo = base + rateio_c;
+
+        if (c->usar_mei_comercio[i]) c->imposto_percent[i] = 4.0;
+        ajustes += ajustarPercentuais(&c->imposto_percent[i], &c->taxa_cartao_percent[i],
+                                      &c->lucro_produtor_percent[i]);
+
+        long long lucro = centavosArredondar(c->lucro_produtor_percent[i]);
+        long long total = centavosArredondar(c->imposto_percent[i]) +
+                          centavosArredondar(c->taxa_cartao_percent[i]);
+        if (total >= PONTOS_BASE) total = 99 * 100;
+
+        long long com_lucro = custo + dividirArredondando(custo * lucro, PONTOS_BASE);
+        long long preco = dividirParaCima(com_lucro * PONTOS_BASE, PONTOS_BASE - total);
+
+        c->custo_unitario[i] = (double)custo / 100.0;
+        c->preco_produtor[i] = (double)preco / 100.0;
+    }
+    return ajustes;
+}
+#endif
+
+/* um produto isolado passa pelo mesmo núcleo, vendo o struct como colunas de 1 item */
+void calcularTudo(struct Produto *p) {
+    struct ColunasPreco c;
+#define X(tipo, campo) c.campo = &p->campo;
+    COLUNAS_PRECO(X)
+#undef X
+    if (calcularLote(&c, 0, 1, rateioDespesasFixas()) > 0)
+        imprimir_aviso("Alguns percentuais foram ajustados para valores validos (0-99%% e imposto+taxa < 99%%).");
+}
+
+/* ----- Configurar despesas fixas globais ----- */
+void configurarDespesasFixas() {
+    char buf[BUF_SIZE];
+    imprimir_cabecalho("CONFIGURAR DESPESAS FIXAS MENSAIS");
+
+    printf("\n%s%sVALORES ATUAIS:%s\n", BOLD, YELLOW, RESET);
+    imprimir_valor("Agua", config.gasto_agua);
+    imprimir_valor("Luz", config.gasto_luz);
+    imprimir_valor("Gas", config.gasto_gas);
+    printf("%sProducao mensal          :%s %d unidades\n\n", CYAN, RESET, config.producao_mensal_unidades);
+
+    /* só os campos informados são aplicados, sobre a config relida sob a
+       trava: o que outro usuário mudou nos demais continua valendo */
+    char agua[BUF_SIZE], luz[BUF_SIZE], gas[BUF_SIZE];
+    printf("%sInforme gasto mensal com AGUA (R$): %s", CYAN, RESET);
+    lerLinha(agua, sizeof(agua));
+
+    printf("%sInforme gasto mensal com LUZ (R$): %s", CYAN, RESET);
+    lerLinha(luz, sizeof(luz));
+
+    printf("%sInforme gasto mensal com GAS (R$): %s", CYAN, RESET);
+    lerLinha(gas, sizeof(gas));
+
+    printf("%sInforme a PRODUCAO MENSAL (unidades/mes): %s", CYAN, RESET);
+    lerLinha(buf, sizeof(buf));
+
+    if (!catalogoTravar(NULL)) {
+        imprimir_erro("Nao foi possivel acessar as configuracoes.");
+        pausar();
+        return;
+    }
+    if (agua[0] != '\0') config.gasto_agua = lerValor(agua);
+    if (luz[0] != '\0') config.gasto_luz = lerValor(luz);
+    if (gas[0] != '\0') config.gasto_gas = lerValor(gas);
+    if (buf[0] != '\0') config.producao_mensal_unidades = atoi(buf);
+
+    /* O(1): só invalida os preços; cada produto é reprecificado quando for
+       lido, e os sujos que restarem vão em lote no próximo salvamento */
+    config_versao++;
+
+    if (!salvarConfigAtomic()) {
+        imprimir_aviso("Falha ao salvar configuracoes em disco.");
+    } else {
+        imprimir_sucesso("Configuracoes atualizadas com sucesso!");
+    }
+    catalogoDestravar();
+    pausar();
+}
+
+/* ----- Listar produtos ----- */
+void listarProdutos(struct Catalogo *cat) {
+    imprimir_cabecalho("LISTA DE PRODUTOS CADASTRADOS");
+
+    if (catalogoVivos(cat) == 0) {
+        imprimir_aviso("Nenhum produto cadastrado ainda.");
+        pausar();
+        return;
+    }
+
+    const struct ColunasPreco *c = &cat->col;
+    for (int i = 0; i < cat->qtd; i++) {
+        if (cat->excluido[i]) continue;
+        /* lê direto das colunas e dos textos (no mapa ou na arena), sem cópia */
+        catalogoAtualizarPreco(cat, i);
+
+        printf("\n%s%s+--- PRODUTO #%d --------------------------------------------------+%s\n", BOLD, BLUE, i+1, RESET);
+        printf("%s|%s %s%-60s%s\n", BLUE, RESET, BOLD, cat->nome[i], RESET);
+        printf("%s+-------------------------------------------------------------------+%s\n", BLUE, RESET);
+
+        if (c->modo[i] == 1) {
+            printf("%sModo                         :%s Custo direto por unidade\n", CYAN, RESET);
+            imprimir_valor("Custo informado/unidade", c->preco_custo[i]);
+        } else {
+            printf("%sModo                         :%s Receita (ingredientes)\n", CYAN, RESET);
+            imprimir_valor("Investimento total", c->investimento_total[i]);
+            printf("%sRendimento                   :%s %d unidades\n", CYAN, RESET, c->rendimento[i]);
+            printf("\n%s  Ingredientes:%s\n%s", YELLOW, RESET, cat->ingredientes_desc[i]);
+            imprimir_valor("Despesas variaveis", c->despesas_variaveis[i]);
+        }
+
+        imprimir_valor("Rateio despesas fixas/un", rateioDespesasFixas());
+        imprimir_valor("CUSTO UNITARIO FINAL", c->custo_unitario[i]);
+
+        printf("\n%s  Configuracoes financeiras:%s\n", YELLOW, RESET);
+        char v[DINHEIRO_TAM];
+        printf("%sImposto                      :%s %s%% %s\n", CYAN, RESET,
+               dinheiroTexto(c->imposto_percent[i], v), c->usar_mei_comercio[i] ? "(MEI Comercio)" : "");
+        printf("%sTaxa cartao                  :%s %s%%\n", CYAN, RESET, dinheiroTexto(c->taxa_cartao_percent[i], v));
+        printf("%sLucro desejado               :%s %s%%\n", CYAN, RESET, dinheiroTexto(c->lucro_produtor_percent[i], v));
+
+        printf("\n%s%s> PRECO FINAL SUGERIDO: R$ %s%s\n", BOLD, GREEN, dinheiroTexto(c->preco_produtor[i], v), RESET);
+        imprimir_linha('-', 70);
+    }
+
+    pausar();
+}
+
+/* pergunta qual produto (número da lista ou nome exato, sem diferenciar
+   maiúsculas); Enter mostra a lista antes. Retorna o índice ou -1 */
+int escolherProduto(struct Catalogo *cat, const char *acao) {
+    char buf[BUF_SIZE];
+    printf("\n%sNumero ou nome do produto para %s [Enter = listar]: %s", YELLOW, acao, RESET);
+    lerLinha(buf, sizeof(buf));
+    if (buf[0] == '\0') {
+        listarProdutos(cat);
+        printf("\n%sNumero ou nome do produto para %s: %s", YELLOW, acao, RESET);
+        lerLinha(buf, sizeof(buf));
+    }
+    if (buf[0] == '\0') return -1;
+    if (strspn(buf, "0123456789") == strlen(buf)) return atoi(buf) - 1;
+    return catalogoBuscarNome(cat, buf);
+}
+
+/* ----- Busca por trecho ----- */
+void buscarProdutos(struct Catalogo *cat) {
+    imprimir_cabecalho("BUSCAR PRODUTOS");
+    char buf[BUF_SIZE];
+    printf("\n%sTrecho do nome ou de um ingrediente: %s", CYAN, RESET);
+    lerLinha(buf, sizeof(buf));
+    if (buf[0] == '\0') return;
+
+    int *res;
+    int n = catalogoBuscarTexto(cat, buf, &res);
+    if (n < 0) {
+        imprimir_erro("Memoria insuficiente para a busca!");
+        pausar();
+        return;
+    }
+    if (n == 0) {
+        imprimir_aviso("Nenhum produto encontrado.");
+    } else {
+        printf("\n%s%d produto(s) encontrado(s):%s\n", BOLD, n, RESET);
+        char trecho[MAX_DESC], linha[MAX_DESC];
+        textoNormalizar(buf, trecho, sizeof(trecho));
+        for (int k = 0; k < n; k++) {
+            int i = res[k];
+            catalogoAtualizarPreco(cat, i);
+            char v[DINHEIRO_TAM];
+            printf("%s#%d%s %-40s %sR$ %s%s\n", BOLD, i + 1, RESET, cat->nome[i],
+                   GREEN, dinheiroTexto(cat->col.preco_produtor[i], v), RESET);
+            /* mostra a linha de ingrediente em que o trecho aparece */
+            const char *d = cat->ingredientes_desc[i];
+            while (*d) {
+                size_t tam = strcspn(d, "\n");
+                size_t copia = tam < sizeof(linha) - 1 ? tam : sizeof(linha) - 1;
+                memcpy(linha, d, copia);
+                linha[copia] = '\0';
+                char norm[MAX_DESC];
+                textoNormalizar(linha, norm, sizeof(norm));
+                if (strstr(norm, trecho)) printf("    %s%s%s\n", YELLOW, linha, RESET);
+                d += tam;
+                if (*d) d++;
+            }
+        }
+    }
+    free(res);
+    pausar();
+}
+
+/* ----- Consultas por faixa / top-K ----- */
+void consultarFaixas(struct Catalogo *cat) {
+    static const char *rotulos[NUM_ORDENS] = { "Preco final (R$)", "Custo unitario (R$)", "Margem efetiva (%)" };
+    imprimir_cabecalho("CONSULTAR POR FAIXA");
+    char buf[BUF_SIZE];
+
+    printf("%s1%s - Preco final\n%s2%s - Custo unitario\n%s3%s - Margem efetiva (lucro apos imposto e taxa)\n",
+           GREEN, RESET, GREEN, RESET, GREEN, RESET);
+    printf("\n%sCampo: %s", CYAN, RESET);
+    lerLinha(buf, sizeof(buf));
+    int ordem = atoi(buf) - 1;
+    if (ordem < 0 || ordem >= NUM_ORDENS) {
+        imprimir_erro("Campo invalido!");
+        pausar();
+        return;
+    }
+
+    printf("\n%s1%s - Faixa (minimo e maximo)\n%s2%s - Os K menores\n%s3%s - Os K maiores\n",
+           GREEN, RESET, GREEN, RESET, GREEN, RESET);
+    printf("\n%sTipo de consulta: %s", CYAN, RESET);
+    lerLinha(buf, sizeof(buf));
+    int tipo = atoi(buf);
+
+    const struct IndiceOrdem *o = catalogoOrdenado(cat, ordem);
+    if (!o) {
+        imprimir_erro("Memoria insuficiente para a consulta!");
+        pausar();
+        return;
+    }
+
+    /* cursor no começo do resultado; para no limite (faixa) ou após k */
+    struct CursorOrdem c;
+    double max = 0.0;
+    int k = -1, passo = 1;
+    if (tipo == 1) {
+        printf("%sMinimo: %s", CYAN, RESET);
+        lerLinha(buf, sizeof(buf));
+        double min = lerValor(buf);
+        printf("%sMaximo: %s", CYAN, RESET);
+        lerLinha(buf, sizeof(buf));
+        max = lerValor(buf);
+        ordemLimite(o, min, 0, &c);
+    } else if (tipo == 2 || tipo == 3) {
+        printf("%sK: %s", CYAN, RESET);
+        lerLinha(buf, sizeof(buf));
+        k = atoi(buf);
+        if (k < 0) k = 0;
+        /* os maiores saem do fim para o começo */
+        passo = tipo == 2 ? 1 : -1;
+        ordemExtremo(o, tipo == 3, &c);
+    } else {
+        imprimir_erro("Tipo invalido!");
+        pausar();
+        return;
+    }
+
+    printf("\n%s%-6s %-40s %s%s\n", BOLD, "#", "Produto", rotulos[ordem], RESET);
+    imprimir_linha('-', 70);
+    int n = 0;
+    for (const struct EntradaOrdem *e; (e = cursorEntrada(&c)) != NULL; cursorAvancar(&c, passo)) {
+        if (k >= 0 ? n >= k : !(e->chave <= max)) break;
+        char v[DINHEIRO_TAM];
+        printf("%-6d %-40s %s\n", e->idx + 1, cat->nome[e->idx], dinheiroTexto(e->chave, v));
+        n++;
+    }
+    if (n == 0) imprimir_aviso("Nenhum produto nessa consulta.");
+    else printf("\n%s%d produto(s).%s\n", BOLD, n, RESET);
+    pausar();
+}
+
+/* ----- Ingredientes (preços compartilhados) ----- */
+void gerenciarIngredientes(struct Catalogo *cat) {
+    char buf[BUF_SIZE];
+    while (1) {
+        catalogoSincronizar(cat);
+        imprimir_cabecalho("INGREDIENTES");
+        if (ingredientes.qtd == 0) {
+            imprimir_aviso("Nenhum ingrediente cadastrado ainda (cadastre uma receita).");
+            pausar();
+            return;
+        }
+        for (int g = 0; g < ingredientes.qtd; g++) {
+            const struct Ingrediente *ing = &ingredientes.itens[g];
+            char v[DINHEIRO_TAM];
+            printf("%s%3d%s - %-30s R$ %10s %-14s %s(%d receita(s))%s\n", GREEN, g + 1, RESET, ing->nome,
+                   dinheiroTexto(ing->preco, v),
+                   ing->tipo == INGR_PRODUTO ? "/un (produto)" : ing->tipo == INGR_POR_UNIDADE ? "/un" : "/kg",
+                   CYAN, ingredienteReceitas(g), RESET);
+        }
+
+        printf("\n%sNumero do ingrediente para alterar o preco [Enter volta]: %s", CYAN, RESET);
+        lerLinha(buf, sizeof(buf));
+        if (buf[0] == '\0') return;
+        int g = atoi(buf) - 1;
+        if (g < 0 || g >= ingredientes.qtd) {
+            imprimir_erro("Numero invalido!");
+            pausar();
+            continue;
+        }
+        if (ingredientes.itens[g].tipo == INGR_PRODUTO) {
+            imprimir_aviso("O custo de uma sub-receita vem do produto: edite o produto.");
+            pausar();
+            continue;
+        }
+        char v[DINHEIRO_TAM];
+        printf("%sNovo preco de %s (R$) [atual %s]: %s", CYAN, ingredientes.itens[g].nome,
+               dinheiroTexto(ingredientes.itens[g].preco, v), RESET);
+        lerLinha(buf, sizeof(buf));
+        if (buf[0] == '\0') continue;
+        double preco = lerValor(buf);
+        int n = -1;
+        if (catalogoTravar(cat)) {
+            n = ingredientesAlterarPrecos(cat, &g, &preco, 1);
+            catalogoDestravar();
+        }
+        if (n < 0) {
+            imprimir_erro("Falha ao salvar a tabela de ingredientes!");
+        } else {
+            snprintf(buf, sizeof(buf), "Preco atualizado; %d receita(s) recalculada(s).", n);
+            imprimir_sucesso(buf);
+        }
+        pausar();
+    }
+}
+
+/* ----- Editar produto ----- */
+/* mesmos dados de entrada? (custo unitário e preço ficam de fora: mudam
+   sozinhos com a config) */
+static int produtoMesmaEntrada(const struct Produto *a, const struct Produto *b) {
+    return strcmp(a->nome, b->nome) == 0 && a->modo == b->modo && a->preco_custo == b->preco_custo &&
+           a->investimento_total == b->investimento_total && a->rendimento == b->rendimento &&
+           strcmp(a->ingredientes_desc, b->ingredientes_desc) == 0 &&
+           a->despesas_variaveis == b->despesas_variaveis && a->usar_mei_comercio == b->usar_mei_comercio &&
+           a->imposto_percent == b->imposto_percent && a->taxa_cartao_percent == b->taxa_cartao_percent &&
+           a->lucro_produtor_percent == b->lucro_produtor_percent;
+}
+
+void editarProduto(struct Catalogo *cat) {
+    if (catalogoVivos(cat) == 0) {
+        imprimir_aviso("Nenhum produto para editar.");
+        pausar();
+        return;
+    }
+
+    char buf[BUF_SIZE];
+    int idx = escolherProduto(cat, "editar");
+
+    if (!catalogoValido(cat, idx)) {
+        imprimir_erro("Numero invalido!");
+        pausar();
+        return;
+    }
+
+    /* edita uma cópia e grava de volta no catálogo ao final */
+    struct Produto prod, original;
+    catalogoObter(cat, idx, &prod);
+    original = prod;
+    struct Produto *p = &prod;
+    char nome_antigo[MAX_NOME];
+    memcpy(nome_antigo, p->nome, sizeof(nome_antigo));
+    struct ItemReceita itens[MAX_INGR];
+    int qtd_itens = -1;     /* -1: receita não foi refeita */
+    imprimir_cabecalho("EDITAR PRODUTO");
+
+    printf("%sNovo nome [Enter mantem: %s]: %s", CYAN, p->nome, RESET);
+    lerLinha(buf, sizeof(buf));
+    if (buf[0] != '\0') {
+        int outro = catalogoBuscarNome(cat, buf);
+        if (outro >= 0 && outro != idx) {
+            imprimir_aviso("Ja existe outro produto com esse nome; nome mantido.");
+        } else {
+            strncpy(p->nome, buf, sizeof(p->nome)-1);
+            p->nome[sizeof(p->nome)-1] = '\0';
+        }
+    }
+
+    printf("%sAlterar modo/ingredientes? (s/n): %s", CYAN, RESET);
+    lerLinha(buf, sizeof(buf));
+    if (buf[0] == 's' || buf[0] == 'S') {
+        printf("%sNovo modo (1=custo direto | 2=receita): %s", CYAN, RESET);
+        lerLinha(buf, sizeof(buf));
+        p->modo = atoi(buf);
+        if (p->modo == 1) {
+            printf("%sPreco de custo/un (R$): %s", CYAN, RESET);
+            lerLinha(buf, sizeof(buf));
+            p->preco_custo = lerValor(buf);
+            p->investimento_total = p->preco_custo;
+            p->rendimento = 1;
+            p->ingredientes_desc[0] = '\0';
+            p->despesas_variaveis = 0.0;
+        } else {
+            char desc[MAX_DESC];
+            int n;
+            double custoCalc = coletarIngredientes(cat, nome_antigo, itens, &n, desc, sizeof(desc), &p->rendimento);
+            if (custoCalc >= 0.0) {
+                p->investimento_total = custoCalc;
+                memcpy(p->ingredientes_desc, desc, sizeof(desc));
+                qtd_itens = n;
+            }
+            char v[DINHEIRO_TAM];
+            printf("%sDespesas variaveis (R$) [Enter mantem %s]: %s", CYAN,
+                   dinheiroTexto(p->despesas_variaveis, v), RESET);
+            lerLinha(buf, sizeof(buf));
+            if (buf[0] != '\0') p->despesas_variaveis = lerValor(buf);
+        }
+    }
+
+    printf("%sUsar MEI comercio? (s/n) [atual: %s]: %s", CYAN, p->usar_mei_comercio ? "sim" : "nao", RESET);
+    lerLinha(buf, sizeof(buf));
+    if (buf[0] == 's' || buf[0] == 'S') {
+        p->usar_mei_comercio = 1;
+        p->imposto_percent = 4.0;
+    } else {
+        p->usar_mei_comercio = 0;
+        char v[DINHEIRO_TAM];
+        printf("%sImposto (%%) [atual %s, Enter mantem]: %s", CYAN, dinheiroTexto(p->imposto_percent, v), RESET);
+        lerLinha(buf, sizeof(buf));
+        if (buf[0] != '\0') p->imposto_percent = lerValor(buf);
+    }
+
+    char v[DINHEIRO_TAM];
+    printf("%sTaxa cartao [atual %s, Enter mantem]: %s", CYAN, dinheiroTexto(p->taxa_cartao_percent, v), RESET);
+    lerLinha(buf, sizeof(buf));
+    if (buf[0] != '\0') p->taxa_cartao_percent = lerValor(buf);
+
+    printf("%sLucro produtor [atual %s, Enter mantem]: %s", CYAN, dinheiroTexto(p->lucro_produtor_percent, v), RESET);
+    lerLinha(buf, sizeof(buf));
+    if (buf[0] != '\0') p->lucro_produtor_percent = lerValor(buf);
+
+    /* validar e recalcular */
+    validarPercentuaisProduto(p);
+
+    /* confirma sobre o estado mais recente: se outro usuário alterou ou
+       excluiu o produto (ou tomou o nome novo) durante a edição, quem
+       confirmou primeiro vence e esta edição é descartada */
+    if (!catalogoTravar(cat)) {
+        imprimir_erro("Nao foi possivel acessar o catalogo. Edicao descartada.");
+        pausar();
+        return;
+    }
+    idx = catalogoBuscarNome(cat, nome_antigo);
+    struct Produto atual;
+    if (idx >= 0) catalogoObter(cat, idx, &atual);
+    int dono = catalogoBuscarNome(cat, p->nome);
+    if (idx < 0 || !produtoMesmaEntrada(&atual, &original) || (dono >= 0 && dono != idx)) {
+        catalogoDestravar();
+        imprimir_erro("Outro usuario alterou este produto durante a edicao. Edicao descartada.");
+        pausar();
+        return;
+    }
+    calcularTudo(p);
+    if (!catalogoGravar(cat, idx, p)) {
+        catalogoDestravar();
+        imprimir_erro("Memoria insuficiente para atualizar o produto!");
+        pausar();
+        return;
+    }
+    if (!diarioRegistrar(cat, LOG_ATUALIZAR, idx) || !diarioConfirmar(cat))
+        imprimir_aviso("Falha ao salvar apos edicao.");
+
+    /* a receita acompanha o nome; some se o produto deixou de ser receita */
+    int receita_mudou = strcmp(nome_antigo, p->nome) != 0 && receitaRenomear(nome_antigo, p->nome);
+    if (p->modo != 2) receita_mudou |= receitaRemover(p->nome);
+    else if (qtd_itens >= 0) receita_mudou |= receitaDefinir(p->nome, itens, qtd_itens);
+    if (receita_mudou && !salvarIngredientesAtomic())
+        imprimir_aviso("Falha ao salvar a tabela de ingredientes.");
+    /* receitas que usam este produto como sub-receita acompanham o custo */
+    int dependentes = produtoPropagar(cat, idx);
+    if (dependentes < 0) {
+        imprimir_aviso("Falha ao salvar as receitas que usam este produto.");
+    } else if (dependentes > 0) {
+        snprintf(buf, sizeof(buf), "%d receita(s) que usam este produto recalculada(s).", dependentes);
+        imprimir_sucesso(buf);
+    }
+    catalogoDestravar();
+
+    imprimir_sucesso("Produto atualizado e recalculado!");
+    pausar();
+}
+
+/* ----- Excluir produto ----- */
+void excluirProdutoIndex(struct Catalogo *cat, int idx) {
+    if (!catalogoValido(cat, idx)) {
+        imprimir_erro("Indice invalido para exclusao.");
+        return;
+    }
+    /* quem usava o produto como sub-receita fica com o último custo dele */
+    int g = ingredienteDoProduto(cat->nome[idx]);
+    if (g >= 0) ingredientes.itens[g].tipo = INGR_POR_UNIDADE;
+    if ((receitaRemover(cat->nome[idx]) || g >= 0) && !salvarIngredientesAtomic())
+        imprimir_aviso("Falha ao salvar a tabela de ingredientes.");
+    catalogoRemover(cat, idx);
+}
+
+/* exclui, sob a trava, o produto que ainda tiver esse nome; 0 se outro
+   usuário já o excluiu, -1 se não foi possível gravar */
+static int excluirProdutoConfirmar(struct Catalogo *cat, const char *nome) {
+    if (!catalogoTravar(cat)) return -1;
+    int idx = catalogoBuscarNome(cat, nome);
+    int r = 0;
+    if (idx >= 0) {
+        excluirProdutoIndex(cat, idx);
+        r = diarioRegistrar(cat, LOG_EXCLUIR, idx) && diarioConfirmar(cat) ? 1 : -1;
+    }
+    catalogoDestravar();
+    return r;
+}
+
+void excluirProduto(struct Catalogo *cat) {
+    if (catalogoVivos(cat) == 0) {
+        imprimir_aviso("Nenhum produto para excluir.");
+        pausar();
+        return;
+    }
+
+    char buf[BUF_SIZE];
+    int idx = escolherProduto(cat, "EXCLUIR");
+
+    if (!catalogoValido(cat, idx)) {
+        imprimir_erro("Numero invalido!");
+        pausar();
+        return;
+    }
+
+    char nome[MAX_NOME];
+    snprintf(nome, sizeof(nome), "%s", cat->nome[idx]);
+    printf("%s%sTem certeza? (s/n): %s", BOLD, RED, RESET);
+    lerLinha(buf, sizeof(buf));
+    if (buf[0] != 's' && buf[0] != 'S') {
+        printf("Operacao cancelada.\n");
+        pausar();
+        return;
+    }
+
+    int r = excluirProdutoConfirmar(cat, nome);
+    if (r == 0) {
+        imprimir_aviso("O produto ja tinha sido excluido por outro usuario.");
+        pausar();
+        return;
+    }
+    if (r < 0) imprimir_aviso("Falha ao salvar apos exclusao.");
+
+    imprimir_sucesso("Produto excluido!");
+    pausar();
+}
+
+/* ----- Cálculo rápido ----- */
+void calculoRapido() {
+    imprimir_cabecalho("CALCULO RAPIDO");
+
+    char buf[BUF_SIZE];
+    struct Produto p;
+    memset(&p, 0, sizeof(p));
+
+    printf("%sModo (1=custo direto | 2=receita): %s", CYAN, RESET);
+    lerLinha(buf, sizeof(buf));
+    p.modo = atoi(buf);
+    if (p.modo != 1 && p.modo != 2) p.modo = 1;
+
+    if (p.modo == 1) {
+        printf("%sPreco de custo/un (R$): %s", CYAN, RESET);
+        lerLinha(buf, sizeof(buf));
+        p.preco_custo = lerValor(buf);
+    } else {
+        struct ItemReceita itens[MAX_INGR];
+        int n;
+        double c = coletarIngredientes(NULL, NULL, itens, &n, p.ingredientes_desc, sizeof(p.ingredientes_desc),
+                                       &p.rendimento);
+        if (c < 0.0) return;
+        p.investimento_total = c;
+        printf("%sDespesas variaveis (R$) [Enter=0]: %s", CYAN, RESET);
+        lerLinha(buf, sizeof(buf));
+        if (buf[0] != '\0') p.despesas_variaveis = lerValor(buf);
+    }
+
+    printf("%sUsar MEI comercio (4%%)? (s/n): %s", CYAN, RESET);
+    lerLinha(buf, sizeof(buf));
+    if (buf[0] == 's' || buf[0] == 'S') {
+        p.usar_mei_comercio = 1;
+        p.imposto_percent = 4.0;
+    } else {
+        printf("%sImposto (%%): %s", CYAN, RESET);
+        lerLinha(buf, sizeof(buf));
+        p.imposto_percent = lerValor(buf);
+    }
+
+    printf("%sTaxa cartao (%%): %s", CYAN, RESET);
+    lerLinha(buf, sizeof(buf));
+    p.taxa_cartao_percent = lerValor(buf);
+
+    printf("%sLucro desejado (%%): %s", CYAN, RESET);
+    lerLinha(buf, sizeof(buf));
+    p.lucro_produtor_percent = lerValor(buf);
+
+    validarPercentuaisProduto(&p);
+    calcularTudo(&p);
+
+    imprimir_secao("RESULTADO");
+    imprimir_valor("Custo unitario (com rateio)", p.custo_unitario);
+    char v[DINHEIRO_TAM];
+    printf("%s%s> PRECO FINAL SUGERIDO: R$ %s%s\n", BOLD, GREEN, dinheiroTexto(p.preco_produtor, v), RESET);
+
+    pausar();
+}
+
+/* ----- Menu curto após cadastro ----- */
+void menuPosCadastro(struct Catalogo *cat, int idxRecente) {
+    char buf[BUF_SIZE];
+    int opc = 0;
+    /* o índice pode mudar se outro usuário consolidar o arquivo: o produto
+       é reencontrado pelo nome */
+    char nome[MAX_NOME];
+    snprintf(nome, sizeof(nome), "%s", catalogoValido(cat, idxRecente) ? cat->nome[idxRecente] : "");
+    while (1) {
+        imprimir_secao("O QUE DESEJA FAZER AGORA?");
+        printf("%s1%s - Salvar agora\n", GREEN, RESET);
+        printf("%s2%s - Editar este produto\n", GREEN, RESET);
+        printf("%s3%s - Excluir este produto\n", GREEN, RESET);
+        printf("%s4%s - Listar produtos\n", GREEN, RESET);
+        printf("%s5%s - Voltar ao menu principal\n", YELLOW, RESET);
+
+        printf("\n%sOpcao: %s", BOLD, RESET);
+        lerLinha(buf, sizeof(buf));
+        opc = atoi(buf);
+
+        if (opc == 1) {
+            /* o cadastro já foi para o log; aqui só confirma pendências */
+            int ok = catalogoTravar(cat);
+            if (ok) {
+                ok = diarioConfirmar(cat);
+                catalogoDestravar();
+            }
+            if (ok)
+                imprimir_sucesso("Produtos salvos!");
+            else
+                imprimir_erro("Falha ao salvar!");
+            pausar();
+        } else if (opc == 2) {
+            if (catalogoBuscarNome(cat, nome) >= 0) {
+                editarProduto(cat);
+            } else {
+                imprimir_erro("Indice do produto invalido para edicao.");
+                pausar();
+            }
+            break;
+        } else if (opc == 3) {
+            if (catalogoBuscarNome(cat, nome) >= 0) {
+                printf("%s%sTem certeza que deseja excluir o produto criado? (s/n): %s", BOLD, RED, RESET);
+                lerLinha(buf, sizeof(buf));
+                if (buf[0] == 's' || buf[0] == 'S') {
+                    int r = excluirProdutoConfirmar(cat, nome);
+                    if (r < 0) imprimir_aviso("Falha ao salvar apos exclusao.");
+                    if (r == 0) imprimir_aviso("O produto ja tinha sido excluido por outro usuario.");
+                    else imprimir_sucesso("Produto excluido!");
+                } else {
+                    printf("Operacao cancelada.\n");
+                }
+                pausar();
+            } else {
+                imprimir_erro("Indice do produto invalido para exclusao.");
+                pausar();
+            }
+            break;
+        } else if (opc == 4) {
+            listarProdutos(cat);
+        } else if (opc == 5) {
+            break;
+        } else {
+            imprimir_erro("Opcao invalida!");
+            pausar();
+        }
+    }
+}
+
+/* ----- Cadastro de produto ----- */
+void cadastrarProduto(struct Catalogo *cat) {
+    imprimir_cabecalho("CADASTRAR NOVO PRODUTO");
+
+    char buf[BUF_SIZE];
+    struct Produto p;
+    memset(&p, 0, sizeof(p));
+    struct ItemReceita itens[MAX_INGR];
+    int qtd_itens = 0;
+
+    printf("\n%sNome do produto: %s", CYAN, RESET);
+    lerLinha(buf, sizeof(buf));
+    if (buf[0] == '\0') {
+        imprimir_aviso("Nome vazio — atribuindo nome padrao.");
+        /* o primeiro "Produto N" livre */
+        for (int n = catalogoVivos(cat) + 1; ; n++) {
+            snprintf(p.nome, sizeof(p.nome), "Produto %d", n);
+            if (catalogoBuscarNome(cat, p.nome) < 0) break;
+        }
+    } else {
+        if (catalogoBuscarNome(cat, buf) >= 0) {
+            imprimir_erro("Ja existe um produto com esse nome. Cadastro cancelado.");
+            pausar();
+            return;
+        }
+        strncpy(p.nome, buf, sizeof(p.nome)-1);
+        p.nome[sizeof(p.nome)-1] = '\0';
+    }
+
+    printf("%sModo (1=custo direto/unidade | 2=receita com ingredientes): %s", CYAN, RESET);
+    lerLinha(buf, sizeof(buf));
+    p.modo = atoi(buf);
+    if (p.modo != 1 && p.modo != 2) p.modo = 1;
+
+    if (p.modo == 1) {
+        printf("%sPreco de custo por unidade (R$): %s", CYAN, RESET);
+        lerLinha(buf, sizeof(buf));
+        p.preco_custo = lerValor(buf);
+    } else {
+        imprimir_secao("INGREDIENTES DA RECEITA");
+        double custoCalc = coletarIngredientes(cat, p.nome, itens, &qtd_itens, p.ingredientes_desc,
+                                               sizeof(p.ingredientes_desc), &p.rendimento);
+        if (custoCalc < 0.0) {
+            imprimir_erro("Erro na insercao de ingredientes. Cadastro cancelado.");
+            pausar();
+            return;
+        }
+        p.investimento_total = custoCalc;
+
+        printf("\n%sDespesas variaveis (embalagem, entrega etc.) - R$ [Enter=0]: %s", CYAN, RESET);
+        lerLinha(buf, sizeof(buf));
+        if (buf[0] != '\0') p.despesas_variaveis = lerValor(buf);
+        else p.despesas_variaveis = 0.0;
+    }
+
+    imprimir_secao("CONFIGURACOES FINANCEIRAS");
+
+    printf("%sUsar regime MEI COMERCIO (imposto 4%%)? (s/n): %s", CYAN, RESET);
+    lerLinha(buf, sizeof(buf));
+    if (buf[0] == 's' || buf[0] == 'S') {
+        p.usar_mei_comercio = 1;
+        p.imposto_percent = 4.0;
+        printf("%s✓ MEI Comercio aplicado (4%%)%s\n", GREEN, RESET);
+    } else {
+        p.usar_mei_comercio = 0;
+        printf("%sPercentual de imposto (%%): %s", CYAN, RESET);
+        lerLinha(buf, sizeof(buf));
+        p.imposto_percent = lerValor(buf);
+    }
+
+    printf("%sTaxa da maquininha/cartao (%%) [ex: 2.5]: %s", CYAN, RESET);
+    lerLinha(buf, sizeof(buf));
+    p.taxa_cartao_percent = lerValor(buf);
+
+    printf("%sPercentual de lucro desejado (%%): %s", CYAN, RESET);
+    lerLinha(buf, sizeof(buf));
+    p.lucro_produtor_percent = lerValor(buf);
+
+    /* valida percentuais antes de calcular */
+    validarPercentuaisProduto(&p);
+
+    /* confirma sob a trava, sobre o estado mais recente: outro usuário pode
+       ter cadastrado o mesmo nome enquanto este digitava */
+    if (!catalogoTravar(cat)) {
+        imprimir_erro("Nao foi possivel acessar o catalogo. Cadastro cancelado.");
+        pausar();
+        return;
+    }
+    if (catalogoBuscarNome(cat, p.nome) >= 0) {
+        catalogoDestravar();
+        imprimir_erro("Outro usuario cadastrou um produto com esse nome. Cadastro cancelado.");
+        pausar();
+        return;
+    }
+
+    calcularTudo(&p);
+
+    /* garantir nome terminado e seguro já foi feito */
+    int idxRecente = catalogoAdicionar(cat, &p);
+    if (idxRecente < 0) {
+        catalogoDestravar();
+        imprimir_erro("Memoria insuficiente para cadastrar o produto!");
+        pausar();
+        return;
+    }
+
+    /* registra no log de alterações (uma escrita, sem regravar o arquivo) */
+    if (!diarioRegistrar(cat, LOG_INSERIR, idxRecente) || !diarioConfirmar(cat)) {
+        imprimir_aviso("Falha ao salvar arquivo (produto ficou em memoria)");
+    }
+    if (p.modo == 2 && (!receitaDefinir(p.nome, itens, qtd_itens) || !salvarIngredientesAtomic()))
+        imprimir_aviso("Falha ao salvar a receita na tabela de ingredientes.");
+    catalogoDestravar();
+
+    imprimir_secao("RESULTADO DO CADASTRO");
+    imprimir_sucesso("Produto cadastrado com sucesso!");
+    imprimir_valor("Custo unitario (com rateio)", p.custo_unitario);
+    imprimir_valor("PRECO FINAL AO CLIENTE", p.preco_produtor);
+
+    /* menu curto pós-cadastro */
+    menuPosCadastro(cat, idxRecente);
+}
+
+/* ----- Modo lote (linha de comando) ----- */
+/* Sem prompts, cores nem pausas: erros vão para stderr e o código de saída
+   diz o resultado (0 ok, 1 uso, 2 E/S, 3 linhas inválidas) */
+#define LOTE_BUF_ES (1 << 20)
+
+static void usoLote(void) {
+    fprintf(stderr,
+            "uso: SIPRI price --in produtos.csv --out precificados.csv\n"
+            "     SIPRI import --in fornecedor.csv\n"
+            "     SIPRI export [--format csv|jsonl|colunar] --out produtos.csv\n"
+            "     SIPRI reprice-all\n"
+            "     SIPRI ingredient-prices --in fornecedor.csv\n"
+            "     SIPRI serve [--socket sipri.sock]\n"
+            "     SIPRI bench [--socket sipri.sock] [--conexoes 8] [--requisicoes 200000]\n"
+            "                 [--pipeline 16] [--nome produto]\n"
+            "\n"
+            "price        precifica cada linha do CSV (cabecalho com os nomes dos\n"
+            "             campos: modo, preco_custo, investimento_total, rendimento,\n"
+            "             despesas_variaveis, usar_mei_comercio, imposto_percent,\n"
+            "             taxa_cartao_percent, lucro_produtor_percent; os demais sao\n"
+            "             copiados) e acrescenta custo_unitario e preco_produtor.\n"
+            "             '-' e a entrada/saida padrao.\n"
+            "import       acrescenta ao produtos.dat os produtos de um CSV/TSV\n"
+            "             (colunas nome, ingredientes e as de preco acima),\n"
+            "             validados e precificados; nomes ja cadastrados ficam de fora.\n"
+            "export       grava o catalogo precificado com a config atual em CSV\n"
+            "             (as colunas do import), JSON Lines ou colunar binario.\n"
+            "reprice-all  recalcula todos os produtos de produtos.dat com a config\n"
+            "             atual e regrava o arquivo.\n"
+            "ingredient-prices\n"
+            "             aplica a lista de precos (colunas nome e preco) a tabela\n"
+            "             de ingredientes e recalcula so as receitas afetadas.\n"
+            "serve        mantem o catalogo em memoria e atende pelo socket Unix\n"
+            "             (uma linha por requisicao, campos separados por TAB):\n"
+            "             PRECO nome | CALCULO campo=valor... |\n"
+            "             GRAVAR nome campo=valor... | EXCLUIR nome |\n"
+            "             INGREDIENTE nome preco | FAIXA preco|custo|margem min max\n"
+            "             [limite] | LISTAR | PING. Responde OK ou ERRO, na ordem;\n"
+            "             varias requisicoes podem ir sem esperar resposta. FAIXA e\n"
+            "             LISTAR respondem OK n e n linhas nome, custo, preco.\n"
+            "bench        gerador de carga para o serve: cada conexao mantem\n"
+            "             --pipeline requisicoes em voo (PRECO do --nome, ou um\n"
+            "             CALCULO); mostra requisicoes/s e latencias p50/p99.\n"
+            "\n"
+            "--threads N  trabalhadores de import/reprice-all/export (0 = sem\n"
+            "             threads; padrao: um por processador) e fatias do serve\n"
+            "             (cada uma com sua thread e sua parte do catalogo).\n"
+            "--deterministic  sem roubo de trabalho entre as threads: cada uma\n"
+            "             faz sempre o mesmo trecho. A saida e igual de qualquer\n"
+            "             jeito; serve para medir e depurar de forma repetivel.\n");
+}
+
+/* separa uma linha CSV em campos, no lugar (aspas duplas com "" de escape);
+   retorna quantos campos */
+static int csvSeparar(char *linha, char **campos, int max) {
+    int n = 0;
+    char *p = linha;
+    while (n < max) {
+        char *dst = p;
+        campos[n++] = p;
+        if (*p == '"') {
+            const char *src = p + 1;
+            while (*src) {
+                if (*src == '"' && src[1] == '"') { *dst++ = '"'; src += 2; }
+                else if (*src == '"') { src++; break; }
+                else *dst++ = *src++;
+            }
+            p = (char *)src;
+        }
+        while (*p && *p != ',') *dst++ = *p++;
+        int fim = *p == '\0';
+        *dst = '\0';
+        if (fim) break;
+        p++;
+    }
+    return n;
+}
+
+/* qual coluna de preço o campo do cabeçalho alimenta (-1: só é copiado).
+   custo_unitario e preco_produtor são calculados, nunca lidos */
+enum {
+#define X(tipo, campo) LOTE_COL_##campo,
+    COLUNAS_PRECO(X)
+#undef X
+    LOTE_NUM_COLUNAS
+};
+
+static int loteColuna(const char *nome) {
+#define X(tipo, campo) \
+    if (strcmp(nome, #campo) == 0) \
+        return LOTE_COL_##campo == LOTE_COL_custo_unitario || \
+               LOTE_COL_##campo == LOTE_COL_preco_produtor ? -1 : LOTE_COL_##campo;
+    COLUNAS_PRECO(X)
+#undef X
+    return -1;
+}
+
+/* um lote de linhas de entrada: o texto original (copiado para a saída) e
+   as colunas numéricas que vão para o kernel em lote */
+struct LoteCsv {
+    char *texto;
+    size_t usado;
+    size_t capacidade;
+    size_t fim[LOTE_REGISTROS];     /* fim da linha i em texto */
+    int qtd;
+};
+
+static int loteGuardarLinha(struct LoteCsv *l, const char *linha, size_t len) {
+    if (l->usado + len + 1 > l->capacidade) {
+        size_t cap = l->capacidade ? l->capacidade * 2 : 64 * 1024;
+        while (cap < l->usado + len + 1) cap *= 2;
+        char *novo = realloc(l->texto, cap);
+        if (!novo) return 0;
+        l->texto = novo;
+        l->capacidade = cap;
+    }
+    memcpy(l->texto + l->usado, linha, len);
+    l->usado += len;
+    l->fim[l->qtd++] = l->usado;
+    return 1;
+}
+
+/* precifica o lote e escreve cada linha original + os dois valores */
+static int loteEscrever(struct LoteCsv *l, struct ColunasPreco *c, FILE *out, int *ajustes) {
+    *ajustes += calcularLote(c, 0, l->qtd, rateioDespesasFixas());
+    size_t ini = 0;
+    for (int i = 0; i < l->qtd; i++) {
+        char valores[2 * DINHEIRO_TAM + 3], *d = valores;
+        *d++ = ',';
+        d += dinheiroFormatar(c->custo_unitario[i], d);
+        *d++ = ',';
+        d += dinheiroFormatar(c->preco_produtor[i], d);
+        *d++ = '\n';
+        fwrite(l->texto + ini, 1, l->fim[i] - ini, out);
+        fwrite(valores, 1, (size_t)(d - valores), out);
+        ini = l->fim[i];
+    }
+    l->qtd = 0;
+    l->usado = 0;
+    return !ferror(out);
+}
+
+static int comandoPrice(const char *arq_in, const char *arq_out) {
+    FILE *in = strcmp(arq_in, "-") == 0 ? stdin : fopen(arq_in, "rb");
+    if (!in) {
+        fprintf(stderr, "SIPRI: nao foi possivel abrir %s: %s\n", arq_in, strerror(errno));
+        return 2;
+    }
+    FILE *out = strcmp(arq_out, "-") == 0 ? stdout : fopen(arq_out, "wb");
+    if (!out) {
+        fprintf(stderr, "SIPRI: nao foi possivel criar %s: %s\n", arq_out, strerror(errno));
+        if (in != stdin) fclose(in);
+        return 2;
+    }
+    setvbuf(in, NULL, _IOFBF, LOTE_BUF_ES);
+    setvbuf(out, NULL, _IOFBF, LOTE_BUF_ES);
+
+    /* colunas do lote: um vetor estático por campo de preço */
+#define X(tipo, campo) static tipo lote_##campo[LOTE_REGISTROS];
+    COLUNAS_PRECO(X)
+#undef X
+    struct ColunasPreco c = {
+#define X(tipo, campo) lote_##campo,
+        COLUNAS_PRECO(X)
+#undef X
+    };
+    struct LoteCsv lote = { NULL, 0, 0, { 0 }, 0 };
+    static char linha[BUF_SIZE * 8], copia[BUF_SIZE * 8];
+    char *campos[64];
+    int mapa[64];
+    int num_campos = 0;
+    long linhas = 0, invalidas = 0, produtos = 0;
+    int ajustes = 0, codigo = 0;
+
+    while (fgets(linha, sizeof(linha), in)) {
+        linhas++;
+        size_t len = strcspn(linha, "\r\n");
+        if (linha[len] == '\0' && !feof(in)) {
+            fprintf(stderr, "SIPRI: linha %ld longa demais\n", linhas);
+            codigo = 3;
+            break;
+        }
+        linha[len] = '\0';
+        if (len == 0) continue;
+
+        memcpy(copia, linha, len + 1);
+        if (num_campos == 0) {
+            /* cabeçalho: saída ganha as duas colunas calculadas */
+            num_campos = csvSeparar(copia, campos, 64);
+            for (int k = 0; k < num_campos; k++) mapa[k] = loteColuna(campos[k]);
+            fprintf(out, "%s,custo_unitario,preco_produtor\n", linha);
+            continue;
+        }
+
+        int i = lote.qtd;
+#define X(tipo, campo) c.campo[i] = 0;
+        COLUNAS_PRECO(X)
+#undef X
+        c.modo[i] = 1;
+        int n = csvSeparar(copia, campos, 64), ok = 1;
+        for (int k = 0; k < n && k < num_campos && ok; k++) {
+            if (mapa[k] < 0 || campos[k][0] == '\0') continue;
+            double v;
+            ok = numeroLer(campos[k], campos[k] + strlen(campos[k]), &v) && valorNaFaixa(v);
+            switch (mapa[k]) {
+#define X(tipo, campo) case LOTE_COL_##campo: c.campo[i] = (tipo)v; break;
+                COLUNAS_PRECO(X)
+#undef X
+            }
+        }
+        if (!ok) {
+            fprintf(stderr, "SIPRI: linha %ld ignorada (numero invalido ou fora da faixa)\n", linhas);
+            invalidas++;
+            continue;
+        }
+        if (!loteGuardarLinha(&lote, linha, len)) {
+            fprintf(stderr, "SIPRI: memoria insuficiente\n");
+            codigo = 2;
+            break;
+        }
+        produtos++;
+        if (lote.qtd == LOTE_REGISTROS && !loteEscrever(&lote, &c, out, &ajustes)) {
+            codigo = 2;
+            break;
+        }
+    }
+    if (codigo == 0 && lote.qtd > 0 && !loteEscrever(&lote, &c, out, &ajustes)) codigo = 2;
+    if (codigo == 0 && ferror(in)) codigo = 2;
+    free(lote.texto);
+    if (in != stdin) fclose(in);
+    if (fflush(out) != 0 || ferror(out)) codigo = 2;
+    if (out != stdout && fclose(out) != 0) codigo = 2;
+    if (codigo == 2) fprintf(stderr, "SIPRI: erro de leitura/escrita\n");
+
+    fprintf(stderr, "%ld produto(s) precificado(s)", produtos);
+    if (ajustes) fprintf(stderr, ", %d com percentuais ajustados", ajustes);
+    if (invalidas) fprintf(stderr, ", %ld linha(s) invalida(s)", invalidas);
+    fprintf(stderr, "\n");
+    if (codigo == 0 && invalidas) codigo = 3;
+    return codigo;
+}
+
+/* campo de um registro CSV: aponta para o arquivo mapeado, sem cópia */
+struct CampoCsv {
+    const char *ini;
+    const char *fim;
+    int aspas;          /* entre aspas: "" dentro dele vale uma aspa */
+};
+
+/* separa o registro que começa em p (até fim) em campos; aspas podem conter
+   separador e quebra de linha. Retorna o início do próximo registro e soma
+   em *linhas as quebras de linha consumidas */
+static const char *csvRegistro(const char *p, const char *fim, char sep,
+                               struct CampoCsv *campos, int max, int *n, long *linhas) {
+    *n = 0;
+    for (;;) {
+        struct CampoCsv c = { p, p, 0 };
+        if (p < fim && *p == '"') {
+            c.aspas = 1;
+            c.ini = ++p;
+            for (;;) {
+                const char *q = memchr(p, '"', (size_t)(fim - p));
+                if (!q) q = fim;
+                for (const char *k = p; k < q; k++) *linhas += *k == '\n';
+                p = q;
+                if (p + 1 < fim && p[1] == '"') { p += 2; continue; }
+                break;
+            }
+            c.fim = p;
+            if (p < fim) p++;
+            while (p < fim && *p != sep && *p != '\n') p++;
+        } else {
+            while (p < fim && *p != sep && *p != '\n') p++;
+            c.fim = p;
+            if (c.fim > c.ini && c.fim[-1] == '\r') c.fim--;
+        }
+        if (*n < max) campos[(*n)++] = c;
+        if (p >= fim) return p;
+        if (*p++ == '\n') {
+            (*linhas)++;
+            return p;
+        }
+    }
+}
+
+/* copia o texto do campo para dst (no máximo max-1 bytes, terminado em
+   '\0'), desfazendo o escape das aspas; retorna o tamanho copiado */
+static size_t csvCopiar(const struct CampoCsv *c, char *dst, size_t max) {
+    size_t n = 0;
+    for (const char *k = c->ini; k < c->fim && n + 1 < max; k++) {
+        dst[n++] = *k;
+        if (c->aspas && *k == '"' && k + 1 < c->fim && k[1] == '"') k++;
+    }
+    dst[n] = '\0';
+    return n;
+}
+
+/* colunas do arquivo de importação além das de preço */
+enum { IMPORTA_NOME = LOTE_NUM_COLUNAS, IMPORTA_INGREDIENTES };
+
+static int importaColuna(const char *nome) {
+    if (strcmp(nome, "nome") == 0) return IMPORTA_NOME;
+    if (strcmp(nome, "ingredientes") == 0 || strcmp(nome, "ingredientes_desc") == 0)
+        return IMPORTA_INGREDIENTES;
+    return loteColuna(nome);
+}
+
+/* resultado de uma linha importada */
+enum { LINHA_OK, LINHA_SEM_NOME, LINHA_NUMERO_INVALIDO };
+
+struct Importacao {
+    const char *p;              /* leitor: o que falta dividir em tarefas */
+    const char *fim;
+    long linha;
+    char sep;
+    int num_campos;
+    int mapa[64];
+    double rateio;
+    struct Catalogo *cat;
+    int anexar;
+    long importados;
+    long invalidas;
+    long duplicados;
+    int ajustes;
+    int sem_memoria;
+};
+
+/* leitor: separa até ESTEIRA_LOTE registros inteiros. Linhas sem aspas são
+   achadas com memchr; só as que têm aspas passam pelo separador completo
+   (uma quebra de linha entre aspas não encerra o registro) */
+static int importacaoPreparar(struct TarefaLote *t, void *ctx) {
+    struct Importacao *imp = ctx;
+    if (imp->p >= imp->fim) return 0;
+    const char *p = imp->p;
+    long linhas = 0;
+    struct CampoCsv campos[64];
+    for (int n = 0; n < ESTEIRA_LOTE && p < imp->fim; n++) {
+        const char *nl = memchr(p, '\n', (size_t)(imp->fim - p));
+        if (!nl) nl = imp->fim;
+        if (!memchr(p, '"', (size_t)(nl - p))) {
+            p = nl < imp->fim ? nl + 1 : nl;
+            linhas += nl < imp->fim;
+        } else {
+            int qtd;
+            p = csvRegistro(p, imp->fim, imp->sep, campos, 64, &qtd, &linhas);
+        }
+    }
+    t->ini = imp->p;
+    t->fim = p;
+    t->linha = imp->linha;
+    imp->p = p;
+    imp->linha += linhas;
+    return 1;
+}
+
+/* regras do cadastro sobre campos que vieram prontos (sem prompts): modo
+   fora de 1/2 vira custo direto, MEI fixa o imposto e os percentuais são
+   ajustados. Retorna 1 se algum percentual foi ajustado */
+static int importaNormalizar(struct Produto *prod) {
+    if (prod->modo != 1 && prod->modo != 2) prod->modo = 1;
+    if (prod->usar_mei_comercio) {
+        prod->usar_mei_comercio = 1;
+        prod->imposto_percent = 4.0;
+    }
+    return ajustarPercentuais(&prod->imposto_percent, &prod->taxa_cartao_percent,
+                              &prod->lucro_produtor_percent);
+}
+
+/* valida uma linha com as regras do cadastro e monta o produto */
+static int importacaoLinha(const struct Importacao *imp, const struct CampoCsv *campos, int n,
+                           struct Produto *prod, int *ajustes) {
+    prod->modo = 1;
+    for (int k = 0; k < n && k < imp->num_campos; k++) {
+        const struct CampoCsv *c = &campos[k];
+        if (imp->mapa[k] == IMPORTA_NOME) {
+            char nome[sizeof(prod->nome)];
+            csvCopiar(c, nome, sizeof(nome));
+            /* espaços nas pontas saem, como na digitação */
+            char *a = nome, *b = nome + strlen(nome);
+            while (*a == ' ' || *a == '\t') a++;
+            while (b > a && (b[-1] == ' ' || b[-1] == '\t')) b--;
+            *b = '\0';
+            memcpy(prod->nome, a, (size_t)(b - a) + 1);
+            continue;
+        }
+        if (imp->mapa[k] == IMPORTA_INGREDIENTES) {
+            csvCopiar(c, prod->ingredientes_desc, sizeof(prod->ingredientes_desc));
+            continue;
+        }
+        if (imp->mapa[k] < 0 || c->ini == c->fim) continue;
+        double v;
+        int ok = numeroLer(c->ini, c->fim, &v) && valorNaFaixa(v);
+        switch (imp->mapa[k]) {
+#define X(tipo, campo) case LOTE_COL_##campo: \
+            ok = ok && (tipo)v == v; \
+            prod->campo = (tipo)v; \
+            break;
+            COLUNAS_PRECO(X)
+#undef X
+        }
+        if (!ok) return LINHA_NUMERO_INVALIDO;
+    }
+    if (prod->nome[0] == '\0') return LINHA_SEM_NOME;
+    *ajustes += importaNormalizar(prod);
+    return LINHA_OK;
+}
+
+/* trabalhador: separa, valida, precifica (kernel em lote, nas colunas da
+   pilha) e sela os registros da tarefa */
+static void importacaoProcessar(struct TarefaLote *t, void *ctx) {
+    const struct Importacao *imp = ctx;
+    struct CampoCsv campos[64];
+    const char *p = t->ini;
+    long linha = t->linha, linhas = 0;
+    while (p < t->fim) {
+        linha += linhas;
+        linhas = 0;
+        long linha_registro = linha;
+        int n;
+        p = csvRegistro(p, t->fim, imp->sep, campos, 64, &n, &linhas);
+        if (n == 1 && campos[0].ini == campos[0].fim) continue;    /* linha em branco */
+        int j = t->qtd++;
+        memset(&t->reg[j], 0, sizeof(t->reg[j]));
+        t->linha_reg[j] = linha_registro;
+        t->estado[j] = (unsigned char)importacaoLinha(imp, campos, n, &t->reg[j].produto, &t->ajustes);
+    }
+
+#define X(tipo, campo) tipo campo[ESTEIRA_LOTE];
+    struct { COLUNAS_PRECO(X) } col;
+#undef X
+    struct ColunasPreco c = {
+#define X(tipo, campo) col.campo,
+        COLUNAS_PRECO(X)
+#undef X
+    };
+    int pos[ESTEIRA_LOTE], k = 0;
+    for (int j = 0; j < t->qtd; j++) {
+        if (t->estado[j] != LINHA_OK) continue;
+#define X(tipo, campo) col.campo[k] = t->reg[j].produto.campo;
+        COLUNAS_PRECO(X)
+#undef X
+        pos[k++] = j;
+    }
+    t->ajustes += calcularLote(&c, 0, k, imp->rateio);
+    for (int i = 0; i < k; i++) {
+        struct RegistroProduto *r = &t->reg[pos[i]];
+#define X(tipo, campo) r->produto.campo = col.campo[i];
+        COLUNAS_PRECO(X)
+#undef X
+        selarRegistro(r);
+    }
+}
+
+/* gravador: em ordem, recusa nomes repetidos, põe os produtos no catálogo
+   (sempre no fim) e anexa os registros aceitos ao base num pwrite só */
+static int importacaoConsumir(struct TarefaLote *t, void *ctx) {
+    struct Importacao *imp = ctx;
+    struct Catalogo *cat = imp->cat;
+    int primeiro = cat->qtd, k = 0;
+    imp->ajustes += t->ajustes;
+    for (int j = 0; j < t->qtd; j++) {
+        struct RegistroProduto *r = &t->reg[j];
+        if (t->estado[j] != LINHA_OK) {
+            fprintf(stderr, "SIPRI: linha %ld ignorada (%s)\n", t->linha_reg[j],
+                    t->estado[j] == LINHA_SEM_NOME ? "sem nome" : "numero invalido ou fora da faixa");
+            imp->invalidas++;
+            continue;
+        }
+        if (catalogoBuscarNome(cat, r->produto.nome) >= 0) {
+            fprintf(stderr, "SIPRI: linha %ld ignorada (produto \"%s\" ja existe)\n",
+                    t->linha_reg[j], r->produto.nome);
+            imp->duplicados++;
+            continue;
+        }
+        int idx = catalogoInserirEm(cat, cat->qtd, &r->produto);
+        if (idx < 0) {
+            imp->sem_memoria = 1;
+            return 0;
+        }
+        cat->versao_preco[idx] = config_versao;
+        if (k != j) memcpy(&t->reg[k], r, sizeof(*r));
+        k++;
+    }
+    imp->importados += k;
+    if (imp->anexar && !baseAnexarRegistros(t->reg, k, primeiro)) imp->anexar = 0;
+    return 1;
+}
+
+/* SIPRI import: mapeia o CSV/TSV do fornecedor e passa pela esteira: o
+   leitor divide o arquivo em trechos de linhas inteiras, os trabalhadores
+   validam com as regras do cadastro, precificam e selam os registros, e o
+   gravador acrescenta os produtos no fim de produtos.dat na ordem do
+   arquivo. Nomes já cadastrados (ou repetidos no arquivo) são recusados */
+/* mapeia o arquivo de entrada inteiro (*dados NULL se vazio); 0 em erro,
+   já relatado */
+static int entradaAbrir(const char *arq_in, const char **dados, size_t *tamanho, int *no_heap) {
+    int fd = open(arq_in, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "SIPRI: nao foi possivel abrir %s: %s\n", arq_in, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    *tamanho = (size_t)st.st_size;
+    *dados = NULL;
+    *no_heap = 0;
+    if (*tamanho > 0) {
+        void *m = mmap(NULL, *tamanho, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m != MAP_FAILED) {
+            madvise(m, *tamanho, MADV_SEQUENTIAL);
+            *dados = m;
+        } else {
+            /* sem mmap (pipe, sistema de arquivos exótico): lê para o heap */
+            char *buf = malloc(*tamanho);
+            if (!buf || pread(fd, buf, *tamanho, 0) != (ssize_t)*tamanho) {
+                fprintf(stderr, "SIPRI: erro ao ler %s\n", arq_in);
+                free(buf);
+                close(fd);
+                return 0;
+            }
+            *dados = buf;
+            *no_heap = 1;
+        }
+    }
+    close(fd);
+    return 1;
+}
+
+static void entradaFechar(const char *dados, size_t tamanho, int no_heap) {
+    if (no_heap) free((void *)dados);
+    else if (dados) munmap((void *)dados, tamanho);
+}
+
+/* separador pelo cabeçalho: tab (TSV), ';' (planilha em português) ou ',' */
+static char csvDetectarSeparador(const char *p, const char *fim) {
+    const char *fim_cab = memchr(p, '\n', (size_t)(fim - p));
+    if (!fim_cab) fim_cab = fim;
+    return memchr(p, '\t', (size_t)(fim_cab - p)) ? '\t'
+         : memchr(p, ';', (size_t)(fim_cab - p)) ? ';' : ',';
+}
+
+static int comandoImport(const char *arq_in) {
+    const char *dados;
+    size_t tamanho;
+    int no_heap;
+    if (!entradaAbrir(arq_in, &dados, &tamanho, &no_heap)) return 2;
+
+    /* a importação inteira é uma confirmação só: segura a trava do começo
+       (catálogo no estado mais recente) ao fim */
+    struct Catalogo cat;
+    catalogoIniciar(&cat);
+    if (!catalogoTravar(&cat)) {
+        fprintf(stderr, "SIPRI: nao foi possivel carregar %s\n", ARQ_PRODUTOS);
+        entradaFechar(dados, tamanho, no_heap);
+        catalogoLiberar(&cat);
+        return 2;
+    }
+
+    static struct Importacao imp;
+    memset(&imp, 0, sizeof(imp));
+    imp.p = dados;
+    imp.fim = dados + tamanho;
+    imp.cat = &cat;
+    imp.rateio = rateioDespesasFixas();
+    if (tamanho >= 3 && memcmp(imp.p, "\xEF\xBB\xBF", 3) == 0) imp.p += 3;   /* BOM UTF-8 */
+
+    imp.sep = csvDetectarSeparador(imp.p, imp.fim);
+
+    struct CampoCsv campos[64];
+    int tem_nome = 0;
+    long linhas = 0;
+    imp.p = csvRegistro(imp.p, imp.fim, imp.sep, campos, 64, &imp.num_campos, &linhas);
+    imp.linha = 1 + linhas;
+    for (int k = 0; k < imp.num_campos; k++) {
+        char nome[64];
+        csvCopiar(&campos[k], nome, sizeof(nome));
+        textoNormalizar(nome, nome, sizeof(nome));
+        imp.mapa[k] = importaColuna(nome);
+        tem_nome |= imp.mapa[k] == IMPORTA_NOME;
+    }
+    int codigo = 0;
+    if (!tem_nome) {
+        fprintf(stderr, "SIPRI: cabecalho de %s sem a coluna nome\n", arq_in);
+        codigo = 3;
+    }
+
+    /* uma linha por produto, no máximo: reserva tudo de uma vez */
+    long estimadas = 0;
+    for (const char *q = imp.p; q < imp.fim && (q = memchr(q, '\n', (size_t)(imp.fim - q))); q++) estimadas++;
+    if (codigo == 0 && !catalogoReservar(&cat, cat.qtd + (int)(estimadas < 0x7fffffff - cat.qtd ? estimadas + 1 : 0))) {
+        fprintf(stderr, "SIPRI: memoria insuficiente\n");
+        codigo = 2;
+    }
+
+    /* produtos entram sempre no fim (lápides não são reaproveitadas), direto
+       no base enquanto ele aceitar anexar */
+    int qtd_inicial = cat.qtd;
+    imp.anexar = baseAnexavel(&cat);
+    if (codigo == 0) {
+        static struct Esteira esteira;
+        esteira.preparar = importacaoPreparar;
+        esteira.processar = importacaoProcessar;
+        esteira.consumir = importacaoConsumir;
+        esteira.ctx = &imp;
+        if (!esteiraExecutar(&esteira) || imp.sem_memoria) {
+            fprintf(stderr, "SIPRI: memoria insuficiente\n");
+            codigo = 2;
+        }
+    }
+    entradaFechar(dados, tamanho, no_heap);
+
+    if (codigo == 0 && cat.qtd > qtd_inicial) {
+        /* a troca do cabeçalho efetiva a importação; base que não aceitou
+           anexar (log pendente, escrita falhou) é regravado por inteiro */
+        int gravou = imp.anexar && baseAnexarConfirmar(cat.qtd);
+        if (!gravou && !salvarProdutosAtomic(&cat)) {
+            fprintf(stderr, "SIPRI: falha ao gravar %s\n", ARQ_PRODUTOS);
+            codigo = 2;
+        }
+    }
+    catalogoDestravar();
+    catalogoLiberar(&cat);
+
+    fprintf(stderr, "%ld produto(s) importado(s)", codigo == 2 ? 0 : imp.importados);
+    if (imp.ajustes) fprintf(stderr, ", %d com percentuais ajustados", imp.ajustes);
+    if (imp.duplicados) fprintf(stderr, ", %ld ja existente(s)", imp.duplicados);
+    if (imp.invalidas) fprintf(stderr, ", %ld linha(s) invalida(s)", imp.invalidas);
+    fprintf(stderr, "\n");
+    if (codigo == 0 && (imp.invalidas || imp.duplicados)) codigo = 3;
+    return codigo;
+}
+
+/* lista de preços do fornecedor (colunas nome ou ingrediente, e preco):
+   aplica os preços que mudaram e recalcula numa propagação só as receitas
+   afetadas, inclusive as que usam essas como sub-receita. Nomes fora da
+   tabela de ingredientes são contados e ignorados */
+static int comandoIngredientPrices(const char *arq_in) {
+    const char *dados;
+    size_t tamanho;
+    int no_heap;
+    if (!entradaAbrir(arq_in, &dados, &tamanho, &no_heap)) return 2;
+    catalogoSincronizar(NULL);
+
+    const char *p = dados, *fim = dados + tamanho;
+    if (tamanho >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0) p += 3;    /* BOM UTF-8 */
+    char sep = csvDetectarSeparador(p, fim);
+    struct CampoCsv campos[64];
+    int n, col_nome = -1, col_preco = -1;
+    long linhas = 0;
+    p = csvRegistro(p, fim, sep, campos, 64, &n, &linhas);
+    for (int k = 0; k < n; k++) {
+        char nome[64];
+        csvCopiar(&campos[k], nome, sizeof(nome));
+        textoNormalizar(nome, nome, sizeof(nome));
+        if (strcmp(nome, "nome") == 0 || strcmp(nome, "ingrediente") == 0) col_nome = k;
+        else if (strcmp(nome, "preco") == 0) col_preco = k;
+    }
+    if (col_nome < 0 || col_preco < 0) {
+        fprintf(stderr, "SIPRI: cabecalho de %s sem as colunas nome e preco\n", arq_in);
+        entradaFechar(dados, tamanho, no_heap);
+        return 3;
+    }
+
+    int *ids = malloc(((size_t)ingredientes.qtd + 1) * sizeof(int));
+    double *precos = malloc(((size_t)ingredientes.qtd + 1) * sizeof(double));
+    int *posicao = malloc(((size_t)ingredientes.qtd + 1) * sizeof(int));   /* em ids, ou -1 */
+    if (!ids || !precos || !posicao) {
+        fprintf(stderr, "SIPRI: memoria insuficiente\n");
+        free(ids);
+        free(precos);
+        free(posicao);
+        entradaFechar(dados, tamanho, no_heap);
+        return 2;
+    }
+    for (int g = 0; g < ingredientes.qtd; g++) posicao[g] = -1;
+    int alterados = 0;
+    long desconhecidos = 0, invalidas = 0, linha = 1 + linhas;
+    while (p < fim) {
+        long lidas = 0;
+        p = csvRegistro(p, fim, sep, campos, 64, &n, &lidas);
+        linha += lidas;
+        if (n == 1 && campos[0].fim == campos[0].ini) continue;     /* linha em branco */
+        char nome[MAX_NOME], valor[DINHEIRO_TAM];
+        double preco;
+        if (n <= col_nome || n <= col_preco) {
+            fprintf(stderr, "SIPRI: %s:%ld: colunas faltando\n", arq_in, linha - lidas);
+            invalidas++;
+            continue;
+        }
+        csvCopiar(&campos[col_nome], nome, sizeof(nome));
+        csvCopiar(&campos[col_preco], valor, sizeof(valor));
+        int g = ingredienteBuscar(nome);
+        if (g < 0) {
+            desconhecidos++;
+            continue;
+        }
+        if (!dinheiroLer(valor, &preco) || preco < 0.0 || ingredientes.itens[g].tipo == INGR_PRODUTO) {
+            fprintf(stderr, "SIPRI: %s:%ld: preco invalido para %s\n", arq_in, linha - lidas, nome);
+            invalidas++;
+            continue;
+        }
+        /* o mesmo ingrediente repetido: vale a última linha */
+        if (posicao[g] < 0) {
+            posicao[g] = alterados;
+            ids[alterados++] = g;
+        }
+        precos[posicao[g]] = preco;
+    }
+    entradaFechar(dados, tamanho, no_heap);
+
+    /* só o que mudou de fato (na tabela relida sob a trava; os ids não
+       mudam) entra na propagação, que só carrega o catálogo se precisar */
+    int codigo = 0, recalculadas = 0, mudaram = 0;
+    if (alterados > 0 && !catalogoTravar(NULL)) {
+        fprintf(stderr, "SIPRI: nao foi possivel travar %s\n", ARQ_PRODUTOS_LCK);
+        codigo = 2;
+    } else if (alterados > 0) {
+        for (int k = 0; k < alterados; k++) {
+            if (precos[k] == ingredientes.itens[ids[k]].preco) continue;
+            ids[mudaram] = ids[k];
+            precos[mudaram++] = precos[k];
+        }
+        struct Catalogo cat;
+        catalogoIniciar(&cat);
+        if (mudaram > 0 && !catalogoTravar(&cat)) {
+            fprintf(stderr, "SIPRI: nao foi possivel carregar %s\n", ARQ_PRODUTOS);
+            codigo = 2;
+        } else if (mudaram > 0) {
+            recalculadas = ingredientesAlterarPrecos(&cat, ids, precos, mudaram);
+            if (recalculadas < 0) {
+                fprintf(stderr, "SIPRI: falha ao gravar os precos novos\n");
+                codigo = 2;
+            }
+            catalogoDestravar();
+        }
+        catalogoDestravar();
+        catalogoLiberar(&cat);
+    }
+    free(ids);
+    free(precos);
+    free(posicao);
+
+    if (codigo != 2) {
+        fprintf(stderr, "%d ingrediente(s) com preco novo, %d receita(s) recalculada(s)", mudaram, recalculadas);
+        if (desconhecidos) fprintf(stderr, ", %ld fora da tabela", desconhecidos);
+        if (invalidas) fprintf(stderr, ", %ld linha(s) invalida(s)", invalidas);
+        fprintf(stderr, "\n");
+        if (invalidas) codigo = 3;
+    }
+    return codigo;
+}
+
+/* ----- Exportação ----- */
+/* O export lê produtos.dat mapeado, registro a registro, sem montar o
+   catálogo: só um lote de LOTE_REGISTROS produtos por vez, reprecificado
+   com a config atual. Alterações que ainda estão no log entram por cima
+   (as últimas de cada slot, ordenadas por índice). A saída é formatada à
+   mão num buffer grande e vai para o disco com write, sem printf */
+#define EXPORTA_BUF (1 << 20)
+
+struct SobreposicaoLog {
+    int idx;
+    int ordem;                  /* posição no log: a última do slot vale */
+    unsigned tipo;
+    const struct Produto *produto;
+};
+
+struct LeitorBase {
+    const char *mapa;
+    size_t tamanho;
+    int no_heap;
+    int fd;                     /* o base mapeado, para reler um registro */
+    int formato;
+    struct CabecalhoProdutos cab;
+    long long qtd;              /* registros no base */
+    long long total;            /* slots, com as inserções que só estão no log */
+    long long proximo;
+    long long corrompidos;      /* checksum inválido mesmo relido: fora */
+    char *log;
+    struct SobreposicaoLog *sob;
+    int qtd_sob;
+    int pos_sob;
+    struct Produto lote[LOTE_REGISTROS];    /* registros convertidos ou do log */
+};
+
+static int sobreposicaoComparar(const void *a, const void *b) {
+    const struct SobreposicaoLog *x = a, *y = b;
+    if (x->idx != y->idx) return x->idx < y->idx ? -1 : 1;
+    return x->ordem < y->ordem ? -1 : x->ordem > y->ordem;
+}
+
+/* lê as entradas válidas do log amarrado a este base (mesmo critério do
+   replay) e fica só com a última de cada slot */
+static int leitorCarregarLog(struct LeitorBase *lb, unsigned long long base_ino, long long limite) {
+    int fd = open(ARQ_PRODUTOS_WAL, O_RDONLY);
+    if (fd < 0) return 1;
+    struct stat st;
+    struct CabecalhoDiario cab;
+    if (fstat(fd, &st) != 0 || st.st_size <= (off_t)sizeof(cab) ||
+        !lerTudo(fd, &cab, sizeof(cab)) || memcmp(cab.magic, DIARIO_MAGIC, sizeof(cab.magic)) != 0 ||
+        cab.base_ino != base_ino) {
+        close(fd);
+        return 1;
+    }
+    size_t n = (size_t)st.st_size - sizeof(cab);
+    if (limite >= (long long)sizeof(cab) && (size_t)limite - sizeof(cab) < n) n = (size_t)limite - sizeof(cab);
+    lb->log = malloc(n);
+    int max = (int)(n / sizeof(struct EntradaDiario));
+    lb->sob = malloc((size_t)(max ? max : 1) * sizeof(*lb->sob));
+    if (!lb->log || !lb->sob || !lerTudo(fd, lb->log, n)) {
+        close(fd);
+        return 0;
+    }
+    close(fd);
+
+    static struct Produto vazio;
+    size_t pos = 0;
+    while (pos + sizeof(struct EntradaDiario) <= n) {
+        struct EntradaDiario e;
+        memcpy(&e, lb->log + pos, sizeof(e));
+        if (e.tamanho != 0 && e.tamanho != sizeof(struct Produto)) break;
+        if (pos + sizeof(e) + e.tamanho > n) break;
+        const struct Produto *p = e.tamanho ? (const struct Produto *)(lb->log + pos + sizeof(e)) : &vazio;
+        if (crcEntrada(&e, p) != e.crc || e.idx < 0) break;
+        struct SobreposicaoLog *o = &lb->sob[lb->qtd_sob];
+        o->idx = e.idx;
+        o->ordem = lb->qtd_sob++;
+        o->tipo = e.tipo;
+        o->produto = p;
+        if (e.tipo == LOG_INSERIR && e.idx >= lb->total) lb->total = e.idx + 1LL;
+        pos += sizeof(e) + e.tamanho;
+    }
+    qsort(lb->sob, (size_t)lb->qtd_sob, sizeof(*lb->sob), sobreposicaoComparar);
+    int k = 0;
+    for (int i = 0; i < lb->qtd_sob; i++) {
+        if (k > 0 && lb->sob[k - 1].idx == lb->sob[i].idx) lb->sob[k - 1] = lb->sob[i];
+        else lb->sob[k++] = lb->sob[i];
+    }
+    lb->qtd_sob = k;
+    return 1;
+}
+
+static void leitorFechar(struct LeitorBase *lb) {
+    if (lb->no_heap) free((void *)lb->mapa);
+    else if (lb->mapa) munmap((void *)lb->mapa, lb->tamanho);
+    if (lb->fd >= 0) close(lb->fd);
+    free(lb->log);
+    free(lb->sob);
+    lb->fd = -1;
+    lb->mapa = NULL;
+    lb->log = NULL;
+    lb->sob = NULL;
+}
+
+/* abre o último estado publicado sem travar: o base cujo inode está em
+   produtos.lck e o log só até o tamanho publicado (um confirmar que ainda
+   está sendo gravado fica de fora). Se o base for trocado entre ler o
+   estado e abrir o arquivo, tenta de novo */
+static int leitorAbrir(struct LeitorBase *lb) {
+    memset(lb, 0, sizeof(*lb));
+    lb->fd = -1;
+    struct EstadoCompartilhado e;
+    struct stat st;
+    int fd = -1;
+    for (int t = 0; t < SINCRONIZAR_TENTATIVAS; t++) {
+        if (!estadoLer(&e)) memset(&e, 0, sizeof(e));
+        fd = open(ARQ_PRODUTOS, O_RDONLY);
+        if (fd < 0) return 0;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return 0;
+        }
+        if (e.geracao == 0 || (unsigned long long)st.st_ino == e.base_ino) break;
+        close(fd);
+        fd = -1;
+        sched_yield();
+    }
+    /* sem estado que bata: lê o log inteiro, como antes de haver produtos.lck */
+    long long limite = fd >= 0 && e.geracao != 0 ? e.log_tamanho : -1;
+    if (fd < 0) {
+        fd = open(ARQ_PRODUTOS, O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            if (fd >= 0) close(fd);
+            return 0;
+        }
+    }
+    lb->tamanho = (size_t)st.st_size;
+    if (lb->tamanho > 0) {
+        void *m = mmap(NULL, lb->tamanho, PROT_READ, MAP_SHARED, fd, 0);
+        if (m != MAP_FAILED) {
+            madvise(m, lb->tamanho, MADV_SEQUENTIAL);
+            lb->mapa = m;
+        } else {
+            char *buf = malloc(lb->tamanho);
+            if (!buf || pread(fd, buf, lb->tamanho, 0) != (ssize_t)lb->tamanho) {
+                free(buf);
+                close(fd);
+                return 0;
+            }
+            lb->mapa = buf;
+            lb->no_heap = 1;
+        }
+    }
+    lb->fd = fd;
+    lb->formato = formatoBase(lb->mapa, lb->tamanho, &lb->cab);
+    if (lb->formato == FORMATO_DESCONHECIDO) {
+        leitorFechar(lb);
+        return 0;
+    }
+    long long cabem = lb->tamanho > lb->cab.tam_cabecalho
+                    ? (long long)(lb->tamanho - lb->cab.tam_cabecalho) / (long long)lb->cab.tam_registro : 0;
+    lb->qtd = (long long)lb->cab.qtd < cabem ? (long long)lb->cab.qtd : cabem;
+    lb->total = lb->qtd;
+    if (!leitorCarregarLog(lb, (unsigned long long)st.st_ino, limite)) {
+        leitorFechar(lb);
+        return 0;
+    }
+    return 1;
+}
+
+/* relê o registro i do base sob a trava de leitura (nenhum gravador no
+   meio) e confere o crc de novo. Quem já tem a trava de gravação não pede
+   outra: o fcntl trocaria a dele pela de leitura */
+static int leitorReler(struct LeitorBase *lb, long long i, struct RegistroProduto *r) {
+    int travar = compartilhado.travado == 0 && compartilhamentoAbrir();
+    if (travar && !travaGravacao(F_RDLCK)) return 0;
+    off_t off = (off_t)lb->cab.tam_cabecalho + (off_t)i * (off_t)sizeof(*r);
+    int ok = pread(lb->fd, r, sizeof(*r), off) == (ssize_t)sizeof(*r) &&
+             r->selo == REGISTRO_SELO && registroValido(r);
+    if (travar) travaGravacao(F_UNLCK);
+    return ok;
+}
+
+/* próximo lote de produtos vivos (lápides e exclusões do log ficam de
+   fora); no formato atual aponta direto para o arquivo mapeado, senão para
+   a cópia em copias[] (LOTE_REGISTROS lugares). Registro com crc errado que
+   o log não cobre não sai: o que vem do mapa só vale se fechar o crc */
+static int leitorLote(struct LeitorBase *lb, const struct Produto **ps, long long *idxs,
+                      struct Produto *copias) {
+    int n = 0;
+    while (n < LOTE_REGISTROS && lb->proximo < lb->total) {
+        long long i = lb->proximo++;
+        while (lb->pos_sob < lb->qtd_sob && lb->sob[lb->pos_sob].idx < i) lb->pos_sob++;
+        if (lb->pos_sob < lb->qtd_sob && lb->sob[lb->pos_sob].idx == i) {
+            const struct SobreposicaoLog *o = &lb->sob[lb->pos_sob];
+            if (o->tipo == LOG_EXCLUIR) continue;
+            memcpy(&copias[n], o->produto, sizeof(copias[n]));
+            ps[n] = &copias[n];
+        } else if (i >= lb->qtd) {
+            continue;
+        } else if (lb->formato == FORMATO_ATUAL) {
+            const struct RegistroProduto *r =
+                (const struct RegistroProduto *)(lb->mapa + lb->cab.tam_cabecalho) + i;
+            if (r->selo != REGISTRO_SELO && r->selo != REGISTRO_LAPIDE) {
+                lb->corrompidos++;
+                continue;
+            }
+            if (!registroValido(r)) {
+                /* bytes misturados ou estragados de fato: lê de novo, inteiro */
+                struct RegistroProduto relido;
+                if (!leitorReler(lb, i, &relido)) {
+                    lb->corrompidos++;
+                    continue;
+                }
+                memcpy(&copias[n], &relido.produto, sizeof(copias[n]));
+                ps[n] = &copias[n];
+            } else if (r->selo != REGISTRO_SELO) {
+                continue;
+            } else {
+                ps[n] = &r->produto;
+            }
+        } else {
+            if (lb->formato == FORMATO_CAMPOS || lb->formato == FORMATO_SELADO) {
+                /* layout antigo nunca é regravado no lugar: crc errado é dano */
+                const char *r = lb->mapa + lb->cab.tam_cabecalho + i * (long long)lb->cab.tam_registro;
+                if (!registroValidoEm(r, lb->cab.offset_selo, lb->cab.offset_crc)) {
+                    unsigned selo;
+                    memcpy(&selo, r + lb->cab.offset_selo, sizeof(selo));
+                    if (selo != REGISTRO_LAPIDE) lb->corrompidos++;
+                    continue;
+                }
+            }
+            registroConverter(lb->mapa, lb->formato, &lb->cab, i, &copias[n]);
+            ps[n] = &copias[n];
+        }
+        idxs[n++] = i;
+    }
+    return n;
+}
+
+/* saída bufferizada direto no descritor; com fd < 0 fica só em memória,
+   e o buffer cresce em vez de ser descarregado */
+struct SaidaExporta {
+    int fd;
+    int erro;
+    size_t usado;
+    char *buf;
+    size_t capacidade;
+};
+
+static void saidaDescarregar(struct SaidaExporta *s) {
+    if (!s->erro && s->usado && !escreverTudo(s->fd, s->buf, s->usado)) s->erro = 1;
+    s->usado = 0;
+}
+
+/* garante espaço para n bytes (nunca mais que a capacidade inicial) e
+   devolve onde escrever. Em memória, sem como crescer, o que já estava é
+   descartado e fica o erro */
+static char *saidaReservar(struct SaidaExporta *s, size_t n) {
+    if (s->usado + n <= s->capacidade) return s->buf + s->usado;
+    if (s->fd >= 0) {
+        saidaDescarregar(s);
+        return s->buf;
+    }
+    size_t cap = s->capacidade * 2;
+    while (cap < s->usado + n) cap *= 2;
+    char *novo = realloc(s->buf, cap);
+    if (!novo) {
+        s->erro = 1;
+        s->usado = 0;
+        return s->buf;
+    }
+    s->buf = novo;
+    s->capacidade = cap;
+    return s->buf + s->usado;
+}
+
+static void saidaTexto(struct SaidaExporta *s, const char *t, size_t n) {
+    if (s->fd >= 0 && n > s->capacidade / 2) {
+        saidaDescarregar(s);
+        if (!s->erro && !escreverTudo(s->fd, t, n)) s->erro = 1;
+        return;
+    }
+    memcpy(saidaReservar(s, n), t, n);
+    s->usado += n;
+}
+
+/* campo de texto CSV: entre aspas só quando precisa */
+static void saidaCsvTexto(struct SaidaExporta *s, const char *t, size_t n) {
+    size_t especiais = 0;
+    for (size_t i = 0; i < n; i++)
+        especiais += t[i] == ',' || t[i] == '"' || t[i] == '\n' || t[i] == '\r';
+    if (!especiais) {
+        saidaTexto(s, t, n);
+        return;
+    }
+    char *d = saidaReservar(s, 2 * n + 2), *ini = d;
+    *d++ = '"';
+    for (size_t i = 0; i < n; i++) {
+        if (t[i] == '"') *d++ = '"';
+        *d++ = t[i];
+    }
+    *d++ = '"';
+    s->usado += (size_t)(d - ini);
+}
+
+static void saidaJsonTexto(struct SaidaExporta *s, const char *t, size_t n) {
+    static const char hex[] = "0123456789abcdef";
+    char *d = saidaReservar(s, 6 * n + 2), *ini = d;
+    *d++ = '"';
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)t[i];
+        if (c == '"' || c == '\\') {
+            *d++ = '\\';
+            *d++ = (char)c;
+        } else if (c == '\n') {
+            *d++ = '\\';
+            *d++ = 'n';
+        } else if (c < 0x20) {
+            memcpy(d, "\\u00", 4);
+            d[4] = hex[c >> 4];
+            d[5] = hex[c & 15];
+            d += 6;
+        } else {
+            *d++ = (char)c;
+        }
+    }
+    *d++ = '"';
+    s->usado += (size_t)(d - ini);
+}
+
+enum { EXPORTA_CSV, EXPORTA_JSONL, EXPORTA_COLUNAS };
+
+/* valores digitados saem com o mínimo de casas que volta ao mesmo double
+   (export -> import sem perda); os calculados, em reais com duas casas */
+static size_t exportaInteiro(int v, int calculado, char *dst) {
+    (void)calculado;
+    return formatarInteiro(v, dst);
+}
+
+static size_t exportaReal(double v, int calculado, char *dst) {
+    return calculado ? dinheiroFormatar(v, dst) : numeroFormatarCurto(v, dst);
+}
+
+/* uma linha por produto; números formatados à mão */
+static void exportarLinha(struct SaidaExporta *s, int formato, long long idx,
+                          const struct Produto *p, const struct ColunasPreco *c, int i) {
+    size_t nome_len = strnlen(p->nome, sizeof(p->nome));
+    size_t desc_len = strnlen(p->ingredientes_desc, sizeof(p->ingredientes_desc));
+    int json = formato == EXPORTA_JSONL;
+    if (json) {
+        saidaTexto(s, "{\"id\":", 6);
+        char *d = saidaReservar(s, 24);
+        s->usado += formatarInteiro(idx, d);
+        saidaTexto(s, ",\"nome\":", 8);
+        saidaJsonTexto(s, p->nome, nome_len);
+    } else {
+        saidaCsvTexto(s, p->nome, nome_len);
+    }
+    /* os números cabem folgados em 48 bytes cada */
+    char *d = saidaReservar(s, 48 * 11 + 256), *ini = d;
+#define X(tipo, campo) \
+    if (json) { \
+        memcpy(d, ",\"" #campo "\":", sizeof(#campo) + 3); \
+        d += sizeof(#campo) + 3; \
+    } else { \
+        *d++ = ','; \
+    } \
+    d += _Generic(c->campo[i], int: exportaInteiro, default: exportaReal) \
+        (c->campo[i], LOTE_COL_##campo == LOTE_COL_custo_unitario || \
+                      LOTE_COL_##campo == LOTE_COL_preco_produtor, d);
+    COLUNAS_PRECO(X)
+#undef X
+    s->usado += (size_t)(d - ini);
+    if (json) {
+        saidaTexto(s, ",\"ingredientes\":", 16);
+        saidaJsonTexto(s, p->ingredientes_desc, desc_len);
+        saidaTexto(s, "}\n", 2);
+    } else {
+        saidaTexto(s, ",", 1);
+        saidaCsvTexto(s, p->ingredientes_desc, desc_len);
+        saidaTexto(s, "\n", 1);
+    }
+}
+
+/* Formato colunar: cabeçalho, descritores e cada coluna contígua no
+   arquivo (tudo na ordem de bytes de quem gravou, marcada em ordem). Texto
+   é (qtd + 1) deslocamentos de 64 bits seguidos dos bytes, sem '\0' */
+#define COLUNAR_MAGIC "SIPRICOL"
+#define COLUNAR_VERSAO 1
+#define COLUNAR_BUF (1 << 16)
+
+enum { COLUNA_INT64 = 1, COLUNA_INT32, COLUNA_FLOAT64, COLUNA_TEXTO };
+
+struct CabecalhoColunar {
+    char magic[8];
+    unsigned ordem;
+    unsigned versao;
+    unsigned long long qtd;
+    unsigned num_colunas;
+    unsigned reservado;
+};
+
+struct DescritorColuna {
+    char nome[24];
+    unsigned tipo;
+    unsigned reservado;
+    unsigned long long offset;
+    unsigned long long tamanho;
+};
+
+/* id, as colunas de preço e os dois textos (deslocamentos + bytes) */
+enum {
+    COLUNAR_ID,
+#define X(tipo, campo) COLUNAR_##campo,
+    COLUNAS_PRECO(X)
+#undef X
+    COLUNAR_NOME,
+    COLUNAR_INGREDIENTES,
+    COLUNAR_NUM,
+    COLUNAR_NOME_BYTES = COLUNAR_NUM,
+    COLUNAR_INGREDIENTES_BYTES,
+    COLUNAR_NUM_BUFFERS
+};
+
+/* buffer de uma região do arquivo colunar, descarregado com pwrite */
+struct RegiaoColunar {
+    off_t pos;
+    size_t usado;
+    char buf[COLUNAR_BUF];
+};
+
+static int regiaoDescarregar(int fd, struct RegiaoColunar *r) {
+    ssize_t n = r->usado ? pwrite(fd, r->buf, r->usado, r->pos) : 0;
+    if (n != (ssize_t)r->usado) return 0;
+    r->pos += (off_t)r->usado;
+    r->usado = 0;
+    return 1;
+}
+
+static int regiaoAcrescentar(int fd, struct RegiaoColunar *r, const void *dados, size_t n) {
+    const char *p = dados;
+    while (n > 0) {
+        if (r->usado == COLUNAR_BUF && !regiaoDescarregar(fd, r)) return 0;
+        size_t k = COLUNAR_BUF - r->usado < n ? COLUNAR_BUF - r->usado : n;
+        memcpy(r->buf + r->usado, p, k);
+        r->usado += k;
+        p += k;
+        n -= k;
+    }
+    return 1;
+}
+
+/* CSV e JSON Lines em rodadas de até EXPORTA_RODADA lotes: o leitor
+   enche os lotes em sequência, o executor paralelo reprecifica e formata
+   cada lote no buffer dele e a thread que chamou escreve os buffers na
+   ordem dos lotes, então o arquivo sai igual ao feito em série */
+#define EXPORTA_RODADA 32
+#define EXPORTA_LOTE_BUF (1 << 16)
+
+struct LoteExporta {
+    int n;
+    const struct Produto *ps[LOTE_REGISTROS];
+    long long idxs[LOTE_REGISTROS];
+    struct Produto copias[LOTE_REGISTROS];  /* o leitor já seguiu adiante */
+    struct SaidaExporta s;                  /* em memória */
+};
+
+struct ExportaTexto {
+    int formato;
+    double rateio;
+    struct LoteExporta *lotes;
+    struct SaidaExporta *saida;
+};
+
+static void exportaFormatar(int ini, int fim, int w, void *ctx) {
+    (void)w;
+    struct ExportaTexto *e = ctx;
+#define X(tipo, campo) tipo col_##campo[LOTE_REGISTROS];
+    COLUNAS_PRECO(X)
+#undef X
+    struct ColunasPreco c = {
+#define X(tipo, campo) col_##campo,
+        COLUNAS_PRECO(X)
+#undef X
+    };
+    for (int k = ini; k < fim; k++) {
+        struct LoteExporta *l = &e->lotes[k];
+        for (int i = 0; i < l->n; i++) {
+#define X(tipo, campo) c.campo[i] = l->ps[i]->campo;
+            COLUNAS_PRECO(X)
+#undef X
+        }
+        calcularLote(&c, 0, l->n, e->rateio);
+        l->s.usado = 0;
+        for (int i = 0; i < l->n; i++) exportarLinha(&l->s, e->formato, l->idxs[i], l->ps[i], &c, i);
+    }
+}
+
+static void exportaJuntar(int k, void *ctx) {
+    struct ExportaTexto *e = ctx;
+    struct SaidaExporta *s = &e->lotes[k].s;
+    if (s->erro) e->saida->erro = 1;
+    saidaTexto(e->saida, s->buf, s->usado);
+}
+
+/* SIPRI export: CSV (mesmas colunas que o import aceita), JSON Lines ou
+   colunar. Memória constante: uma rodada de lotes e os buffers de saída */
+static int comandoExport(int formato, const char *arq_out) {
+    static struct LeitorBase lb;
+    if (!leitorAbrir(&lb)) {
+        fprintf(stderr, "SIPRI: nao foi possivel ler %s\n", ARQ_PRODUTOS);
+        return 2;
+    }
+    if (formato == EXPORTA_COLUNAS && strcmp(arq_out, "-") == 0) {
+        fprintf(stderr, "SIPRI: o formato colunar precisa de um arquivo de saida\n");
+        leitorFechar(&lb);
+        return 1;
+    }
+    int fd = strcmp(arq_out, "-") == 0 ? STDOUT_FILENO : open(arq_out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "SIPRI: nao foi possivel criar %s: %s\n", arq_out, strerror(errno));
+        leitorFechar(&lb);
+        return 2;
+    }
+
+#define X(tipo, campo) static tipo lote_##campo[LOTE_REGISTROS];
+    COLUNAS_PRECO(X)
+#undef X
+    struct ColunasPreco c = {
+#define X(tipo, campo) lote_##campo,
+        COLUNAS_PRECO(X)
+#undef X
+    };
+    static const struct Produto *ps[LOTE_REGISTROS];
+    static long long idxs[LOTE_REGISTROS];
+    double rateio = rateioDespesasFixas();
+    long long exportados = 0;
+    int ok = 1, n;
+
+    if (formato != EXPORTA_COLUNAS) {
+        struct SaidaExporta s = { fd, 0, 0, malloc(EXPORTA_BUF), EXPORTA_BUF };
+        struct LoteExporta *lotes = calloc(EXPORTA_RODADA, sizeof(*lotes));
+        ok = s.buf != NULL && lotes != NULL;
+        for (int k = 0; ok && k < EXPORTA_RODADA; k++) {
+            struct SaidaExporta vazia = { -1, 0, 0, malloc(EXPORTA_LOTE_BUF), EXPORTA_LOTE_BUF };
+            lotes[k].s = vazia;
+            ok = lotes[k].s.buf != NULL;
+        }
+        struct ExportaTexto e = { formato, rateio, lotes, &s };
+        if (ok && formato == EXPORTA_CSV) {
+            saidaTexto(&s, "nome", 4);
+#define X(tipo, campo) saidaTexto(&s, "," #campo, sizeof(#campo));
+            COLUNAS_PRECO(X)
+#undef X
+            saidaTexto(&s, ",ingredientes\n", 14);
+        }
+        while (ok && !s.erro) {
+            int qtd = 0;
+            while (qtd < EXPORTA_RODADA &&
+                   (lotes[qtd].n = leitorLote(&lb, lotes[qtd].ps, lotes[qtd].idxs, lotes[qtd].copias)) > 0)
+                exportados += lotes[qtd++].n;
+            if (qtd == 0) break;
+            struct Paralelo p = { exportaFormatar, exportaJuntar, &e, qtd, 1 };
+            paraleloExecutar(&p);
+        }
+        if (ok) saidaDescarregar(&s);
+        ok = ok && !s.erro;
+        for (int k = 0; lotes && k < EXPORTA_RODADA; k++) free(lotes[k].s.buf);
+        free(lotes);
+        free(s.buf);
+    } else {
+        /* primeira passada só conta produtos e bytes de texto: com isso a
+           posição de cada coluna no arquivo já é conhecida */
+        unsigned long long qtd = 0, bytes_nome = 0, bytes_desc = 0;
+        while ((n = leitorLote(&lb, ps, idxs, lb.lote)) > 0) {
+            for (int i = 0; i < n; i++) {
+                bytes_nome += strnlen(ps[i]->nome, sizeof(ps[i]->nome));
+                bytes_desc += strnlen(ps[i]->ingredientes_desc, sizeof(ps[i]->ingredientes_desc));
+            }
+            qtd += (unsigned long long)n;
+        }
+        lb.proximo = 0;
+        lb.pos_sob = 0;
+        lb.corrompidos = 0;
+
+        struct CabecalhoColunar cab;
+        struct DescritorColuna desc[COLUNAR_NUM];
+        memset(&cab, 0, sizeof(cab));
+        memset(desc, 0, sizeof(desc));
+        memcpy(cab.magic, COLUNAR_MAGIC, sizeof(cab.magic));
+        cab.ordem = FORMATO_ORDEM;
+        cab.versao = COLUNAR_VERSAO;
+        cab.qtd = qtd;
+        cab.num_colunas = COLUNAR_NUM;
+        strcpy(desc[COLUNAR_ID].nome, "id");
+        desc[COLUNAR_ID].tipo = COLUNA_INT64;
+        desc[COLUNAR_ID].tamanho = qtd * 8;
+#define X(t, campo) \
+        strcpy(desc[COLUNAR_##campo].nome, #campo); \
+        desc[COLUNAR_##campo].tipo = sizeof(t) == 8 ? COLUNA_FLOAT64 : COLUNA_INT32; \
+        desc[COLUNAR_##campo].tamanho = qtd * sizeof(t);
+        COLUNAS_PRECO(X)
+#undef X
+        strcpy(desc[COLUNAR_NOME].nome, "nome");
+        desc[COLUNAR_NOME].tipo = COLUNA_TEXTO;
+        desc[COLUNAR_NOME].tamanho = (qtd + 1) * 8 + bytes_nome;
+        strcpy(desc[COLUNAR_INGREDIENTES].nome, "ingredientes");
+        desc[COLUNAR_INGREDIENTES].tipo = COLUNA_TEXTO;
+        desc[COLUNAR_INGREDIENTES].tamanho = (qtd + 1) * 8 + bytes_desc;
+
+        /* colunas alinhadas em 64 bytes, uma depois da outra */
+        struct RegiaoColunar *reg = malloc(COLUNAR_NUM_BUFFERS * sizeof(*reg));
+        unsigned long long pos = sizeof(cab) + sizeof(desc);
+        for (int k = 0; k < COLUNAR_NUM; k++) {
+            pos = (pos + FORMATO_ALINHAMENTO - 1) / FORMATO_ALINHAMENTO * FORMATO_ALINHAMENTO;
+            desc[k].offset = pos;
+            pos += desc[k].tamanho;
+        }
+        ok = reg != NULL;
+        for (int k = 0; ok && k < COLUNAR_NUM_BUFFERS; k++) {
+            reg[k].usado = 0;
+            reg[k].pos = (off_t)(k < COLUNAR_NUM ? desc[k].offset
+                       : desc[k - COLUNAR_NUM + COLUNAR_NOME].offset + (qtd + 1) * 8);
+        }
+        unsigned long long off_nome = 0, off_desc = 0;
+        while (ok && (n = leitorLote(&lb, ps, idxs, lb.lote)) > 0 && exportados + n <= (long long)qtd) {
+            for (int i = 0; i < n; i++) {
+#define X(tipo, campo) c.campo[i] = ps[i]->campo;
+                COLUNAS_PRECO(X)
+#undef X
+            }
+            calcularLote(&c, 0, n, rateio);
+            ok = regiaoAcrescentar(fd, &reg[COLUNAR_ID], idxs, (size_t)n * sizeof(idxs[0]));
+#define X(tipo, campo) \
+            ok = ok && regiaoAcrescentar(fd, &reg[COLUNAR_##campo], c.campo, (size_t)n * sizeof(tipo));
+            COLUNAS_PRECO(X)
+#undef X
+            for (int i = 0; ok && i < n; i++) {
+                size_t ln = strnlen(ps[i]->nome, sizeof(ps[i]->nome));
+                size_t ld = strnlen(ps[i]->ingredientes_desc, sizeof(ps[i]->ingredientes_desc));
+                ok = regiaoAcrescentar(fd, &reg[COLUNAR_NOME], &off_nome, sizeof(off_nome)) &&
+                     regiaoAcrescentar(fd, &reg[COLUNAR_NOME_BYTES], ps[i]->nome, ln) &&
+                     regiaoAcrescentar(fd, &reg[COLUNAR_INGREDIENTES], &off_desc, sizeof(off_desc)) &&
+                     regiaoAcrescentar(fd, &reg[COLUNAR_INGREDIENTES_BYTES], ps[i]->ingredientes_desc, ld);
+                off_nome += ln;
+                off_desc += ld;
+            }
+            exportados += n;
+        }
+        ok = ok && exportados == (long long)qtd &&
+             regiaoAcrescentar(fd, &reg[COLUNAR_NOME], &off_nome, sizeof(off_nome)) &&
+             regiaoAcrescentar(fd, &reg[COLUNAR_INGREDIENTES], &off_desc, sizeof(off_desc));
+        for (int k = 0; ok && k < COLUNAR_NUM_BUFFERS; k++) ok = regiaoDescarregar(fd, &reg[k]);
+        /* cabeçalho por último: arquivo interrompido não passa por válido */
+        ok = ok && pwrite(fd, desc, sizeof(desc), sizeof(cab)) == (ssize_t)sizeof(desc) &&
+             pwrite(fd, &cab, sizeof(cab), 0) == (ssize_t)sizeof(cab) &&
+             ftruncate(fd, (off_t)pos) == 0;
+        free(reg);
+    }
+    long long corrompidos = lb.corrompidos;
+    leitorFechar(&lb);
+    if (fd != STDOUT_FILENO && close(fd) != 0) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "SIPRI: erro ao gravar %s\n", arq_out);
+        return 2;
+    }
+    if (corrompidos > 0)
+        fprintf(stderr, "SIPRI: %lld registro(s) de %s com checksum invalido ficaram de fora\n",
+                corrompidos, ARQ_PRODUTOS);
+    fprintf(stderr, "%lld produto(s) exportado(s)\n", exportados);
+    return 0;
+}
+
+static int comandoRepriceAll(void) {
+    struct Catalogo cat;
+    catalogoIniciar(&cat);
+    if (!catalogoTravar(&cat)) {
+        fprintf(stderr, "SIPRI: nao foi possivel carregar %s\n", ARQ_PRODUTOS);
+        catalogoLiberar(&cat);
+        return 2;
+    }
+    /* todo produto recém-carregado está sujo: a regravação reprecifica todos
+       em lote com a config atual */
+    for (int i = 0; i < cat.qtd; i++) cat.versao_preco[i] = 0;
+    int ajustes = catalogoAtualizarPrecos(&cat);
+    int ok = salvarProdutosAtomic(&cat);
+    if (ok) {
+        fprintf(stderr, "%d produto(s) reprecificado(s)", catalogoVivos(&cat));
+        if (ajustes) fprintf(stderr, ", %d com percentuais ajustados", ajustes);
+        fprintf(stderr, "\n");
+    } else {
+        fprintf(stderr, "SIPRI: falha ao gravar %s\n", ARQ_PRODUTOS);
+    }
+    catalogoDestravar();
+    catalogoLiberar(&cat);
+    return ok ? 0 : 2;
+}
+
+/* ----- Servidor local (socket Unix) ----- */
+/* SIPRI serve mantém o catálogo carregado e atende, por um socket Unix, a um
+   protocolo de linhas: uma requisição por linha, campos separados por TAB, e
+   uma resposta por requisição, na ordem em que chegaram:
+
+     PING                              OK
+     PRECO nome                        OK custo_unitario preco_produtor
+     CALCULO campo=valor...            OK custo_unitario preco_produtor
+     GRAVAR nome campo=valor...        OK custo_unitario preco_produtor
+     EXCLUIR nome                      OK
+     INGREDIENTE nome preco            OK receitas_recalculadas
+     FAIXA preco|custo|margem min max [limite]
+                                       OK n, e n linhas nome custo preco
+     LISTAR                            OK n, e n linhas nome custo preco
+
+   Os campos são os das colunas do import (modo, preco_custo, rendimento,
+   imposto_percent...). GRAVAR cadastra o nome ou altera só os campos dados.
+   Falhas respondem "ERRO\tmotivo".
+
+   O catálogo fica dividido em fatias pelo hash do nome. Cada fatia tem a sua
+   thread, a sua partição (com índice de nomes e índices ordenados próprios)
+   e as conexões que ela aceitou, e só lê a própria partição: o PRECO de um
+   nome de outra fatia vira um pedido na caixa dela, e FAIXA/LISTAR vão a
+   todas e as partes são juntadas na ordem do catálogo inteiro. O catálogo
+   de verdade (produtos.dat + log) fica com o coordenador, a thread
+   principal: mutações, e o que outros processos confirmam, entram nele pela
+   mesma trava e pelo mesmo log de sempre e são repassados às partições com
+   todas as fatias paradas, então nenhuma resposta vê metade de uma
+   alteração */
+#define ARQ_SOCKET "sipri.sock"
+#define SERVIDOR_CONEXOES_MAX 1024          /* por fatia */
+#define SERVIDOR_EVENTOS 64
+#define SERVIDOR_SAIDA_MAX (256 * 1024)     /* respostas pendentes por conexão */
+#define SERVIDOR_EM_VOO 256                 /* requisições sem resposta por conexão */
+#define SERVIDOR_CAMPOS_MAX 32
+#define SERVIDOR_REPARO_MS 1000             /* nova reconstrução após faltar memória */
+#define FATIAS_MAX 64
+
+/* resposta de uma requisição: curta no próprio slot, longa (FAIXA, LISTAR)
+   no heap. Quem atende escreve; a conexão só olha depois de pronta */
+struct Resposta {
+    char *texto;
+    size_t tam;
+    size_t capacidade;
+    int pronta;
+    char curta[80];
+};
+
+struct Conexao {
+    int fd;
+    int encerrar;           /* fecha depois de enviar o que falta */
+    int morta;              /* erro de escrita: o que falta é descartado */
+    int barreira;           /* mutação em andamento: as linhas seguintes esperam */
+    int tocada;             /* já está na lista de tocadas da fatia */
+    int posicao;            /* em con[] da fatia */
+    unsigned interesse;     /* eventos pedidos ao epoll (0: fora dele) */
+    unsigned cabeca;        /* anel: mais antiga ainda não enviada */
+    unsigned cauda;         /* anel: próxima livre */
+    size_t lidos;
+    char entrada[16384];    /* também o limite de uma linha */
+    char *saida;
+    size_t saida_usada;
+    size_t saida_enviada;
+    size_t saida_capacidade;
+    struct Resposta anel[SERVIDOR_EM_VOO];
+};
+
+enum { PEDIDO_PRECO, PEDIDO_MUTACAO, PEDIDO_FAIXA, PEDIDO_LISTAR };
+
+struct ItemColeta {
+    double chave;
+    int mestre;             /* slot no catálogo do coordenador: ordem e desempate */
+    double custo;
+    double preco;
+    char nome[MAX_NOME];
+};
+
+/* FAIXA/LISTAR: cada fatia preenche a sua parte (qtd < 0: falhou); só a
+   fatia de origem conta as que faltam e junta tudo */
+struct Coleta {
+    int tipo;
+    int ordem;
+    double min;
+    double max;
+    int limite;
+    int pendentes;
+    struct Conexao *c;
+    struct Resposta *r;
+    struct {
+        struct ItemColeta *itens;
+        int qtd;
+    } parte[FATIAS_MAX];
+};
+
+struct Pedido {
+    int tipo;
+    struct Conexao *c;
+    struct Resposta *r;
+    struct Coleta *coleta;
+    char *linha;            /* mutação: a linha inteira, para o coordenador */
+    char nome[MAX_NOME];
+};
+
+/* lote de pedidos de uma fatia para outra (ou para o coordenador), enviado
+   uma vez por volta do laço; volta à origem com as respostas escritas */
+struct Mensagem {
+    struct Mensagem *prox;
+    int origem;
+    int volta;
+    int qtd;
+    int capacidade;
+    struct Pedido *p;
+};
+
+struct Caixa {
+    pthread_mutex_t mutex;
+    struct Mensagem *ini;
+    struct Mensagem *fim;
+    int aviso[2];           /* pipe: um byte acorda quem espera */
+};
+
+struct EventoServidor {
+    void *ptr;              /* a conexão, o servidor (ouvinte) ou a caixa */
+    int ler;
+    int erro;
+};
+
+struct Servidor;
+
+struct Fatia {
+    int id;
+    struct Servidor *srv;
+    pthread_t thread;
+    struct Caixa caixa;
+    struct Catalogo cat;            /* a partição */
+    int *mestre;                    /* slot do mestre de cada item da partição */
+    int mestre_capacidade;
+    struct Mensagem *lote[FATIAS_MAX + 1];  /* a enviar; o último vai ao coordenador */
+    int qtd_con;
+    struct Conexao *con[SERVIDOR_CONEXOES_MAX];
+    int qtd_tocadas;
+    struct Conexao *tocadas[SERVIDOR_CONEXOES_MAX];
+    struct EventoServidor eventos[2 + SERVIDOR_CONEXOES_MAX];
+    unsigned tarefa_vista;
+    int incompleta;                 /* a última reconstrução parou no meio */
+#ifdef SIPRI_EPOLL
+    int ep;
+#else
+    struct pollfd pfd[2 + SERVIDOR_CONEXOES_MAX];
+#endif
+};
+
+/* tarefas que as fatias paradas executam juntas, cada uma na sua parte */
+enum { TAREFA_ROTEAR, TAREFA_RECONSTRUIR, TAREFA_REPRECIFICAR };
+
+struct Servidor {
+    int qtd_fatias;
+    struct Fatia *fatias;
+    struct Caixa coordenador;
+    int ouvinte;
+    struct Catalogo *mestre;
+    struct Alteracoes alteracoes;   /* o que mudou no mestre desde a última época */
+    int incompleto;                 /* partições sem parte do mestre (faltou memória):
+                                       consultas ao catálogo respondem ERRO até uma
+                                       reconstrução dar certo. Só muda com as fatias
+                                       paradas */
+    int *fatia_de;                  /* por slot do mestre: fatia e slot na partição */
+    int *local_de;
+    int localizacao_capacidade;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    atomic_int pausar;
+    int paradas;
+    int tarefa;
+    unsigned tarefa_rodada;
+    int tarefas_feitas;
+    atomic_int encerrar;
+    atomic_int pedir_epoca;         /* uma fatia viu o estado publicado mudar */
+    _Atomic unsigned long long geracao;     /* estado publicado que as partições refletem */
+};
+
+static volatile sig_atomic_t servidor_parar = 0;
+
+static void servidorSinal(int sinal) {
+    (void)sinal;
+    servidor_parar = 1;
+}
+
+/* fatia dona do nome: bits altos do hash (os baixos escolhem a posição no
+   índice de nomes da partição) */
+static int fatiaDoNome(const char *nome, int qtd_fatias) {
+    char norm[MAX_NOME];
+    unsigned h = nomeHash(norm, nomeNormalizar(nome, norm));
+    return (int)(((unsigned long long)h * (unsigned)qtd_fatias) >> 32);
+}
+
+/* ----- Servidor: respostas ----- */
+static struct Resposta *respostaNova(struct Conexao *c) {
+    struct Resposta *r = &c->anel[c->cauda++ % SERVIDOR_EM_VOO];
+    r->texto = r->curta;
+    r->tam = 0;
+    r->capacidade = sizeof(r->curta);
+    r->pronta = 0;
+    return r;
+}
+
+static void respostaLimpar(struct Resposta *r) {
+    if (r->texto != r->curta) free(r->texto);
+    r->texto = r->curta;
+    r->tam = 0;
+    r->capacidade = sizeof(r->curta);
+}
+
+static int respostaAcrescentar(struct Resposta *r, const char *s, size_t n) {
+    if (r->tam + n > r->capacidade) {
+        size_t cap = r->capacidade * 2;
+        while (cap < r->tam + n) cap *= 2;
+        char *novo = malloc(cap);
+        if (!novo) return 0;
+        memcpy(novo, r->texto, r->tam);
+        if (r->texto != r->curta) free(r->texto);
+        r->texto = novo;
+        r->capacidade = cap;
+    }
+    memcpy(r->texto + r->tam, s, n);
+    r->tam += n;
+    return 1;
+}
+
+static void respostaErro(struct Resposta *r, const char *motivo) {
+    char linha[128];
+    int n = snprintf(linha, sizeof(linha), "ERRO\t%s\n", motivo);
+    respostaLimpar(r);
+    respostaAcrescentar(r, linha, (size_t)n);
+}
+
+static void respostaPreco(struct Resposta *r, double custo, double preco) {
+    char linha[2 * DINHEIRO_TAM + 8], *d = linha;
+    memcpy(d, "OK\t", 3);
+    d += 3;
+    d += dinheiroFormatar(custo, d);
+    *d++ = '\t';
+    d += dinheiroFormatar(preco, d);
+    *d++ = '\n';
+    respostaAcrescentar(r, linha, (size_t)(d - linha));
+}
+
+/* separa a linha nos TABs, no lugar; retorna quantos campos */
+static int servidorSeparar(char *linha, char **campos) {
+    int n = 0;
+    for (char *p = linha; n < SERVIDOR_CAMPOS_MAX; ) {
+        campos[n++] = p;
+        p = strchr(p, '\t');
+        if (!p) break;
+        *p++ = '\0';
+    }
+    return n;
+}
+
+static int comandoIgual(const char *linha, size_t k, const char *comando) {
+    return strlen(comando) == k && memcmp(linha, comando, k) == 0;
+}
+
+/* ----- Servidor: requisições ----- */
+/* aplica "campo=valor" ao produto; 0 se algum campo não existe ou o valor
+   não é um número válido para ele */
+static int servidorCampos(char **campos, int n, struct Produto *prod) {
+    for (int k = 0; k < n; k++) {
+        char *igual = strchr(campos[k], '=');
+        if (!igual) return 0;
+        *igual = '\0';
+        int col = loteColuna(campos[k]);
+        const char *valor = igual + 1;
+        double v;
+        if (col < 0 || !numeroLer(valor, valor + strlen(valor), &v) || !valorNaFaixa(v)) return 0;
+        int ok = 1;
+        switch (col) {
+#define X(tipo, campo) case LOTE_COL_##campo: \
+            ok = (tipo)v == v; \
+            prod->campo = (tipo)v; \
+            break;
+            COLUNAS_PRECO(X)
+#undef X
+        }
+        if (!ok) return 0;
+    }
+    return 1;
+}
+
+/* nome sem espaços nas pontas, como na digitação e no import */
+static int servidorNome(const char *campo, char *nome) {
+    const char *a = campo, *b = campo + strlen(campo);
+    while (*a == ' ') a++;
+    while (b > a && b[-1] == ' ') b--;
+    if (b == a || (size_t)(b - a) >= MAX_NOME) return 0;
+    memcpy(nome, a, (size_t)(b - a));
+    nome[b - a] = '\0';
+    return 1;
+}
+
+/* ----- Servidor: mutações (coordenador, no catálogo mestre) ----- */
+static void servidorGravar(struct Catalogo *cat, struct Resposta *r, char **campos, int n) {
+    char nome[MAX_NOME];
+    if (n < 2 || !servidorNome(campos[1], nome)) {
+        respostaErro(r, "nome invalido");
+        return;
+    }
+    if (!catalogoTravar(cat)) {
+        respostaErro(r, "nao foi possivel travar o catalogo");
+        return;
+    }
+    struct Produto p;
+    int idx = catalogoBuscarNome(cat, nome);
+    if (idx >= 0) {
+        catalogoObter(cat, idx, &p);
+    } else {
+        memset(&p, 0, sizeof(p));
+        memcpy(p.nome, nome, sizeof(nome));
+        p.modo = 1;
+    }
+    if (!servidorCampos(campos + 2, n - 2, &p)) {
+        catalogoDestravar();
+        respostaErro(r, "campo invalido");
+        return;
+    }
+    importaNormalizar(&p);
+    calcularTudo(&p);
+
+    int ok;
+    if (idx >= 0) {
+        ok = catalogoGravar(cat, idx, &p) && diarioRegistrar(cat, LOG_ATUALIZAR, idx) && diarioConfirmar(cat);
+        /* como na edição: a receita some se deixou de ser receita, e quem
+           usa o produto como sub-receita acompanha o custo */
+        if (ok && p.modo != 2 && receitaRemover(p.nome) && !salvarIngredientesAtomic()) ok = 0;
+        if (ok && produtoPropagar(cat, idx) < 0) ok = 0;
+    } else {
+        idx = catalogoAdicionar(cat, &p);
+        ok = idx >= 0 && diarioRegistrar(cat, LOG_INSERIR, idx) && diarioConfirmar(cat);
+    }
+    catalogoDestravar();
+    if (ok) respostaPreco(r, p.custo_unitario, p.preco_produtor);
+    else respostaErro(r, "falha ao gravar");
+}
+
+static void servidorIngrediente(struct Catalogo *cat, struct Resposta *r, char **campos, int n) {
+    double preco;
+    if (n != 3 || !dinheiroLer(campos[2], &preco) || preco < 0.0) {
+        respostaErro(r, "preco invalido");
+        return;
+    }
+    if (!catalogoTravar(cat)) {
+        respostaErro(r, "nao foi possivel travar o catalogo");
+        return;
+    }
+    int g = ingredienteBuscar(campos[1]);
+    if (g < 0 || ingredientes.itens[g].tipo == INGR_PRODUTO) {
+        catalogoDestravar();
+        respostaErro(r, g < 0 ? "ingrediente nao encontrado" : "custo de sub-receita vem do produto");
+        return;
+    }
+    int recalculadas = ingredientesAlterarPrecos(cat, &g, &preco, 1);
+    catalogoDestravar();
+    if (recalculadas < 0) {
+        respostaErro(r, "falha ao gravar");
+        return;
+    }
+    char linha[32];
+    int k = snprintf(linha, sizeof(linha), "OK\t%d\n", recalculadas);
+    respostaAcrescentar(r, linha, (size_t)k);
+}
+
+static void servidorMutar(struct Catalogo *cat, char *linha, struct Resposta *r) {
+    char *campos[SERVIDOR_CAMPOS_MAX];
+    int n = servidorSeparar(linha, campos);
+    if (strcmp(campos[0], "GRAVAR") == 0) {
+        servidorGravar(cat, r, campos, n);
+    } else if (strcmp(campos[0], "EXCLUIR") == 0 && n == 2) {
+        int e = excluirProdutoConfirmar(cat, campos[1]);
+        if (e > 0) respostaAcrescentar(r, "OK\n", 3);
+        else respostaErro(r, e == 0 ? "produto nao encontrado" : "falha ao gravar");
+    } else if (strcmp(campos[0], "INGREDIENTE") == 0) {
+        servidorIngrediente(cat, r, campos, n);
+    } else {
+        respostaErro(r, "requisicao invalida");
+    }
+}
+
+/* ----- Servidor: caixas de mensagens ----- */
+static int caixaIniciar(struct Caixa *cx) {
+    cx->ini = cx->fim = NULL;
+    if (pipe(cx->aviso) != 0) return 0;
+    if (fcntl(cx->aviso[0], F_SETFL, O_NONBLOCK) != 0 || fcntl(cx->aviso[1], F_SETFL, O_NONBLOCK) != 0) {
+        close(cx->aviso[0]);
+        close(cx->aviso[1]);
+        return 0;
+    }
+    pthread_mutex_init(&cx->mutex, NULL);
+    return 1;
+}
+
+static void caixaLiberar(struct Caixa *cx) {
+    close(cx->aviso[0]);
+    close(cx->aviso[1]);
+    pthread_mutex_destroy(&cx->mutex);
+}
+
+static void caixaAcordar(struct Caixa *cx) {
+    char b = 0;
+    ssize_t w = write(cx->aviso[1], &b, 1);     /* pipe cheio: já há aviso pendente */
+    (void)w;
+}
+
+/* o aviso só é escrito quando a caixa estava vazia: quem tira esvazia o
+   pipe antes de pegar as mensagens, então nenhuma fica sem aviso */
+static void caixaEnviar(struct Caixa *cx, struct Mensagem *m) {
+    m->prox = NULL;
+    pthread_mutex_lock(&cx->mutex);
+    int vazia = cx->ini == NULL;
+    if (vazia) cx->ini = m;
+    else cx->fim->prox = m;
+    cx->fim = m;
+    pthread_mutex_unlock(&cx->mutex);
+    if (vazia) caixaAcordar(cx);
+}
+
+static struct Mensagem *caixaTirar(struct Caixa *cx) {
+    char b[64];
+    while (read(cx->aviso[0], b, sizeof(b)) > 0) {}
+    pthread_mutex_lock(&cx->mutex);
+    struct Mensagem *m = cx->ini;
+    cx->ini = cx->fim = NULL;
+    pthread_mutex_unlock(&cx->mutex);
+    return m;
+}
+
+static void mensagemLiberar(struct Mensagem *m) {
+    free(m->p);
+    free(m);
+}
+
+/* próximo pedido do lote desta volta para o destino (uma fatia ou, com
+   destino == qtd_fatias, o coordenador); NULL sem memória */
+static struct Pedido *pedidoNovo(struct Fatia *f, int destino) {
+    struct Mensagem *m = f->lote[destino];
+    if (!m) {
+        m = calloc(1, sizeof(*m));
+        if (!m) return NULL;
+        m->origem = f->id;
+        f->lote[destino] = m;
+    }
+    if (m->qtd == m->capacidade) {
+        int cap = m->capacidade ? m->capacidade * 2 : 16;
+        struct Pedido *novo = realloc(m->p, (size_t)cap * sizeof(*novo));
+        if (!novo) return NULL;
+        m->p = novo;
+        m->capacidade = cap;
+    }
+    struct Pedido *p = &m->p[m->qtd++];
+    memset(p, 0, sizeof(*p));
+    return p;
+}
+
+static void fatiaDespachar(struct Fatia *f) {
+    struct Servidor *s = f->srv;
+    for (int d = 0; d <= s->qtd_fatias; d++) {
+        if (!f->lote[d]) continue;
+        caixaEnviar(d == s->qtd_fatias ? &s->coordenador : &s->fatias[d].caixa, f->lote[d]);
+        f->lote[d] = NULL;
+    }
+}
+
+static void fatiaTocar(struct Fatia *f, struct Conexao *c) {
+    if (c->tocada) return;
+    c->tocada = 1;
+    f->tocadas[f->qtd_tocadas++] = c;
+}
+
+/* ----- Servidor: consultas na partição (só a thread da fatia) ----- */
+static void fatiaPreco(struct Fatia *f, const char *nome, struct Resposta *r) {
+    int idx = catalogoBuscarNome(&f->cat, nome);
+    if (idx < 0) {
+        respostaErro(r, "produto nao encontrado");
+        return;
+    }
+    catalogoAtualizarPreco(&f->cat, idx);
+    respostaPreco(r, f->cat.col.custo_unitario[idx], f->cat.col.preco_produtor[idx]);
+}
+
+static int itemAntes(const struct ItemColeta *a, const struct ItemColeta *b, int tipo) {
+    if (tipo == PEDIDO_LISTAR) return a->mestre < b->mestre;
+    return entradaMenor(a->chave, a->mestre, b->chave, b->mestre);
+}
+
+static int compararItensFaixa(const void *a, const void *b) {
+    const struct ItemColeta *x = a, *y = b;
+    if (itemAntes(x, y, PEDIDO_FAIXA)) return -1;
+    return itemAntes(y, x, PEDIDO_FAIXA);
+}
+
+static int compararItensLista(const void *a, const void *b) {
+    const struct ItemColeta *x = a, *y = b;
+    return (x->mestre > y->mestre) - (x->mestre < y->mestre);
+}
+
+static int coletaItem(struct ItemColeta **itens, int *qtd, int *cap, struct Fatia *f, int idx, double chave) {
+    if (*qtd == *cap) {
+        int novo_cap = *cap ? *cap * 2 : 64;
+        struct ItemColeta *novo = realloc(*itens, (size_t)novo_cap * sizeof(*novo));
+        if (!novo) return 0;
+        *itens = novo;
+        *cap = novo_cap;
+    }
+    struct ItemColeta *it = &(*itens)[(*qtd)++];
+    catalogoAtualizarPreco(&f->cat, idx);
+    it->chave = chave;
+    it->mestre = f->mestre[idx];
+    it->custo = f->cat.col.custo_unitario[idx];
+    it->preco = f->cat.col.preco_produtor[idx];
+    snprintf(it->nome, sizeof(it->nome), "%s", f->cat.nome[idx]);
+    return 1;
+}
+
+/* a parte desta fatia, já na ordem em que as partes são juntadas. Na faixa,
+   os índices da partição desempatam pelo slot local: depois do limite ainda
+   entram os empatados com o último, para que o corte final (pelo slot do
+   mestre) seja o mesmo do catálogo inteiro */
+static void coletaParte(struct Fatia *f, struct Coleta *col) {
+    struct ItemColeta *itens = NULL;
+    int qtd = 0, cap = 0, ok = 1;
+    if (col->tipo == PEDIDO_LISTAR) {
+        for (int i = 0; ok && i < f->cat.qtd; i++)
+            if (!f->cat.excluido[i]) ok = coletaItem(&itens, &qtd, &cap, f, i, 0.0);
+        if (ok) qsort(itens, (size_t)qtd, sizeof(*itens), compararItensLista);
+    } else {
+        const struct IndiceOrdem *o = catalogoOrdenado(&f->cat, col->ordem);
+        struct CursorOrdem cur;
+        const struct EntradaOrdem *e;
+        ok = o != NULL;
+        if (ok) ordemLimite(o, col->min, 0, &cur);
+        while (ok && (e = cursorEntrada(&cur)) != NULL && e->chave <= col->max &&
+               (qtd < col->limite || (qtd > 0 && e->chave == itens[qtd - 1].chave))) {
+            ok = coletaItem(&itens, &qtd, &cap, f, e->idx, e->chave);
+            cursorAvancar(&cur, 1);
+        }
+        if (ok) qsort(itens, (size_t)qtd, sizeof(*itens), compararItensFaixa);
+        if (qtd > col->limite) qtd = col->limite;
+    }
+    if (!ok) {
+        free(itens);
+        itens = NULL;
+        qtd = -1;
+    }
+    col->parte[f->id].itens = itens;
+    col->parte[f->id].qtd = qtd;
+}
+
+/* todas as partes chegaram: junta (intercalação das partes ordenadas) e
+   escreve a resposta */
+static void coletaJuntar(struct Fatia *f, struct Coleta *col) {
+    struct Servidor *s = f->srv;
+    struct Resposta *r = col->r;
+    int pos[FATIAS_MAX], total = 0, ok = 1;
+    for (int k = 0; k < s->qtd_fatias; k++) {
+        pos[k] = 0;
+        if (col->parte[k].qtd < 0) ok = 0;
+        else total += col->parte[k].qtd;
+    }
+    if (total > col->limite) total = col->limite;
+    char linha[MAX_NOME + 2 * DINHEIRO_TAM + 4];
+    int n = snprintf(linha, sizeof(linha), "OK\t%d\n", total);
+    ok = ok && respostaAcrescentar(r, linha, (size_t)n);
+    for (int i = 0; ok && i < total; i++) {
+        int melhor = -1;
+        for (int k = 0; k < s->qtd_fatias; k++) {
+            if (pos[k] >= col->parte[k].qtd) continue;
+            if (melhor < 0 || itemAntes(&col->parte[k].itens[pos[k]],
+                                        &col->parte[melhor].itens[pos[melhor]], col->tipo))
+                melhor = k;
+        }
+        const struct ItemColeta *it = &col->parte[melhor].itens[pos[melhor]++];
+        size_t k = strlen(it->nome);
+        memcpy(linha, it->nome, k);
+        linha[k++] = '\t';
+        k += dinheiroFormatar(it->custo, linha + k);
+        linha[k++] = '\t';
+        k += dinheiroFormatar(it->preco, linha + k);
+        linha[k++] = '\n';
+        ok = respostaAcrescentar(r, linha, k);
+    }
+    if (!ok) respostaErro(r, "memoria insuficiente");
+    r->pronta = 1;
+    fatiaTocar(f, col->c);
+    for (int k = 0; k < s->qtd_fatias; k++) free(col->parte[k].itens);
+    free(col);
+}
+
+static void coletaConcluir(struct Fatia *f, struct Coleta *col) {
+    if (--col->pendentes == 0) coletaJuntar(f, col);
+}
+
+/* FAIXA/LISTAR: um pedido para cada outra fatia, a parte desta na hora */
+static void fatiaColetar(struct Fatia *f, struct Conexao *c, struct Resposta *r, int tipo, int ordem,
+                         double min, double max, int limite) {
+    struct Servidor *s = f->srv;
+    struct Coleta *col = calloc(1, sizeof(*col));
+    if (!col) {
+        respostaErro(r, "memoria insuficiente");
+        r->pronta = 1;
+        return;
+    }
+    col->tipo = tipo;
+    col->ordem = ordem;
+    col->min = min;
+    col->max = max;
+    col->limite = limite;
+    col->c = c;
+    col->r = r;
+    col->pendentes = s->qtd_fatias;
+    for (int d = 0; d < s->qtd_fatias; d++) {
+        if (d == f->id) continue;
+        struct Pedido *p = pedidoNovo(f, d);
+        if (!p) {
+            col->parte[d].qtd = -1;
+            col->pendentes--;
+            continue;
+        }
+        p->tipo = tipo;
+        p->c = c;
+        p->r = r;
+        p->coleta = col;
+    }
+    coletaParte(f, col);
+    coletaConcluir(f, col);
+}
+
+/* uma requisição (linha sem o '\n'), com a resposta no próximo slot do anel */
+static void fatiaAtender(struct Fatia *f, struct Conexao *c, char *linha) {
+    struct Servidor *s = f->srv;
+    struct Resposta *r = respostaNova(c);
+    size_t k = strcspn(linha, "\t");
+
+    /* mutação: vai inteira ao coordenador, e as linhas seguintes desta
+       conexão esperam (quem grava e depois consulta vê o que gravou) */
+    if (comandoIgual(linha, k, "GRAVAR") || comandoIgual(linha, k, "EXCLUIR") ||
+        comandoIgual(linha, k, "INGREDIENTE")) {
+        char *copia = strdup(linha);
+        struct Pedido *p = copia ? pedidoNovo(f, s->qtd_fatias) : NULL;
+        if (!p) {
+            free(copia);
+            respostaErro(r, "memoria insuficiente");
+            r->pronta = 1;
+            return;
+        }
+        p->tipo = PEDIDO_MUTACAO;
+        p->c = c;
+        p->r = r;
+        p->linha = copia;
+        c->barreira = 1;
+        return;
+    }
+
+    char *campos[SERVIDOR_CAMPOS_MAX];
+    int n = servidorSeparar(linha, campos);
+    r->pronta = 1;
+    if (s->incompleto && (strcmp(campos[0], "PRECO") == 0 || strcmp(campos[0], "FAIXA") == 0 ||
+                          strcmp(campos[0], "LISTAR") == 0)) {
+        respostaErro(r, "catalogo indisponivel");
+        return;
+    }
+    if (strcmp(campos[0], "PRECO") == 0 && n == 2) {
+        int dono = fatiaDoNome(campos[1], s->qtd_fatias);
+        if (dono == f->id) {
+            fatiaPreco(f, campos[1], r);
+            return;
+        }
+        struct Pedido *p = pedidoNovo(f, dono);
+        if (!p) {
+            respostaErro(r, "memoria insuficiente");
+            return;
+        }
+        p->tipo = PEDIDO_PRECO;
+        p->c = c;
+        p->r = r;
+        nomeNormalizar(campos[1], p->nome);     /* a dona busca pelo mesmo nome */
+        r->pronta = 0;
+    } else if (strcmp(campos[0], "CALCULO") == 0) {
+        struct Produto p;
+        memset(&p, 0, sizeof(p));
+        p.modo = 1;
+        if (!servidorCampos(campos + 1, n - 1, &p)) {
+            respostaErro(r, "campo invalido");
+            return;
+        }
+        importaNormalizar(&p);
+        calcularTudo(&p);
+        respostaPreco(r, p.custo_unitario, p.preco_produtor);
+    } else if (strcmp(campos[0], "FAIXA") == 0 && (n == 4 || n == 5)) {
+        int ordem = strcmp(campos[1], "preco") == 0 ? ORDEM_PRECO
+                  : strcmp(campos[1], "custo") == 0 ? ORDEM_CUSTO
+                  : strcmp(campos[1], "margem") == 0 ? ORDEM_MARGEM : -1;
+        double min, max, limite = INT_MAX;
+        if (ordem < 0 || !numeroLer(campos[2], campos[2] + strlen(campos[2]), &min) ||
+            !numeroLer(campos[3], campos[3] + strlen(campos[3]), &max) ||
+            (n == 5 && (!numeroLer(campos[4], campos[4] + strlen(campos[4]), &limite) ||
+                        !(limite >= 0 && limite <= INT_MAX) || limite != (int)limite))) {
+            respostaErro(r, "faixa invalida");
+            return;
+        }
+        r->pronta = 0;
+        fatiaColetar(f, c, r, PEDIDO_FAIXA, ordem, min, max, (int)limite);
+    } else if (strcmp(campos[0], "LISTAR") == 0 && n == 1) {
+        r->pronta = 0;
+        fatiaColetar(f, c, r, PEDIDO_LISTAR, 0, 0.0, 0.0, INT_MAX);
+    } else if (strcmp(campos[0], "PING") == 0 && n == 1) {
+        respostaAcrescentar(r, "OK\n", 3);
+    } else {
+        respostaErro(r, "requisicao invalida");
+    }
+}
+
+/* ----- Servidor: conexões (só a thread da fatia que aceitou) ----- */
+static int saidaAcrescentar(struct Conexao *c, const char *s, size_t n) {
+    if (c->saida_usada + n > c->saida_capacidade) {
+        size_t cap = c->saida_capacidade ? c->saida_capacidade * 2 : 4096;
+        while (cap < c->saida_usada + n) cap *= 2;
+        char *novo = realloc(c->saida, cap);
+        if (!novo) return 0;
+        c->saida = novo;
+        c->saida_capacidade = cap;
+    }
+    memcpy(c->saida + c->saida_usada, s, n);
+    c->saida_usada += n;
+    return 1;
+}
+
+static int conexaoEmVoo(const struct Conexao *c) {
+    return (int)(c->cauda - c->cabeca);
+}
+
+/* atende as linhas completas que já chegaram, até a saída pendente passar
+   do limite, o anel encher ou uma mutação ficar pendente: o resto espera
+   (um cliente que só envia não faz a memória do servidor crescer sem limite) */
+static void conexaoProcessar(struct Fatia *f, struct Conexao *c) {
+    char *ini = c->entrada, *fim = c->entrada + c->lidos, *nl;
+    while (!c->encerrar && !c->barreira && conexaoEmVoo(c) < SERVIDOR_EM_VOO &&
+           c->saida_usada - c->saida_enviada < SERVIDOR_SAIDA_MAX &&
+           (nl = memchr(ini, '\n', (size_t)(fim - ini))) != NULL) {
+        *nl = '\0';
+        if (nl > ini && nl[-1] == '\r') nl[-1] = '\0';
+        fatiaAtender(f, c, ini);
+        ini = nl + 1;
+    }
+    c->lidos = (size_t)(fim - ini);
+    memmove(c->entrada, ini, c->lidos);
+    if (!c->encerrar && c->lidos == sizeof(c->entrada) && conexaoEmVoo(c) < SERVIDOR_EM_VOO &&
+        !memchr(c->entrada, '\n', c->lidos)) {
+        struct Resposta *r = respostaNova(c);
+        respostaErro(r, "linha longa demais");
+        r->pronta = 1;
+        c->encerrar = 1;
+    }
+}
+
+/* passa para a saída as respostas prontas, na ordem das requisições */
+static void conexaoColher(struct Conexao *c) {
+    while (c->cabeca != c->cauda) {
+        struct Resposta *r = &c->anel[c->cabeca % SERVIDOR_EM_VOO];
+        if (!r->pronta) break;
+        if (!c->morta && !saidaAcrescentar(c, r->texto, r->tam)) c->morta = c->encerrar = 1;
+        respostaLimpar(r);
+        c->cabeca++;
+    }
+}
+
+/* uma leitura (o que couber no buffer); o fim da conexão marca encerrar */
+static void conexaoLer(struct Conexao *c) {
+    ssize_t r = read(c->fd, c->entrada + c->lidos, sizeof(c->entrada) - c->lidos);
+    if (r > 0) c->lidos += (size_t)r;
+    else if (r == 0 || (errno != EAGAIN && errno != EINTR)) c->encerrar = 1;
+}
+
+/* envia o que couber; a conexão que caiu fica morta (o resto é descartado) */
+static void conexaoEnviar(struct Conexao *c) {
+    while (!c->morta && c->saida_enviada < c->saida_usada) {
+        ssize_t w = write(c->fd, c->saida + c->saida_enviada, c->saida_usada - c->saida_enviada);
+        if (w < 0) {
+            if (errno != EAGAIN && errno != EINTR) c->morta = c->encerrar = 1;
+            return;
+        }
+        c->saida_enviada += (size_t)w;
+    }
+    c->saida_usada = c->saida_enviada = 0;
+}
+
+static int conexaoQuerLer(const struct Conexao *c) {
+    return !c->encerrar && c->lidos < sizeof(c->entrada) && conexaoEmVoo(c) < SERVIDOR_EM_VOO &&
+           c->saida_usada - c->saida_enviada < SERVIDOR_SAIDA_MAX;
+}
+
+static int conexaoQuerEscrever(const struct Conexao *c) {
+    return !c->morta && c->saida_usada > c->saida_enviada;
+}
+
+/* só fecha sem nada em voo: uma resposta de outra fatia ainda vai ser
+   escrita no anel */
+static int conexaoTerminada(const struct Conexao *c) {
+    return c->encerrar && c->cabeca == c->cauda && (c->morta || c->saida_usada == 0);
+}
+
+/* lê uma vez (se pedido), atende tudo o que estiver completo e responde
+   com uma só escrita (requisições em pipeline saem juntas). Se a escrita
+   esvaziou a saída, as linhas que esperavam por ela são atendidas na mesma
+   volta */
+static void conexaoAtender(struct Fatia *f, struct Conexao *c, int ler) {
+    if (ler && conexaoQuerLer(c)) conexaoLer(c);
+    do {
+        conexaoProcessar(f, c);
+        conexaoColher(c);
+        conexaoEnviar(c);
+    } while (!c->encerrar && !c->barreira && c->saida_usada == 0 && conexaoEmVoo(c) == 0 &&
+             memchr(c->entrada, '\n', c->lidos));
+}
+
+static void conexaoFechar(struct Fatia *f, struct Conexao *c) {
+    if (c->tocada) {
+        for (int k = 0; k < f->qtd_tocadas; k++)
+            if (f->tocadas[k] == c) {
+                f->tocadas[k] = f->tocadas[--f->qtd_tocadas];
+                break;
+            }
+    }
+    struct Conexao *ultima = f->con[--f->qtd_con];
+    f->con[c->posicao] = ultima;
+    ultima->posicao = c->posicao;
+    close(c->fd);       /* close tira o fd do epoll */
+    for (unsigned k = c->cabeca; k != c->cauda; k++) respostaLimpar(&c->anel[k % SERVIDOR_EM_VOO]);
+    free(c->saida);
+    free(c);
+}
+
+#ifdef SIPRI_EPOLL
+/* epoll, por nível: cada conexão pronta tem uma leitura por volta, então um
+   cliente apressado não segura os outros. O interesse (leitura/escrita) só
+   é trocado no kernel quando muda; sem interesse nenhum (só esperando
+   respostas de outras fatias) a conexão sai do epoll */
+static void fatiaInteresse(struct Fatia *f, struct Conexao *c) {
+    unsigned quer = (conexaoQuerLer(c) ? EPOLLIN : 0u) | (conexaoQuerEscrever(c) ? EPOLLOUT : 0u);
+    if (quer == c->interesse) return;
+    struct epoll_event ev = { .events = quer, .data.ptr = c };
+    int op = c->interesse == 0 ? EPOLL_CTL_ADD : quer == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+    if (epoll_ctl(f->ep, op, c->fd, &ev) == 0) c->interesse = quer;
+    else c->morta = c->encerrar = 1;
+}
+
+static int fatiaEsperarIniciar(struct Fatia *f) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = f->srv };
+#ifdef EPOLLEXCLUSIVE
+    ev.events |= EPOLLEXCLUSIVE;    /* uma conexão nova acorda uma fatia só */
+#endif
+    f->ep = epoll_create1(EPOLL_CLOEXEC);
+    if (f->ep < 0 || epoll_ctl(f->ep, EPOLL_CTL_ADD, f->srv->ouvinte, &ev) != 0) return 0;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &f->caixa;
+    return epoll_ctl(f->ep, EPOLL_CTL_ADD, f->caixa.aviso[0], &ev) == 0;
+}
+
+static void fatiaEsperarLiberar(struct Fatia *f) {
+    if (f->ep >= 0) close(f->ep);
+}
+
+static int fatiaEsperar(struct Fatia *f) {
+    struct epoll_event prontos[SERVIDOR_EVENTOS];
+    int n = epoll_wait(f->ep, prontos, SERVIDOR_EVENTOS, -1);
+    for (int k = 0; k < n; k++) {
+        f->eventos[k].ptr = prontos[k].data.ptr;
+        f->eventos[k].ler = (prontos[k].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+        f->eventos[k].erro = (prontos[k].events & EPOLLERR) != 0;
+    }
+    return n;
+}
+#else
+/* sem epoll: poll sobre a caixa, o socket de escuta e todas as conexões da
+   fatia a cada volta (fd negativo: sem interesse) */
+static void fatiaInteresse(struct Fatia *f, struct Conexao *c) {
+    (void)f;
+    c->interesse = (conexaoQuerLer(c) ? POLLIN : 0u) | (conexaoQuerEscrever(c) ? POLLOUT : 0u);
+}
 
-    excluirProdutoIndex(produtos, qtd, idx);
-    if (!salvarProdutosAtomic(produtos, *qtd))
-        imprimir_aviso("Falha ao salvar apos exclusao.");
+static int fatiaEsperarIniciar(struct Fatia *f) {
+    (void)f;
+    return 1;
+}
 
-    imprimir_sucesso("Produto excluido!");
-    pausar();
+static void fatiaEsperarLiberar(struct Fatia *f) {
+    (void)f;
 }
 
-/* ----- Cálculo rápido ----- */
-void calculoRapido() {
-    imprimir_cabecalho("CALCULO RAPIDO");
+static int fatiaEsperar(struct Fatia *f) {
+    int n = f->qtd_con;
+    f->pfd[0].fd = f->caixa.aviso[0];
+    f->pfd[0].events = POLLIN;
+    f->pfd[1].fd = f->srv->ouvinte;
+    f->pfd[1].events = POLLIN;
+    for (int k = 0; k < n; k++) {
+        f->pfd[2 + k].fd = f->con[k]->interesse ? f->con[k]->fd : -1;
+        f->pfd[2 + k].events = (short)f->con[k]->interesse;
+    }
+    if (poll(f->pfd, (nfds_t)(2 + n), -1) < 0) return -1;
+    int qtd = 0;
+    for (int k = 0; k < 2 + n; k++) {
+        short ev = f->pfd[k].revents;
+        if (!ev) continue;
+        f->eventos[qtd].ptr = k == 0 ? (void *)&f->caixa : k == 1 ? (void *)f->srv : (void *)f->con[k - 2];
+        f->eventos[qtd].ler = (ev & (POLLIN | POLLHUP | POLLERR)) != 0;
+        f->eventos[qtd].erro = (ev & POLLERR) != 0;
+        qtd++;
+    }
+    return qtd;
+}
+#endif
 
-    char buf[BUF_SIZE];
-    struct Produto p;
-    memset(&p, 0, sizeof(p));
+static void fatiaAceitar(struct Fatia *f) {
+    for (;;) {
+        int fd = accept(f->srv->ouvinte, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return;
+        }
+        struct Conexao *c = f->qtd_con < SERVIDOR_CONEXOES_MAX ? calloc(1, sizeof(*c)) : NULL;
+        if (!c || fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+            free(c);
+            close(fd);      /* recusada: as outras da fila ainda são aceitas */
+            continue;
+        }
+        c->fd = fd;
+        c->posicao = f->qtd_con;
+        f->con[f->qtd_con++] = c;
+        fatiaInteresse(f, c);
+        if (c->encerrar) conexaoFechar(f, c);
+    }
+}
 
-    printf("%sModo (1=custo direto | 2=receita): %s", CYAN, RESET);
-    lerLinha(buf, sizeof(buf));
-    p.modo = atoi(buf);
-    if (p.modo != 1 && p.modo != 2) p.modo = 1;
+/* depois de atender: fecha a conexão que terminou ou ajusta o interesse */
+static void fatiaRevisar(struct Fatia *f, struct Conexao *c) {
+    if (conexaoTerminada(c)) conexaoFechar(f, c);
+    else fatiaInteresse(f, c);
+}
 
-    if (p.modo == 1) {
-        printf("%sPreco de custo/un (R$): %s", CYAN, RESET);
-        lerLinha(buf, sizeof(buf));
-        p.preco_custo = atof(buf);
-    } else {
-        double c = coletarIngredientesText(p.ingredientes_desc, sizeof(p.ingredientes_desc), &p.rendimento);
-        if (c < 0.0) return;
-        p.investimento_total = c;
-        printf("%sDespesas variaveis (R$) [Enter=0]: %s", CYAN, RESET);
-        lerLinha(buf, sizeof(buf));
-        if (buf[0] != '\0') p.despesas_variaveis = atof(buf);
+/* ----- Servidor: épocas (as fatias param e o coordenador mexe nas partições) ----- */
+/* anota o slot do mestre do item local da partição */
+static int fatiaMestre(struct Fatia *f, int local, int m) {
+    if (local >= f->mestre_capacidade) {
+        int cap = f->mestre_capacidade ? f->mestre_capacidade : 1024;
+        while (cap <= local) cap *= 2;
+        int *novo = realloc(f->mestre, (size_t)cap * sizeof(int));
+        if (!novo) return 0;
+        f->mestre = novo;
+        f->mestre_capacidade = cap;
     }
+    f->mestre[local] = m;
+    return 1;
+}
 
-    printf("%sUsar MEI comercio (4%%)? (s/n): %s", CYAN, RESET);
-    lerLinha(buf, sizeof(buf));
-    if (buf[0] == 's' || buf[0] == 'S') {
-        p.usar_mei_comercio = 1;
-        p.imposto_percent = 4.0;
+static void fatiaTarefa(struct Fatia *f, int tarefa) {
+    struct Servidor *s = f->srv;
+    struct Catalogo *mestre = s->mestre;
+    if (tarefa == TAREFA_ROTEAR) {
+        /* cada fatia roteia um trecho contíguo dos slots do mestre */
+        int n = s->localizacao_capacidade;
+        int ini = (int)((long long)n * f->id / s->qtd_fatias);
+        int fim = (int)((long long)n * (f->id + 1) / s->qtd_fatias);
+        for (int i = ini; i < fim; i++)
+            s->fatia_de[i] = catalogoValido(mestre, i) ? fatiaDoNome(mestre->nome[i], s->qtd_fatias) : -1;
+    } else if (tarefa == TAREFA_RECONSTRUIR) {
+        /* os preços do mestre já estão em dia: catalogoObter só lê */
+        catalogoLiberar(&f->cat);
+        f->incompleta = 0;
+        struct Produto p;
+        for (int i = 0; i < mestre->qtd; i++) {
+            if (s->fatia_de[i] != f->id) continue;
+            catalogoObter(mestre, i, &p);
+            int local = catalogoAdicionar(&f->cat, &p);
+            if (local < 0 || !fatiaMestre(f, local, i)) {
+                fprintf(stderr, "SIPRI: fatia %d: memoria insuficiente\n", f->id);
+                f->incompleta = 1;
+                break;
+            }
+            s->local_de[i] = local;
+        }
+        catalogoAtualizarPrecos(&f->cat);
     } else {
-        printf("%sImposto (%%): %s", CYAN, RESET);
-        lerLinha(buf, sizeof(buf));
-        p.imposto_percent = atof(buf);
+        catalogoAtualizarPrecos(&f->cat);
+        /* índices ordenados que já existiam são remontados agora, e não na
+           primeira FAIXA depois da mudança de config */
+        if (f->cat.ordenados.versao) catalogoOrdenado(&f->cat, ORDEM_PRECO);
     }
+}
 
-    printf("%sTaxa cartao (%%): %s", CYAN, RESET);
-    lerLinha(buf, sizeof(buf));
-    p.taxa_cartao_percent = atof(buf);
+/* ponto de parada da fatia: enquanto o coordenador pede, espera e executa
+   as tarefas que ele distribui */
+static void fatiaPausa(struct Fatia *f) {
+    struct Servidor *s = f->srv;
+    if (!atomic_load(&s->pausar)) return;
+    pthread_mutex_lock(&s->mutex);
+    s->paradas++;
+    pthread_cond_broadcast(&s->cond);
+    while (atomic_load(&s->pausar)) {
+        if (f->tarefa_vista == s->tarefa_rodada) {
+            pthread_cond_wait(&s->cond, &s->mutex);
+            continue;
+        }
+        f->tarefa_vista = s->tarefa_rodada;
+        int tarefa = s->tarefa;
+        pthread_mutex_unlock(&s->mutex);
+        fatiaTarefa(f, tarefa);
+        pthread_mutex_lock(&s->mutex);
+        s->tarefas_feitas++;
+        pthread_cond_broadcast(&s->cond);
+    }
+    s->paradas--;
+    pthread_mutex_unlock(&s->mutex);
+}
 
-    printf("%sLucro desejado (%%): %s", CYAN, RESET);
-    lerLinha(buf, sizeof(buf));
-    p.lucro_produtor_percent = atof(buf);
+static void fatiasParar(struct Servidor *s) {
+    pthread_mutex_lock(&s->mutex);
+    atomic_store(&s->pausar, 1);
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    for (int k = 0; k < s->qtd_fatias; k++) caixaAcordar(&s->fatias[k].caixa);
+    pthread_mutex_lock(&s->mutex);
+    while (s->paradas < s->qtd_fatias) pthread_cond_wait(&s->cond, &s->mutex);
+    pthread_mutex_unlock(&s->mutex);
+}
 
-    validarPercentuaisProduto(&p);
-    calcularTudo(&p);
+/* todas as fatias (paradas) executam a tarefa; volta quando todas acabaram */
+static void fatiasTarefa(struct Servidor *s, int tarefa) {
+    pthread_mutex_lock(&s->mutex);
+    s->tarefa = tarefa;
+    s->tarefas_feitas = 0;
+    s->tarefa_rodada++;
+    pthread_cond_broadcast(&s->cond);
+    while (s->tarefas_feitas < s->qtd_fatias) pthread_cond_wait(&s->cond, &s->mutex);
+    pthread_mutex_unlock(&s->mutex);
+}
 
-    imprimir_secao("RESULTADO");
-    imprimir_valor("Custo unitario (com rateio)", p.custo_unitario);
-    printf("%s%s> PRECO FINAL SUGERIDO: R$ %.2f%s\n", BOLD, GREEN, p.preco_produtor, RESET);
+static void fatiasRetomar(struct Servidor *s) {
+    pthread_mutex_lock(&s->mutex);
+    atomic_store(&s->pausar, 0);
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+}
 
-    pausar();
+/* fatia_de/local_de cobrem todos os slots do mestre (novos: em fatia nenhuma) */
+static int servidorLocalizacao(struct Servidor *s) {
+    int n = s->mestre->qtd;
+    if (n <= s->localizacao_capacidade) return 1;
+    int cap = s->localizacao_capacidade ? s->localizacao_capacidade : 1024;
+    while (cap < n) cap *= 2;
+    int *fatia_de = realloc(s->fatia_de, (size_t)cap * sizeof(int));
+    if (!fatia_de) return 0;
+    s->fatia_de = fatia_de;
+    int *local_de = realloc(s->local_de, (size_t)cap * sizeof(int));
+    if (!local_de) return 0;
+    s->local_de = local_de;
+    for (int i = s->localizacao_capacidade; i < cap; i++) s->fatia_de[i] = -1;
+    s->localizacao_capacidade = cap;
+    return 1;
 }
 
-/* ----- Menu curto após cadastro ----- */
-void menuPosCadastro(struct Produto produtos[], int *qtd, int idxRecente) {
-    char buf[BUF_SIZE];
-    int opc = 0;
-    while (1) {
-        imprimir_secao("O QUE DESEJA FAZER AGORA?");
-        printf("%s1%s - Salvar agora\n", GREEN, RESET);
-        printf("%s2%s - Editar este produto\n", GREEN, RESET);
-        printf("%s3%s - Excluir este produto\n", GREEN, RESET);
-        printf("%s4%s - Listar produtos\n", GREEN, RESET);
-        printf("%s5%s - Voltar ao menu principal\n", YELLOW, RESET);
+/* leva o slot m do mestre para a partição certa: atualiza no lugar, muda
+   de fatia (nome novo) ou sai (excluído) */
+static int fatiasAplicarSlot(struct Servidor *s, int m) {
+    struct Produto p;
+    int antes = s->fatia_de[m], depois = -1;
+    if (catalogoValido(s->mestre, m)) {
+        catalogoObter(s->mestre, m, &p);
+        depois = fatiaDoNome(p.nome, s->qtd_fatias);
+    }
+    if (antes >= 0 && antes != depois) {
+        catalogoRemover(&s->fatias[antes].cat, s->local_de[m]);
+        s->fatia_de[m] = -1;
+    }
+    if (depois < 0) return 1;
+    struct Fatia *f = &s->fatias[depois];
+    int local = s->local_de[m];
+    if (antes == depois) return catalogoGravar(&f->cat, local, &p);
+    local = catalogoAdicionar(&f->cat, &p);
+    if (local < 0 || !fatiaMestre(f, local, m)) return 0;
+    s->fatia_de[m] = depois;
+    s->local_de[m] = local;
+    return 1;
+}
 
-        printf("\n%sOpcao: %s", BOLD, RESET);
-        lerLinha(buf, sizeof(buf));
-        opc = atoi(buf);
+/* repassa às partições (fatias paradas) o que mudou no mestre: slot a slot
+   ou, depois de recarga/compactação, tudo de novo, em paralelo. versao é a
+   config_versao do início da época. Sem memória para isso, as partições
+   ficam marcadas incompletas e a próxima época reconstrói tudo */
+static void fatiasAplicar(struct Servidor *s, unsigned versao) {
+    struct Alteracoes *a = &s->alteracoes;
+    if (!servidorLocalizacao(s)) {
+        fprintf(stderr, "SIPRI: memoria insuficiente para repassar alteracoes\n");
+        s->incompleto = 1;
+        a->qtd = 0;
+        a->tudo = 1;
+        return;
+    }
+    catalogoAtualizarPrecos(s->mestre);
+    for (int k = 0; !a->tudo && k < a->qtd; k++)
+        if (!fatiasAplicarSlot(s, a->idx[k])) a->tudo = 1;
+    if (a->tudo) {
+        fatiasTarefa(s, TAREFA_ROTEAR);
+        fatiasTarefa(s, TAREFA_RECONSTRUIR);
+        s->incompleto = 0;
+        for (int k = 0; k < s->qtd_fatias; k++) s->incompleto |= s->fatias[k].incompleta;
+    } else if (versao != config_versao) {
+        fatiasTarefa(s, TAREFA_REPRECIFICAR);
+    }
+    a->qtd = 0;
+    a->tudo = s->incompleto;
+}
 
-        if (opc == 1) {
-            if (salvarProdutosAtomic(produtos, *qtd))
-                imprimir_sucesso("Produtos salvos!");
-            else
-                imprimir_erro("Falha ao salvar!");
-            pausar();
-        } else if (opc == 2) {
-            if (idxRecente >= 0 && idxRecente < *qtd) {
-                editarProduto(produtos, *qtd);
-            } else {
-                imprimir_erro("Indice do produto invalido para edicao.");
-                pausar();
-            }
-            break;
-        } else if (opc == 3) {
-            if (idxRecente >= 0 && idxRecente < *qtd) {
-                printf("%s%sTem certeza que deseja excluir o produto criado? (s/n): %s", BOLD, RED, RESET);
-                lerLinha(buf, sizeof(buf));
-                if (buf[0] == 's' || buf[0] == 'S') {
-                    excluirProdutoIndex(produtos, qtd, idxRecente);
-                    if (!salvarProdutosAtomic(produtos, *qtd))
-                        imprimir_aviso("Falha ao salvar apos exclusao.");
-                    imprimir_sucesso("Produto excluido!");
-                } else {
-                    printf("Operacao cancelada.\n");
+/* uma época: com as fatias paradas, alcança o estado publicado, aplica as
+   mutações pedidas e repassa tudo às partições; as respostas voltam às
+   fatias de origem depois que elas já podem ler as partições novas */
+static void servidorEpoca(struct Servidor *s, struct Mensagem *m) {
+    fatiasParar(s);
+    unsigned versao = config_versao;
+    catalogoSincronizar(s->mestre);
+    for (struct Mensagem *k = m; k; k = k->prox)
+        for (int i = 0; i < k->qtd; i++) {
+            servidorMutar(s->mestre, k->p[i].linha, k->p[i].r);
+            free(k->p[i].linha);
+            k->p[i].linha = NULL;
+        }
+    fatiasAplicar(s, versao);
+    atomic_store(&s->geracao, compartilhado.visto.geracao);
+    fatiasRetomar(s);
+    while (m) {
+        struct Mensagem *prox = m->prox;
+        m->volta = 1;
+        caixaEnviar(&s->fatias[m->origem].caixa, m);
+        m = prox;
+    }
+}
+
+/* o estado publicado mudou (outro processo confirmou algo): pede uma época
+   e espera por ela, para responder já com o que foi confirmado */
+static void fatiaSincronizar(struct Fatia *f) {
+    struct Servidor *s = f->srv;
+    struct EstadoCompartilhado e;
+    if (!estadoLer(&e) || e.geracao == atomic_load(&s->geracao)) return;
+    pthread_mutex_lock(&s->mutex);
+    atomic_store(&s->pedir_epoca, 1);
+    caixaAcordar(&s->coordenador);
+    while (!atomic_load(&s->pausar) && !atomic_load(&s->encerrar)) pthread_cond_wait(&s->cond, &s->mutex);
+    pthread_mutex_unlock(&s->mutex);
+    fatiaPausa(f);
+}
+
+/* ----- Servidor: laço de cada fatia ----- */
+/* pedidos de outras fatias são atendidos e devolvidos; respostas que
+   voltam completam o slot do anel (ou a coleta) e marcam a conexão */
+static void fatiaCaixa(struct Fatia *f) {
+    struct Servidor *s = f->srv;
+    struct Mensagem *m = caixaTirar(&f->caixa);
+    while (m) {
+        struct Mensagem *prox = m->prox;
+        if (m->volta) {
+            for (int i = 0; i < m->qtd; i++) {
+                struct Pedido *p = &m->p[i];
+                if (p->coleta) {
+                    coletaConcluir(f, p->coleta);
+                    continue;
                 }
-                pausar();
-            } else {
-                imprimir_erro("Indice do produto invalido para exclusao.");
-                pausar();
+                p->r->pronta = 1;
+                if (p->tipo == PEDIDO_MUTACAO) p->c->barreira = 0;
+                fatiaTocar(f, p->c);
             }
-            break;
-        } else if (opc == 4) {
-            listarProdutos(produtos, *qtd);
-        } else if (opc == 5) {
-            break;
+            mensagemLiberar(m);
         } else {
-            imprimir_erro("Opcao invalida!");
-            pausar();
+            for (int i = 0; i < m->qtd; i++) {
+                struct Pedido *p = &m->p[i];
+                if (p->tipo == PEDIDO_PRECO) fatiaPreco(f, p->nome, p->r);
+                else coletaParte(f, p->coleta);
+            }
+            m->volta = 1;
+            caixaEnviar(&s->fatias[m->origem].caixa, m);
         }
+        m = prox;
     }
 }
 
-/* ----- Cadastro de produto ----- */
-void cadastrarProduto(struct Produto produtos[], int *qtd) {
-    if (*qtd >= MAX_PRODUTOS) {
-        imprimir_erro("Limite de produtos atingido!");
-        pausar();
-        return;
+static void *fatiaLaco(void *arg) {
+    struct Fatia *f = arg;
+    struct Servidor *s = f->srv;
+    while (!atomic_load(&s->encerrar)) {
+        fatiaPausa(f);
+        int n = fatiaEsperar(f);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "SIPRI: fatia %d: %s\n", f->id, strerror(errno));
+            servidor_parar = 1;
+            caixaAcordar(&s->coordenador);
+            break;
+        }
+        /* o que outros processos confirmaram vale para esta rodada */
+        fatiaSincronizar(f);
+        for (int k = 0; k < n; k++) {
+            struct EventoServidor *ev = &f->eventos[k];
+            if (ev->ptr == &f->caixa) {
+                fatiaCaixa(f);
+            } else if (ev->ptr == s) {
+                fatiaAceitar(f);
+            } else {
+                struct Conexao *c = ev->ptr;
+                conexaoAtender(f, c, ev->ler);
+                if (ev->erro) c->morta = c->encerrar = 1;
+                fatiaRevisar(f, c);
+            }
+        }
+        while (f->qtd_tocadas > 0) {
+            struct Conexao *c = f->tocadas[--f->qtd_tocadas];
+            c->tocada = 0;
+            conexaoAtender(f, c, 0);
+            fatiaRevisar(f, c);
+        }
+        fatiaDespachar(f);
     }
+    return NULL;
+}
 
-    imprimir_cabecalho("CADASTRAR NOVO PRODUTO");
-
-    char buf[BUF_SIZE];
-    struct Produto p;
-    memset(&p, 0, sizeof(p));
+/* ----- Servidor: coordenador (thread principal) ----- */
+/* com as partições incompletas, acorda de tempos em tempos para tentar a
+   reconstrução de novo mesmo sem pedidos */
+static void coordenadorLaco(struct Servidor *s) {
+    struct pollfd pfd = { .fd = s->coordenador.aviso[0], .events = POLLIN };
+    while (!servidor_parar) {
+        if (poll(&pfd, 1, s->incompleto ? SERVIDOR_REPARO_MS : -1) < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "SIPRI: poll: %s\n", strerror(errno));
+            break;
+        }
+        struct Mensagem *m = caixaTirar(&s->coordenador);
+        int pedido = atomic_exchange(&s->pedir_epoca, 0);
+        if (m || pedido || s->incompleto) servidorEpoca(s, m);
+    }
+}
 
-    printf("\n%sNome do produto: %s", CYAN, RESET);
-    lerLinha(buf, sizeof(buf));
-    if (buf[0] == '\0') {
-        imprimir_aviso("Nome vazio — atribuindo nome padrao.");
-        snprintf(p.nome, sizeof(p.nome), "Produto %d", (*qtd) + 1);
-    } else {
-        strncpy(p.nome, buf, sizeof(p.nome)-1);
-        p.nome[sizeof(p.nome)-1] = '\0';
+/* socket de escuta não bloqueante; um socket que sobrou de um servidor que
+   caiu é apagado, mas não o de um que ainda atende */
+static int servidorOuvir(const char *caminho) {
+    struct sockaddr_un end;
+    memset(&end, 0, sizeof(end));
+    end.sun_family = AF_UNIX;
+    if (strlen(caminho) >= sizeof(end.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(end.sun_path, caminho);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (bind(fd, (struct sockaddr *)&end, sizeof(end)) != 0) {
+        int erro = errno, vivo = 1;
+        if (erro == EADDRINUSE) {
+            int t = socket(AF_UNIX, SOCK_STREAM, 0);
+            vivo = t < 0 || connect(t, (struct sockaddr *)&end, sizeof(end)) == 0;
+            if (t >= 0) close(t);
+        }
+        if (vivo || unlink(caminho) != 0 || bind(fd, (struct sockaddr *)&end, sizeof(end)) != 0) {
+            if (vivo) errno = erro;
+            close(fd);
+            return -1;
+        }
     }
+    if (listen(fd, SOMAXCONN) != 0 || fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+        close(fd);
+        unlink(caminho);
+        return -1;
+    }
+    return fd;
+}
 
-    printf("%sModo (1=custo direto/unidade | 2=receita com ingredientes): %s", CYAN, RESET);
-    lerLinha(buf, sizeof(buf));
-    p.modo = atoi(buf);
-    if (p.modo != 1 && p.modo != 2) p.modo = 1;
+/* fatias do servidor: --threads, ou uma por CPU */
+static int servidorFatias(void) {
+    int n = lote_trabalhadores;
+    if (n < 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n = cpus > 0 ? (int)cpus : 1;
+    }
+    if (n < 1) n = 1;
+    return n > FATIAS_MAX ? FATIAS_MAX : n;
+}
 
-    if (p.modo == 1) {
-        printf("%sPreco de custo por unidade (R$): %s", CYAN, RESET);
-        lerLinha(buf, sizeof(buf));
-        p.preco_custo = atof(buf);
-    } else {
-        imprimir_secao("INGREDIENTES DA RECEITA");
-        double custoCalc = coletarIngredientesText(p.ingredientes_desc, sizeof(p.ingredientes_desc), &p.rendimento);
-        if (custoCalc < 0.0) {
-            imprimir_erro("Erro na insercao de ingredientes. Cadastro cancelado.");
-            pausar();
-            return;
+static void servidorLiberar(struct Servidor *s, int iniciadas) {
+    for (int k = 0; k < iniciadas; k++) {
+        struct Fatia *f = &s->fatias[k];
+        while (f->qtd_con > 0) conexaoFechar(f, f->con[0]);
+        for (int d = 0; d <= s->qtd_fatias; d++)
+            if (f->lote[d]) mensagemLiberar(f->lote[d]);
+        /* o que ficou nas caixas no encerramento: as conexões já foram */
+        for (struct Mensagem *m = caixaTirar(&f->caixa), *prox; m; m = prox) {
+            prox = m->prox;
+            mensagemLiberar(m);
         }
-        p.investimento_total = custoCalc;
-
-        printf("\n%sDespesas variaveis (embalagem, entrega etc.) - R$ [Enter=0]: %s", CYAN, RESET);
-        lerLinha(buf, sizeof(buf));
-        if (buf[0] != '\0') p.despesas_variaveis = atof(buf);
-        else p.despesas_variaveis = 0.0;
+        fatiaEsperarLiberar(f);
+        caixaLiberar(&f->caixa);
+        catalogoLiberar(&f->cat);
+        free(f->mestre);
     }
+    for (struct Mensagem *m = caixaTirar(&s->coordenador), *prox; m; m = prox) {
+        prox = m->prox;
+        for (int i = 0; i < m->qtd; i++) free(m->p[i].linha);
+        mensagemLiberar(m);
+    }
+    caixaLiberar(&s->coordenador);
+    pthread_mutex_destroy(&s->mutex);
+    pthread_cond_destroy(&s->cond);
+    free(s->fatias);
+    free(s->fatia_de);
+    free(s->local_de);
+    free(s->alteracoes.idx);
+}
 
-    imprimir_secao("CONFIGURACOES FINANCEIRAS");
+static int comandoServe(const char *caminho) {
+    static struct Servidor srv;
+    struct Servidor *s = &srv;
+    struct Catalogo cat;
+    catalogoIniciar(&cat);
+    cat.alteracoes = &s->alteracoes;
+    if (!catalogoTravar(&cat)) {
+        fprintf(stderr, "SIPRI: nao foi possivel carregar %s\n", ARQ_PRODUTOS);
+        catalogoLiberar(&cat);
+        return 2;
+    }
+    catalogoDestravar();
+
+    s->mestre = &cat;
+    s->qtd_fatias = servidorFatias();
+    s->fatias = calloc((size_t)s->qtd_fatias, sizeof(*s->fatias));
+    s->ouvinte = servidorOuvir(caminho);
+    if (s->ouvinte < 0) {
+        fprintf(stderr, "SIPRI: nao foi possivel escutar em %s: %s\n", caminho,
+                errno == EADDRINUSE ? "ja existe um servidor nesse socket" : strerror(errno));
+        free(s->fatias);
+        catalogoLiberar(&cat);
+        return 2;
+    }
+    int iniciadas = 0, ok = s->fatias && caixaIniciar(&s->coordenador);
+    if (!ok) {
+        fprintf(stderr, "SIPRI: memoria insuficiente\n");
+        free(s->fatias);
+        close(s->ouvinte);
+        unlink(caminho);
+        catalogoLiberar(&cat);
+        return 2;
+    }
+    pthread_mutex_init(&s->mutex, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    for (; ok && iniciadas < s->qtd_fatias; iniciadas++) {
+        struct Fatia *f = &s->fatias[iniciadas];
+        f->id = iniciadas;
+        f->srv = s;
+        catalogoIniciar(&f->cat);
+#ifdef SIPRI_EPOLL
+        f->ep = -1;
+#endif
+        if (!caixaIniciar(&f->caixa)) {
+            ok = 0;
+            break;
+        }
+        ok = fatiaEsperarIniciar(f);
+    }
 
-    printf("%sUsar regime MEI COMERCIO (imposto 4%%)? (s/n): %s", CYAN, RESET);
-    lerLinha(buf, sizeof(buf));
-    if (buf[0] == 's' || buf[0] == 'S') {
-        p.usar_mei_comercio = 1;
-        p.imposto_percent = 4.0;
-        printf("%s✓ MEI Comercio aplicado (4%%)%s\n", GREEN, RESET);
+    /* SIGINT/SIGTERM encerram o coordenador (sem SA_RESTART: a espera volta
+       com EINTR); as fatias nascem com os sinais bloqueados, para que sejam
+       entregues a ele. Um cliente que fechou não derruba o servidor com
+       SIGPIPE */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = servidorSinal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* as fatias começam paradas: a primeira época monta as partições */
+    atomic_store(&s->pausar, 1);
+    int rodando = 0;
+    sigset_t todos, antes;
+    sigfillset(&todos);
+    pthread_sigmask(SIG_BLOCK, &todos, &antes);
+    for (; ok && rodando < s->qtd_fatias; rodando++)
+        if (pthread_create(&s->fatias[rodando].thread, NULL, fatiaLaco, &s->fatias[rodando]) != 0) ok = 0;
+    pthread_sigmask(SIG_SETMASK, &antes, NULL);
+
+    if (ok) {
+        fatiasParar(s);
+        s->alteracoes.tudo = 1;
+        fatiasAplicar(s, config_versao);
+        atomic_store(&s->geracao, compartilhado.visto.geracao);
+        fatiasRetomar(s);
+    }
+    if (ok && s->incompleto) {
+        /* nunca teve o catálogo inteiro: não começa a atender pela metade */
+        fprintf(stderr, "SIPRI: memoria insuficiente para montar as fatias\n");
+        ok = 0;
+    } else if (ok) {
+        fprintf(stderr, "SIPRI: %d produto(s) em %d fatia(s), atendendo em %s\n", catalogoVivos(&cat),
+                s->qtd_fatias, caminho);
+        coordenadorLaco(s);
     } else {
-        p.usar_mei_comercio = 0;
-        printf("%sPercentual de imposto (%%): %s", CYAN, RESET);
-        lerLinha(buf, sizeof(buf));
-        p.imposto_percent = atof(buf);
+        fprintf(stderr, "SIPRI: nao foi possivel iniciar as fatias: %s\n", strerror(errno));
     }
 
-    printf("%sTaxa da maquininha/cartao (%%) [ex: 2.5]: %s", CYAN, RESET);
-    lerLinha(buf, sizeof(buf));
-    p.taxa_cartao_percent = atof(buf);
+    pthread_mutex_lock(&s->mutex);
+    atomic_store(&s->encerrar, 1);
+    atomic_store(&s->pausar, 0);
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    for (int k = 0; k < rodando; k++) caixaAcordar(&s->fatias[k].caixa);
+    for (int k = 0; k < rodando; k++) pthread_join(s->fatias[k].thread, NULL);
+
+    /* só com as threads paradas: mensagens em voo ainda apontavam para as
+       conexões */
+    servidorLiberar(s, iniciadas);
+    close(s->ouvinte);
+    unlink(caminho);
+    cat.alteracoes = NULL;
+    catalogoLiberar(&cat);
+    fprintf(stderr, "SIPRI: %s\n", ok ? "servidor encerrado" : "servidor nao iniciado");
+    return ok ? 0 : 2;
+}
 
-    printf("%sPercentual de lucro desejado (%%): %s", CYAN, RESET);
-    lerLinha(buf, sizeof(buf));
-    p.lucro_produtor_percent = atof(buf);
+/* ----- Gerador de carga (SIPRI bench) ----- */
+/* cada cliente abre uma conexão e mantém até `pipeline` requisições em voo:
+   envia o lote numa escrita e lê as respostas; a latência de cada uma vai
+   do envio do lote até a chegada da sua linha */
+struct ClienteCarga {
+    const char *caminho;
+    const char *requisicao;     /* uma linha, com '\n' */
+    long qtd;
+    int pipeline;
+    long long *latencias;       /* ns, uma por requisição */
+    long respondidas;
+    long erros;
+    int falhou;
+};
 
-    /* valida percentuais antes de calcular */
-    validarPercentuaisProduto(&p);
+static long long relogioNs(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
 
-    calcularTudo(&p);
+static void *clienteCarga(void *arg) {
+    struct ClienteCarga *cl = arg;
+    struct sockaddr_un end;
+    memset(&end, 0, sizeof(end));
+    end.sun_family = AF_UNIX;
+    snprintf(end.sun_path, sizeof(end.sun_path), "%s", cl->caminho);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    size_t tam = strlen(cl->requisicao);
+    char *lote = malloc(tam * (size_t)cl->pipeline);
+    if (fd < 0 || !lote || connect(fd, (struct sockaddr *)&end, sizeof(end)) != 0) {
+        cl->falhou = 1;
+        if (fd >= 0) close(fd);
+        free(lote);
+        return NULL;
+    }
+    for (int k = 0; k < cl->pipeline; k++) memcpy(lote + tam * (size_t)k, cl->requisicao, tam);
+
+    char buf[65536];
+    int inicio_linha = 1;
+    while (cl->respondidas < cl->qtd && !cl->falhou) {
+        long n = cl->qtd - cl->respondidas < cl->pipeline ? cl->qtd - cl->respondidas : cl->pipeline;
+        long long t0 = relogioNs();
+        for (size_t env = 0, total = tam * (size_t)n; env < total; ) {
+            ssize_t w = write(fd, lote + env, total - env);
+            if (w <= 0) {
+                cl->falhou = 1;
+                break;
+            }
+            env += (size_t)w;
+        }
+        long faltam = n;
+        while (faltam > 0 && !cl->falhou) {
+            ssize_t r = read(fd, buf, sizeof(buf));
+            if (r <= 0) {
+                cl->falhou = 1;
+                break;
+            }
+            long long agora = relogioNs();
+            for (ssize_t i = 0; i < r; i++) {
+                if (inicio_linha && buf[i] == 'E') cl->erros++;
+                inicio_linha = buf[i] == '\n';
+                if (!inicio_linha) continue;
+                cl->latencias[cl->respondidas++] = agora - t0;
+                faltam--;
+            }
+        }
+    }
+    close(fd);
+    free(lote);
+    return NULL;
+}
 
-    /* garantir nome terminado e seguro já foi feito */
-    produtos[*qtd] = p;
-    int idxRecente = *qtd;
-    (*qtd)++;
+static int compararLatencia(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
 
-    /* salva em disco automaticamente e cria backup */
-    if (!salvarProdutosAtomic(produtos, *qtd)) {
-        imprimir_aviso("Falha ao salvar arquivo (produto ficou em memoria)");
+static int comandoBench(const char *caminho, int conexoes, long requisicoes, int pipeline, const char *nome) {
+    char requisicao[MAX_NOME + 16];
+    if (nome) snprintf(requisicao, sizeof(requisicao), "PRECO\t%s\n", nome);
+    else snprintf(requisicao, sizeof(requisicao), "CALCULO\tpreco_custo=10\timposto_percent=6\t"
+                  "taxa_cartao_percent=2.5\tlucro_produtor_percent=30\n");
+    struct ClienteCarga *cl = calloc((size_t)conexoes, sizeof(*cl));
+    pthread_t *th = calloc((size_t)conexoes, sizeof(*th));
+    long long *latencias = malloc((size_t)requisicoes * sizeof(long long));
+    if (!cl || !th || !latencias) {
+        fprintf(stderr, "SIPRI: memoria insuficiente\n");
+        free(cl);
+        free(th);
+        free(latencias);
+        return 2;
+    }
+    /* as requisições se dividem entre as conexões; cada uma grava as suas
+       latências no seu trecho do vetor */
+    long ini = 0;
+    for (int k = 0; k < conexoes; k++) {
+        cl[k].caminho = caminho;
+        cl[k].requisicao = requisicao;
+        cl[k].qtd = requisicoes / conexoes + (k < requisicoes % conexoes);
+        cl[k].pipeline = pipeline;
+        cl[k].latencias = latencias + ini;
+        ini += cl[k].qtd;
+    }
+    long long t0 = relogioNs();
+    int iniciadas = 0;
+    while (iniciadas < conexoes && pthread_create(&th[iniciadas], NULL, clienteCarga, &cl[iniciadas]) == 0)
+        iniciadas++;
+    for (int k = 0; k < iniciadas; k++) pthread_join(th[k], NULL);
+    double segundos = (double)(relogioNs() - t0) / 1e9;
+
+    /* junta as latências respondidas no começo do vetor */
+    long respondidas = 0, erros = 0;
+    int falhas = conexoes - iniciadas;
+    for (int k = 0; k < iniciadas; k++) {
+        memmove(latencias + respondidas, cl[k].latencias, (size_t)cl[k].respondidas * sizeof(long long));
+        respondidas += cl[k].respondidas;
+        erros += cl[k].erros;
+        falhas += cl[k].falhou;
     }
+    int codigo = 0;
+    if (respondidas > 0) {
+        qsort(latencias, (size_t)respondidas, sizeof(long long), compararLatencia);
+        printf("%ld requisicao(oes) em %.3f s: %.0f req/s (%d conexao(oes), pipeline %d)\n", respondidas,
+               segundos, (double)respondidas / segundos, conexoes, pipeline);
+        printf("latencia (us): p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+               (double)latencias[respondidas / 2] / 1e3, (double)latencias[respondidas * 99 / 100] / 1e3,
+               (double)latencias[respondidas * 999 / 1000] / 1e3, (double)latencias[respondidas - 1] / 1e3);
+    }
+    if (erros) printf("%ld resposta(s) ERRO\n", erros);
+    if (falhas) {
+        fprintf(stderr, "SIPRI: %d conexao(oes) com %s falharam\n", falhas, caminho);
+        codigo = 2;
+    }
+    free(cl);
+    free(th);
+    free(latencias);
+    return codigo;
+}
 
-    imprimir_secao("RESULTADO DO CADASTRO");
-    imprimir_sucesso("Produto cadastrado com sucesso!");
-    imprimir_valor("Custo unitario (com rateio)", p.custo_unitario);
-    imprimir_valor("PRECO FINAL AO CLIENTE", p.preco_produtor);
+int modoLote(int argc, char **argv) {
+    /* --threads N e --deterministic valem para qualquer comando: tira dos
+       argumentos */
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--deterministic") == 0) {
+            paralelo_deterministico = 1;
+            for (int k = i; k + 1 <= argc; k++) argv[k] = argv[k + 1];
+            argc--;
+            i--;
+            continue;
+        }
+        if (strcmp(argv[i], "--threads") != 0) continue;
+        char *fim;
+        long n = i + 1 < argc ? strtol(argv[i + 1], &fim, 10) : -1;
+        if (n < 0 || *fim != '\0') {
+            usoLote();
+            return 1;
+        }
+        lote_trabalhadores = (int)n;
+        for (int k = i; k + 2 <= argc; k++) argv[k] = argv[k + 2];
+        argc -= 2;
+        i--;
+    }
+    if (argc < 2) {
+        usoLote();
+        return 1;
+    }
 
-    /* menu curto pós-cadastro */
-    menuPosCadastro(produtos, qtd, idxRecente);
+    /* config.dat ausente: defaults, sem criar arquivo */
+    carregarConfig();
+
+    if (strcmp(argv[1], "price") == 0) {
+        const char *arq_in = NULL, *arq_out = NULL;
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--in") == 0 && i + 1 < argc) arq_in = argv[++i];
+            else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) arq_out = argv[++i];
+            else {
+                usoLote();
+                return 1;
+            }
+        }
+        if (!arq_in || !arq_out) {
+            usoLote();
+            return 1;
+        }
+        return comandoPrice(arq_in, arq_out);
+    }
+    if (strcmp(argv[1], "import") == 0) {
+        if (argc != 4 || strcmp(argv[2], "--in") != 0) {
+            usoLote();
+            return 1;
+        }
+        return comandoImport(argv[3]);
+    }
+    if (strcmp(argv[1], "export") == 0) {
+        const char *arq_out = NULL, *formato = "csv";
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) arq_out = argv[++i];
+            else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) formato = argv[++i];
+            else {
+                usoLote();
+                return 1;
+            }
+        }
+        int f = strcmp(formato, "csv") == 0 ? EXPORTA_CSV
+              : strcmp(formato, "jsonl") == 0 ? EXPORTA_JSONL
+              : strcmp(formato, "colunar") == 0 ? EXPORTA_COLUNAS : -1;
+        if (!arq_out || f < 0) {
+            usoLote();
+            return 1;
+        }
+        return comandoExport(f, arq_out);
+    }
+    if (strcmp(argv[1], "ingredient-prices") == 0) {
+        if (argc != 4 || strcmp(argv[2], "--in") != 0) {
+            usoLote();
+            return 1;
+        }
+        return comandoIngredientPrices(argv[3]);
+    }
+    if (strcmp(argv[1], "reprice-all") == 0 && argc == 2) return comandoRepriceAll();
+    if (strcmp(argv[1], "serve") == 0) {
+        const char *caminho = ARQ_SOCKET;
+        if (argc == 4 && strcmp(argv[2], "--socket") == 0) caminho = argv[3];
+        else if (argc != 2) {
+            usoLote();
+            return 1;
+        }
+        return comandoServe(caminho);
+    }
+    if (strcmp(argv[1], "bench") == 0) {
+        const char *caminho = ARQ_SOCKET, *nome = NULL;
+        long conexoes = 8, requisicoes = 200000, pipeline = 16;
+        for (int i = 2; i < argc; i++) {
+            long *alvo = strcmp(argv[i], "--conexoes") == 0 ? &conexoes
+                       : strcmp(argv[i], "--requisicoes") == 0 ? &requisicoes
+                       : strcmp(argv[i], "--pipeline") == 0 ? &pipeline : NULL;
+            char *fim = NULL;
+            if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) caminho = argv[++i];
+            else if (strcmp(argv[i], "--nome") == 0 && i + 1 < argc) nome = argv[++i];
+            else if (alvo && i + 1 < argc && (*alvo = strtol(argv[++i], &fim, 10)) > 0 && *fim == '\0') {}
+            else {
+                usoLote();
+                return 1;
+            }
+        }
+        if (conexoes > SERVIDOR_CONEXOES_MAX || pipeline > 4096) {
+            usoLote();
+            return 1;
+        }
+        return comandoBench(caminho, (int)conexoes, requisicoes, (int)pipeline, nome);
+    }
+    usoLote();
+    return 1;
 }
 
 /* ----- Menu principal ----- */
-int main() {
-    struct Produto produtos[MAX_PRODUTOS];
-    int qtd = 0;
+/* regravação completa pedida no menu, sob a trava */
+static int salvarProdutosTravado(struct Catalogo *cat) {
+    if (!catalogoTravar(cat)) return 0;
+    int ok = salvarProdutosAtomic(cat);
+    catalogoDestravar();
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    struct Catalogo catalogo;
+    catalogoIniciar(&catalogo);
 
     /* valores default */
     config.gasto_agua = 0.0;
@@ -793,26 +8157,40 @@ int main() {
     config.gasto_gas = 0.0;
     config.producao_mensal_unidades = 0;
 
-    /* carregar config e produtos ao iniciar */
+    /* argumentos na linha de comando: modo lote, sem menu */
+    if (argc > 1) return modoLote(argc, argv);
+
+    /* carregar config e produtos ao iniciar, sob a trava: a carga converte
+       formatos antigos e conserta o que uma queda deixou pela metade */
+    int travou = catalogoTravar(&catalogo);
     if (!carregarConfig()) {
         /* não existe config.dat: mantém defaults e tenta salvar (não crítico) */
         if (!salvarConfigAtomic()) {
             imprimir_aviso("Nao foi possivel criar config.dat com valores default.");
         }
     }
-
-    carregarProdutos(produtos, &qtd);
+    if (travou) catalogoDestravar();
+    /* produtos.dat é sempre regravado após mudar a config (ver opção 9) */
+    catalogo.versao_salva = config_versao;
+    if (catalogo.registros_corrompidos > 0) {
+        printf("\n%s%s%d registro(s) de produtos.dat com checksum invalido ou faltando (ver %s).%s\n",
+               BOLD, YELLOW, catalogo.registros_corrompidos, ARQ_PRODUTOS_QUARENTENA, RESET);
+        pausar();
+    }
 
     char buf[BUF_SIZE];
     int opc;
 
     do {
+        /* o que outros usuários confirmaram aparece a cada volta ao menu */
+        catalogoSincronizar(&catalogo);
         imprimir_cabecalho("SIPRI - SISTEMA DE PRECIFICACAO INTELIGENTE");
 
         printf("\n%s%sCONFIGURACOES ATUAIS:%s\n", BOLD, MAGENTA, RESET);
-        printf("%s+-%s Agua: R$ %.2f/mes\n", CYAN, RESET, config.gasto_agua);
-        printf("%s+-%s Luz:  R$ %.2f/mes\n", CYAN, RESET, config.gasto_luz);
-        printf("%s+-%s Gas:  R$ %.2f/mes\n", CYAN, RESET, config.gasto_gas);
+        char v[DINHEIRO_TAM];
+        printf("%s+-%s Agua: R$ %s/mes\n", CYAN, RESET, dinheiroTexto(config.gasto_agua, v));
+        printf("%s+-%s Luz:  R$ %s/mes\n", CYAN, RESET, dinheiroTexto(config.gasto_luz, v));
+        printf("%s+-%s Gas:  R$ %s/mes\n", CYAN, RESET, dinheiroTexto(config.gasto_gas, v));
         printf("%s+-%s Producao mensal: %d unidades\n", CYAN, RESET, config.producao_mensal_unidades);
 
         printf("\n%s%sMENU PRINCIPAL:%s\n", BOLD, YELLOW, RESET);
@@ -824,33 +8202,49 @@ int main() {
         printf("%s6%s - Configurar despesas fixas\n", GREEN, RESET);
         printf("%s7%s - Salvar produtos\n", GREEN, RESET);
         printf("%s8%s - Carregar produtos\n", GREEN, RESET);
+        printf("%s10%s - Buscar produtos (nome ou ingrediente)\n", GREEN, RESET);
+        printf("%s11%s - Consultar por faixa de preco/custo/margem\n", GREEN, RESET);
+        printf("%s12%s - Ingredientes (precos compartilhados)\n", GREEN, RESET);
         printf("%s9%s - Sair\n", RED, RESET);
 
         printf("\n%s%sOpcao: %s", BOLD, CYAN, RESET);
         lerLinha(buf, sizeof(buf));
         opc = atoi(buf);
+        /* o menu pode ter ficado parado: cada opção parte do estado atual */
+        catalogoSincronizar(&catalogo);
 
         switch (opc) {
-            case 1: cadastrarProduto(produtos, &qtd); break;
-            case 2: listarProdutos(produtos, qtd); break;
-            case 3: editarProduto(produtos, qtd); break;
-            case 4: excluirProduto(produtos, &qtd); break;
+            case 1: cadastrarProduto(&catalogo); break;
+            case 2: listarProdutos(&catalogo); break;
+            case 3: editarProduto(&catalogo); break;
+            case 4: excluirProduto(&catalogo); break;
             case 5: calculoRapido(); break;
             case 6: configurarDespesasFixas(); break;
             case 7:
-                if (salvarProdutosAtomic(produtos, qtd))
+                if (salvarProdutosTravado(&catalogo))
                     imprimir_sucesso("Produtos salvos!");
                 else
                     imprimir_erro("Falha ao salvar!");
                 pausar();
                 break;
+            case 10: buscarProdutos(&catalogo); break;
+            case 11: consultarFaixas(&catalogo); break;
+            case 12: gerenciarIngredientes(&catalogo); break;
             case 8:
-                carregarProdutos(produtos, &qtd);
+                if (catalogoTravar(&catalogo)) {
+                    carregarProdutos(&catalogo);
+                    catalogoDestravar();
+                }
                 imprimir_sucesso("Produtos carregados!");
-                printf("Total de produtos: %d\n", qtd);
+                printf("Total de produtos: %d\n", catalogoVivos(&catalogo));
                 pausar();
                 break;
             case 9:
+                /* despesas fixas mudaram e o arquivo ainda tem preços antigos */
+                if (catalogo.versao_salva != config_versao && !salvarProdutosTravado(&catalogo)) {
+                    imprimir_erro("Falha ao gravar produtos com os precos atualizados!");
+                    pausar();
+                }
                 limpar_tela();
                 printf("\n%s%sObrigado por usar o SIPRI!%s\n\n", BOLD, GREEN, RESET);
                 break;
@@ -860,5 +8254,6 @@ int main() {
         }
     } while (opc != 9);
 
+    catalogoLiberar(&catalogo);
     return 0;
 }
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Replay do log com o mesmo slot reaproveitado muitas vezes: cadastra A,
+# depois cadastra e exclui B mais vezes que CATALOGO_CAP_INICIAL (64) e
+# reabre o programa. Compilado com AddressSanitizer, para que uma escrita
+# fora da pilha de livres durante o replay derrube a reabertura.
+#
+#   sh tests/replay_livres.sh        (a partir da raiz do projeto)
+set -e
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+gcc -g -O1 -fsanitize=address -pthread main.c -o "$DIR/sipri" -lm
+cd "$DIR"
+
+{
+    # A: modo 1, custo 5, sem MEI, imposto 0, taxa 0, lucro 20; volta ao menu
+    printf '1\nA\n1\n5\nn\n0\n0\n20\n5\n'
+    i=0
+    while [ $i -lt 70 ]; do
+        # B no slot livre e, no menu pós-cadastro, excluído de novo
+        printf '1\nB\n1\n3\nn\n0\n0\n20\n3\ns\n\n'
+        i=$((i + 1))
+    done
+    printf '9\n'
+} | ./sipri > saida1.txt 2>&1
+
+# reabre: o replay de 141 entradas precisa chegar ao menu sem erro
+printf '2\n\n9\n' | ./sipri > saida2.txt 2>&1 || {
+    cat saida2.txt
+    echo "FALHOU: reabertura com replay"
+    exit 1
+}
+if grep -q 'ERROR: AddressSanitizer' saida2.txt; then
+    cat saida2.txt
+    echo "FALHOU: listagem depois do replay"
+    exit 1
+fi
+echo "ok"